@@ -0,0 +1,467 @@
+/**
+ * buffer_pool_benchmark.cpp
+ *
+ * Microbenchmarks for the buffer pool and its parts, so a change to
+ * LRUReplacer, ExtendibleHash or FetchPage can be measured instead of
+ * guessed. Build it as its own executable next to the library.
+ *
+ *   buffer_pool_benchmark                  the default sweep
+ *   buffer_pool_benchmark bench=bpm workload=zipf pool=1000 threads=8 ...
+ *
+ * bench=bpm: threads fetch pages of a file of `pages` pages, write
+ * `write_ratio` of them and unpin. workload is uniform, zipf (YCSB's
+ * scrambled Zipfian, skew `theta`) or scan (every thread reads the file in
+ * order from its own starting point). The database file lives on /dev/shm
+ * unless file= says otherwise, so the device is memory and read_us /
+ * write_us add the latency of the device being modelled. io=direct goes
+ * through OpenDirect (pass a file= on a file system that supports O_DIRECT),
+ * checksum=read|lazy turns on page checksums.
+ *
+ * bench=replacer: Insert / Erase / Victim churn on LRUReplacer, which is what
+ * UnpinPage / FetchPage / eviction do to it.
+ * bench=hash: Insert / Find / Remove on the page table.
+ *
+ * Every line printed is one configuration: throughput, p50 / p99 latency per
+ * operation and, for bench=bpm, hit rate, disk reads and writes per
+ * operation, the peak RSS of the process and how much of the database file
+ * the kernel has cached at the end (mincore), which is what io=direct saves.
+ * The default sweep forks a process per configuration, so both are per run.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buffer/buffer_pool_manager.h"
+#include "buffer/lru_replacer.h"
+#include "buffer/metrics.h"
+#include "buffer/zipfian.h"
+#include "common/exception.h"
+#include "hash/extendible_hash.h"
+
+namespace scudb {
+
+enum { BENCH_OPS = 0, BENCH_COUNTERS };
+static const char *const BENCH_COUNTER_NAMES[BENCH_COUNTERS] = {"ops"};
+enum { BENCH_LATENCY = 0, BENCH_HISTOGRAMS };
+static const char *const BENCH_HISTOGRAM_NAMES[BENCH_HISTOGRAMS] = {
+    "latency_ns"};
+
+struct BenchConfig {
+  std::string bench = "bpm";
+  std::string workload = "uniform";
+  size_t pool = 1000;
+  int pages = 10000;
+  int threads = 1;
+  long ops = 1000000; // over all threads
+  double theta = 0.99;
+  double write_ratio = 0.1;
+  uint32_t read_us = 0;
+  uint32_t write_us = 0;
+  std::string io = "buffered";
+  std::string checksum = "none";
+  std::string file = "/dev/shm/scudb_bench.db";
+};
+
+static inline uint64_t scramble(uint64_t x)
+{
+  // FNV-1a over the 8 bytes
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < 8; ++i)
+  {
+    hash ^= (x >> (i * 8)) & 0xff;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static long peakRssKb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// resident part of file in the OS page cache, -1 if it can not be mapped
+static long cachedKb(const std::string &file)
+{
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return st.st_size == 0 ? 0 : -1;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+  long os_page = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> resident((st.st_size + os_page - 1) / os_page);
+  long cached = -1;
+  if (mincore(data, st.st_size, resident.data()) == 0)
+  {
+    cached = 0;
+    for (unsigned char r : resident)
+      cached += r & 1;
+    cached = cached * os_page / 1024;
+  }
+  munmap(data, st.st_size);
+  return cached;
+}
+
+/*
+ * Run ops operations on threads threads, op(thread_id, rng) does one of them.
+ * Latency is recorded for every operation, the clock costs about as much as
+ * a buffer pool hit, so compare configurations with each other rather than
+ * with absolute numbers
+ */
+template <typename Op>
+static void runThreads(const BenchConfig &config, Metrics &metrics,
+                       double &seconds, const Op &op)
+{
+  std::vector<std::thread> threads;
+  uint64_t start = MetricsNow();
+  for (int t = 0; t < config.threads; ++t)
+  {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 rng(t * 7919 + 1);
+      long n = config.ops / config.threads;
+      for (long i = 0; i < n; ++i)
+      {
+        uint64_t begin = MetricsNow();
+        op(t, i, rng);
+        metrics.Record(BENCH_LATENCY, MetricsNow() - begin);
+      }
+      metrics.Add(BENCH_OPS, n);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  seconds = (MetricsNow() - start) / 1e9;
+}
+
+static void printResult(const BenchConfig &config, const std::string &name,
+                        Metrics &metrics, double seconds,
+                        const std::string &extra)
+{
+  MetricsSnapshot snapshot;
+  metrics.Snapshot(snapshot);
+  const HistogramSnapshot &latency = snapshot.histograms[BENCH_LATENCY];
+  printf("%-44s threads %2d  %10.0f ops/s  p50 %7lu ns  p99 %8lu ns%s\n",
+         name.c_str(), config.threads, snapshot.Get("ops") / seconds,
+         latency.Percentile(50), latency.Percentile(99), extra.c_str());
+}
+
+static void benchBufferPool(const BenchConfig &config)
+{
+  std::remove(config.file.c_str());
+  DiskManager disk_manager(config.file);
+  BufferPoolManager bpm(config.pool, &disk_manager);
+  if (config.io == "direct" && !bpm.OpenDirect(config.file))
+  {
+    printf("%s: O_DIRECT not supported, skipped\n", config.file.c_str());
+    return;
+  }
+  if (config.checksum == "read")
+    bpm.SetChecksumMode(ChecksumMode::VERIFY_ON_READ);
+  else if (config.checksum == "lazy")
+    bpm.SetChecksumMode(ChecksumMode::VERIFY_LAZY);
+
+  // 先把文件建出来，池子放不下的页会被换出写盘
+  std::vector<page_id_t> page_ids(config.pages);
+  for (int i = 0; i < config.pages; ++i)
+  {
+    Page *page = bpm.NewPage(page_ids[i]);
+    if (page == nullptr)
+      throw Exception(EXCEPTION_TYPE_INVALID, "all pages pinned while loading");
+    memcpy(page->GetData(), &i, sizeof(int));
+    bpm.UnpinPage(page_ids[i], true);
+  }
+  for (int i = 0; i < config.pages; ++i)
+    bpm.FlushPage(page_ids[i]);
+  bpm.SetSimulatedLatency(config.read_us, config.write_us);
+  bpm.ResetMetrics();
+
+  ZipfianGenerator zipf(config.pages, config.theta);
+  std::vector<long> cursors(config.threads);
+  for (int t = 0; t < config.threads; ++t)
+    cursors[t] = static_cast<long>(config.pages) * t / config.threads;
+  int write_every = config.write_ratio > 0
+                        ? std::max(1, static_cast<int>(1 / config.write_ratio))
+                        : 0;
+
+  Metrics metrics(BENCH_COUNTER_NAMES, BENCH_COUNTERS, BENCH_HISTOGRAM_NAMES,
+                  BENCH_HISTOGRAMS);
+  double seconds;
+  runThreads(config, metrics, seconds,
+             [&](int t, long i, std::mt19937_64 &rng) {
+    long item;
+    if (config.workload == "zipf")
+      item = scramble(zipf.Next(rng)) % config.pages;
+    else if (config.workload == "scan")
+      item = cursors[t]++ % config.pages;
+    else
+      item = rng() % config.pages;
+    page_id_t page_id = page_ids[item];
+    Page *page = bpm.FetchPage(page_id);
+    if (page == nullptr)
+      return;
+    bool dirty = write_every > 0 && i % write_every == 0;
+    if (dirty)
+    {
+      page->WLatch();
+      page->GetData()[sizeof(int)]++;
+      page->WUnlatch();
+    }
+    bpm.UnpinPage(page_id, dirty);
+  });
+
+  MetricsSnapshot snapshot;
+  bpm.GetMetrics(snapshot);
+  double fetches = std::max<int64_t>(1, snapshot.Get("bpm_fetches"));
+  char extra[192];
+  snprintf(extra, sizeof(extra),
+           "  hit %5.1f%%  reads/op %.3f  writes/op %.3f  rss %ld KB"
+           "  cache %ld KB",
+           100.0 * snapshot.Get("bpm_hits") / fetches,
+           snapshot.Get("bpm_misses") / fetches,
+           snapshot.Get("bpm_write_backs") / fetches, peakRssKb(),
+           cachedKb(config.file));
+  std::string name = "bpm " + config.workload + " pool " +
+                     std::to_string(config.pool) + "/" +
+                     std::to_string(config.pages) + " " + config.io;
+  if (config.checksum != "none")
+    name += " crc-" + config.checksum;
+  printResult(config, name, metrics, seconds, extra);
+  bpm.CloseDirect();
+  std::remove(config.file.c_str());
+}
+
+/*
+ * Each thread works on its own frames: a pinned frame leaves the replacer
+ * (Erase), is unpinned again (Insert) and every so often one is evicted
+ * (Victim) and put back, like a miss
+ */
+static void benchReplacer(const BenchConfig &config)
+{
+  LRUReplacer<Page *> replacer;
+  std::vector<Page> frames(config.pool);
+  for (auto &frame : frames)
+    replacer.Insert(&frame);
+  Metrics metrics(BENCH_COUNTER_NAMES, BENCH_COUNTERS, BENCH_HISTOGRAM_NAMES,
+                  BENCH_HISTOGRAMS);
+  double seconds;
+  runThreads(config, metrics, seconds,
+             [&](int t, long i, std::mt19937_64 &rng) {
+    if (i % 10 == 0)
+    {
+      Page *victim;
+      if (replacer.Victim(victim))
+        replacer.Insert(victim);
+      return;
+    }
+    Page *frame = &frames[rng() % frames.size()];
+    replacer.Erase(frame);
+    replacer.Insert(frame);
+  });
+  printResult(config, "lru replacer " + std::to_string(config.pool) + " frames",
+              metrics, seconds, "");
+}
+
+/*
+ * The page table is only used under the pool latch, so one thread: half
+ * lookups that hit, a quarter that miss, a quarter remove + insert
+ */
+static void benchHash(const BenchConfig &config)
+{
+  ExtendibleHash<page_id_t, Page *> table(BUCKET_SIZE);
+  for (int i = 0; i < config.pages; ++i)
+    table.Insert(i, nullptr);
+  BenchConfig single = config;
+  single.threads = 1;
+  Metrics metrics(BENCH_COUNTER_NAMES, BENCH_COUNTERS, BENCH_HISTOGRAM_NAMES,
+                  BENCH_HISTOGRAMS);
+  double seconds;
+  runThreads(single, metrics, seconds,
+             [&](int, long i, std::mt19937_64 &rng) {
+    Page *page;
+    page_id_t page_id = rng() % config.pages;
+    switch (i % 4)
+    {
+    case 0:
+    case 1:
+      table.Find(page_id, page);
+      break;
+    case 2:
+      table.Find(config.pages + page_id, page);
+      break;
+    default:
+      table.Remove(page_id);
+      table.Insert(page_id, nullptr);
+    }
+  });
+  char extra[64];
+  snprintf(extra, sizeof(extra), "  buckets %d  global depth %d",
+           table.GetNumBuckets(), table.GetGlobalDepth());
+  printResult(single, "extendible hash " + std::to_string(config.pages) + " keys",
+              metrics, seconds, extra);
+}
+
+static void runBench(const BenchConfig &config)
+{
+  if (config.bench == "replacer")
+    benchReplacer(config);
+  else if (config.bench == "hash")
+    benchHash(config);
+  else
+    benchBufferPool(config);
+}
+
+/*
+ * Peak RSS only ever grows within a process, so every configuration of the
+ * sweep gets a fresh one
+ */
+static void runIsolated(const BenchConfig &config)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    runBench(config);
+    return;
+  }
+  if (pid == 0)
+  {
+    runBench(config);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+}
+
+/*
+ * Hit-heavy and miss-heavy pools under every workload and a few thread
+ * counts, then the replacer and page table on their own, then the price of
+ * checksums and of O_DIRECT on a miss-heavy pool
+ */
+static void defaultSweep(BenchConfig config)
+{
+  unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (const char *workload : {"uniform", "zipf", "scan"})
+  {
+    for (size_t pool : {config.pages / 10, config.pages * 9 / 10})
+    {
+      for (int threads : {1, 4, static_cast<int>(hardware)})
+      {
+        BenchConfig c = config;
+        c.workload = workload;
+        c.pool = pool;
+        c.threads = threads;
+        runIsolated(c);
+      }
+    }
+  }
+  for (int threads : {1, 4})
+  {
+    BenchConfig c = config;
+    c.bench = "replacer";
+    c.threads = threads;
+    runIsolated(c);
+  }
+  BenchConfig hash = config;
+  hash.bench = "hash";
+  runIsolated(hash);
+  for (const char *checksum : {"none", "read", "lazy"})
+  {
+    BenchConfig c = config;
+    c.pool = config.pages / 10;
+    c.checksum = checksum;
+    runIsolated(c);
+  }
+  for (const char *io : {"buffered", "direct"})
+  {
+    BenchConfig c = config;
+    c.pool = config.pages / 10;
+    c.io = io;
+    runIsolated(c);
+  }
+}
+
+} // namespace scudb
+
+int main(int argc, char **argv)
+{
+  using namespace scudb;
+  BenchConfig config;
+  std::map<std::string, std::string> args;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+    {
+      fprintf(stderr, "usage: %s [name=value]..., see the top of "
+                      "buffer_pool_benchmark.cpp\n", argv[0]);
+      return 1;
+    }
+    args[arg.substr(0, eq)] = arg.substr(eq + 1);
+  }
+  for (auto &arg : args)
+  {
+    const std::string &name = arg.first;
+    const char *value = arg.second.c_str();
+    if (name == "bench")
+      config.bench = value;
+    else if (name == "workload")
+      config.workload = value;
+    else if (name == "pool")
+      config.pool = atol(value);
+    else if (name == "pages")
+      config.pages = atoi(value);
+    else if (name == "threads")
+      config.threads = std::max(1, atoi(value));
+    else if (name == "ops")
+      config.ops = atol(value);
+    else if (name == "theta")
+      config.theta = atof(value);
+    else if (name == "write_ratio")
+      config.write_ratio = atof(value);
+    else if (name == "read_us")
+      config.read_us = atoi(value);
+    else if (name == "write_us")
+      config.write_us = atoi(value);
+    else if (name == "io")
+      config.io = value;
+    else if (name == "checksum")
+      config.checksum = value;
+    else if (name == "file")
+      config.file = value;
+    else
+    {
+      fprintf(stderr, "unknown parameter %s\n", name.c_str());
+      return 1;
+    }
+  }
+  if (args.empty())
+    defaultSweep(config);
+  else
+    runBench(config);
+  return 0;
+}
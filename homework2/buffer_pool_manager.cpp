@@ -1,38 +1,135 @@
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "buffer/buffer_pool_manager.h"
+#include "buffer/free_space_map.h"
+#include "common/exception.h"
+#include "common/logger.h"
 
 namespace scudb {
 
+// O_DIRECT transfers whole pages at page offsets, so a device that takes
+// them works in blocks of at most PAGE_SIZE; buffers are aligned to that
+static const size_t DIRECT_IO_BLOCK =
+    PAGE_SIZE < DIRECT_IO_ALIGNMENT ? PAGE_SIZE : DIRECT_IO_ALIGNMENT;
+
+// rec_lsns_ entry of a frame nobody needs to redo
+static const uint64_t NO_REC_LSN = ~0ULL;
+
+// frame_pins_ of a frame that is getting another page
+static const int FRAME_LOCKED = -1;
+
+// mbind(2) policies, numaif.h belongs to libnuma which we do not link
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+
+// verify_states_ of a frame
+enum { PAGE_VERIFIED = 0, PAGE_UNVERIFIED, PAGE_VERIFYING, PAGE_CORRUPT };
+
+// metrics_
+enum {
+  BPM_FETCHES = 0,
+  BPM_HITS,
+  BPM_MISSES,
+  BPM_EVICTIONS,    // a page was pushed out to make room
+  BPM_WRITE_BACKS,  // a dirty page was written, on eviction or flush
+  BPM_NEW_PAGES,
+  BPM_DELETED_PAGES,
+  BPM_PINS,
+  BPM_UNPINS,
+  BPM_CHECKSUM_FAILURES,
+  BPM_SWIZZLED_HITS, // hits through the frame, no latch_ or page table lookup
+  BPM_MAPPED_WRITES, // NewPage, DeletePage or dirty unpin refused while mapped
+  BPM_COUNTERS
+};
+static const char *const BPM_COUNTER_NAMES[BPM_COUNTERS] = {
+    "bpm_fetches",    "bpm_hits",          "bpm_misses",
+    "bpm_evictions",  "bpm_write_backs",   "bpm_new_pages",
+    "bpm_deleted_pages", "bpm_pins",       "bpm_unpins",
+    "bpm_checksum_failures", "bpm_swizzled_hits", "bpm_mapped_writes"};
+enum { BPM_LATCH_WAIT = 0, BPM_READ, BPM_WRITE, BPM_HISTOGRAMS };
+static const char *const BPM_HISTOGRAM_NAMES[BPM_HISTOGRAMS] = {
+    "bpm_latch_wait_ns", "bpm_read_ns", "bpm_write_ns"};
+
+/*
+ * A page that has never been written reads back as zeros, that is not a
+ * checksum failure
+ */
+static bool checksumMatches(const char *data)
+{
+  uint32_t stored;
+  memcpy(&stored, data + PAGE_SIZE - PAGE_CHECKSUM_SIZE, sizeof(uint32_t));
+  if (stored == Crc32c(data, PAGE_SIZE - PAGE_CHECKSUM_SIZE))
+    return true;
+  for (int i = 0; i < PAGE_SIZE; ++i)
+  {
+    if (data[i] != 0)
+      return false;
+  }
+  return true;
+}
+
 /*
  * BufferPoolManager Constructor
- * When log_manager is nullptr, logging is disabled (for test purpose)
- * WARNING: Do Not Edit This Function
+ * When log_manager is nullptr, logging is disabled (for test purpose).
+ * The frames and their page data come from allocateFrames, placed on
+ * numa_node
  */
 BufferPoolManager::BufferPoolManager(size_t pool_size,
                                                  DiskManager *disk_manager,
-                                                 LogManager *log_manager)
-    : pool_size_(pool_size), disk_manager_(disk_manager),
-      log_manager_(log_manager) {
+                                                 LogManager *log_manager,
+                                                 int numa_node)
+    : pool_size_(pool_size), numa_node_(numa_node), disk_manager_(disk_manager),
+      log_manager_(log_manager), checksum_mode_(ChecksumMode::NONE),
+      mapped_data_(nullptr), mapped_pages_(0), view_states_(nullptr),
+      direct_fd_(-1),
+      free_space_map_(nullptr),
+      metrics_(BPM_COUNTER_NAMES, BPM_COUNTERS, BPM_HISTOGRAM_NAMES,
+               BPM_HISTOGRAMS),
+      read_latency_us_(0), write_latency_us_(0) {
   // a consecutive memory space for buffer pool
-  pages_ = new Page[pool_size_];
+  allocateFrames();
   page_table_ = new ExtendibleHash<page_id_t, Page *>(BUCKET_SIZE);
   replacer_ = new LRUReplacer<Page *>;
   free_list_ = new std::list<Page *>;
+  rec_lsns_ = new std::atomic<uint64_t>[pool_size_];
+  verify_states_ = new std::atomic<int>[pool_size_];
+  frame_pins_ = new std::atomic<int>[pool_size_];
 
   // put all the pages into free list
   for (size_t i = 0; i < pool_size_; ++i) {
-    free_list_->push_back(&pages_[i]);
+    free_list_->push_back(frame(i));
+    rec_lsns_[i] = NO_REC_LSN;
+    verify_states_[i] = PAGE_VERIFIED;
+    frame_pins_[i] = 0;
   }
 }
 
 /*
  * BufferPoolManager Deconstructor
- * WARNING: Do Not Edit This Function
+ * Frames go back through freeFrames, the way allocateFrames got them
  */
 BufferPoolManager::~BufferPoolManager() {
-  delete[] pages_;
+  freeFrames();
   delete page_table_;
   delete replacer_;
   delete free_list_;
+  delete[] rec_lsns_;
+  delete[] verify_states_;
+  delete[] frame_pins_;
+  UnmapFile();
+  CloseDirect();
+  delete free_space_map_;
 }
 
 /**
@@ -47,35 +144,94 @@ BufferPoolManager::~BufferPoolManager() {
  * pointer
  */
 Page *BufferPoolManager::FetchPage(page_id_t page_id) 
-{ 
-  lock_guard<mutex> lck(latch_);      //解决多线程问题，之后的实现中都需要考虑
+{
+  return FetchPage(page_id, nullptr);
+}
 
+/*
+ * Fetch through a swizzled reference. A hit takes no latch: the frame is
+ * pinned in frame_pins_ first and then checked to still hold page_id. A
+ * frame only gets another page while its frame_pins_ is locked, which fails
+ * while it is pinned, so a frame that still has page_id keeps it. A stale
+ * reference, or a frame that is just being replaced, goes through latch_
+ */
+Page *BufferPoolManager::FetchPage(page_id_t page_id, Page *frame)
+{ 
   Page* tar_page = nullptr;
-  if(page_table_->Find(page_id,tar_page))     //如果能够找到，返回
+  if (frame != nullptr && (tar_page = pinFrame(page_id, frame)) != nullptr)
   {
-    tar_page->pin_count_++;
-    replacer_->Erase(tar_page);
-    return tar_page;
+    metrics_.Add(BPM_FETCHES);
+    metrics_.Add(BPM_HITS);
+    metrics_.Add(BPM_SWIZZLED_HITS);
+    metrics_.Add(BPM_PINS);
   }
+  else
+  {
+    acquireLatch();
+    lock_guard<mutex> lck(latch_, adopt_lock);      //解决多线程问题，之后的实现中都需要考虑
+    metrics_.Add(BPM_FETCHES);
 
-  tar_page = findUsePage();
-  if(tar_page == nullptr)
-    return tar_page;
+    if(page_table_->Find(page_id,tar_page))     //如果能够找到，返回
+    {
+      metrics_.Add(BPM_HITS);
+      initRecLSN(tar_page);
+      tar_page->pin_count_++;
+      replacer_->Erase(tar_page);
+    }
+    else
+    {
+      metrics_.Add(BPM_MISSES);
+      tar_page = findUsePage();
+      if(tar_page == nullptr)
+        return tar_page;
 
-  // 脏页写回
-  if(tar_page->is_dirty_)
-    disk_manager_->WritePage(tar_page->GetPageId(),tar_page->data_);
+      // 脏页写回
+      if(tar_page->is_dirty_)
+        writeBackPage(tar_page);
 
-  // 删除旧页面
-  page_table_->Remove(tar_page->GetPageId());
-  page_table_->Insert(page_id,tar_page);
+      // 删除旧页面
+      page_table_->Remove(tar_page->GetPageId());
 
-  // 获取页面，返回页面指针
-  disk_manager_->ReadPage(page_id,tar_page->data_);
-  tar_page->pin_count_ = 1;   // 获取后pincount+1
-  tar_page->is_dirty_ = false;    // 脏位清除
-  tar_page->page_id_ = page_id;
+      // 获取页面，校验失败的页不能留在缓冲池里
+      const char *view = mappedPage(page_id);
+      if(view != nullptr)
+        memcpy(tar_page->data_, view, PAGE_SIZE);   // 映射里有就不走 ReadPage
+      else
+        readPage(page_id,tar_page->data_);
+      if(checksum_mode_ == ChecksumMode::VERIFY_ON_READ &&
+         !checksumMatches(tar_page->data_))
+      {
+        tar_page->ResetMemory();
+        tar_page->is_dirty_ = false;
+        tar_page->page_id_ = INVALID_PAGE_ID;
+        clearRecLSN(tar_page);
+        unlockFrame(tar_page);
+        free_list_->push_back(tar_page);
+        metrics_.Add(BPM_CHECKSUM_FAILURES);
+        throw Exception(EXCEPTION_TYPE_INVALID,
+                        "checksum mismatch on page " + std::to_string(page_id));
+      }
+      page_table_->Insert(page_id,tar_page);
+      tar_page->pin_count_ = 1;   // 获取后pincount+1
+      tar_page->is_dirty_ = false;    // 脏位清除
+      tar_page->page_id_ = page_id;
+      setRecLSN(tar_page);
+      verify_states_[frameIndex(tar_page)] =
+          checksum_mode_ == ChecksumMode::VERIFY_LAZY ? PAGE_UNVERIFIED
+                                                      : PAGE_VERIFIED;
+      unlockFrame(tar_page);
+    }
+    metrics_.Add(BPM_PINS);
+  }
 
+  // 懒校验在 latch_ 外面做，只有第一个拿到页的线程真正计算
+  if(checksum_mode_ == ChecksumMode::VERIFY_LAZY && !verifyPage(tar_page))
+  {
+    UnpinPage(page_id, false);
+    metrics_.Add(BPM_CHECKSUM_FAILURES);
+    throw Exception(EXCEPTION_TYPE_INVALID,
+                    "checksum mismatch on page " + std::to_string(page_id));
+  }
   return tar_page; 
 }
 
@@ -87,27 +243,37 @@ Page *BufferPoolManager::FetchPage(page_id_t page_id)
  */
 bool BufferPoolManager::UnpinPage(page_id_t page_id, bool is_dirty) 
 {
-  lock_guard<mutex> lck(latch_);
+  acquireLatch();
+  lock_guard<mutex> lck(latch_, adopt_lock);
   Page* tar_page = nullptr;
        
   if (page_table_->Find(page_id, tar_page) )
+    return unpinFrame(tar_page, is_dirty);
+  return false;
+}
+
+/*
+ * The caller's pin keeps the page in its frame, no page table lookup needed.
+ * A clean unpin of a pin taken without latch_ does not take it either, except
+ * for the last one: it clears the recovery LSN of the frame, which needs
+ * latch_ to see that nobody pinned the page through the page table
+ */
+bool BufferPoolManager::UnpinPage(Page *page, bool is_dirty)
+{
+  if (!is_dirty && releaseFramePin(page))
   {
-    tar_page->is_dirty_ = is_dirty;
-    if (tar_page->pin_count_ > 0) 
+    metrics_.Add(BPM_UNPINS);
+    if (frame_pins_[frameIndex(page)] == 0)
     {
-      tar_page->pin_count_--;
-      if (tar_page->pin_count_ == 0) 
-      {
-        replacer_->Insert(tar_page);
-      }
-      return true;
-    } 
-    else 
-    {
-      return false;
+      acquireLatch();
+      lock_guard<mutex> lck(latch_, adopt_lock);
+      clearIfQuiet(page);
     }
+    return true;
   }
-  return false;
+  acquireLatch();
+  lock_guard<mutex> lck(latch_, adopt_lock);
+  return unpinFrame(page, is_dirty);
 }
 
 /*
@@ -115,20 +281,33 @@ bool BufferPoolManager::UnpinPage(page_id_t page_id, bool is_dirty)
  * write_page method of the disk manager
  * if page is not found in page table, return false
  * NOTE: make sure page_id != INVALID_PAGE_ID
+ * Written like in FlushDirtyPages, under the page's read latch and not
+ * latch_, so the caller must not hold the page latch
  */
 bool BufferPoolManager::FlushPage(page_id_t page_id) 
 { 
-  lock_guard<mutex> lck(latch_);
   Page* tar_page = nullptr;
-
-  // 确保pageid有效
-  if(!page_table_->Find(page_id, tar_page) || tar_page->page_id_ == INVALID_PAGE_ID)
-    return false;
-  if(tar_page->is_dirty_)
   {
-    disk_manager_->WritePage(page_id,tar_page->GetData());
+    acquireLatch();
+    lock_guard<mutex> lck(latch_, adopt_lock);
+
+    // 确保pageid有效
+    if(!page_table_->Find(page_id, tar_page) || tar_page->page_id_ == INVALID_PAGE_ID)
+      return false;
+    if(!tar_page->is_dirty_)
+      return true;
+    // pin 住以后帧不会被换走，放掉 latch_ 再写
+    if (tar_page->pin_count_++ == 0)
+      replacer_->Erase(tar_page);
+    metrics_.Add(BPM_PINS);
     tar_page->is_dirty_ = false;
+    setRecLSN(tar_page);
   }
+
+  tar_page->RLatch();
+  writeBackPage(tar_page);
+  tar_page->RUnlatch();
+  UnpinPage(tar_page, false);
   return true; 
 }
 
@@ -138,49 +317,84 @@ bool BufferPoolManager::FlushPage(page_id_t page_id)
  * table, buffer pool manager should be reponsible for removing this entry out
  * of page table, reseting page metadata and adding back to free list. Second,
  * call disk manager's DeallocatePage() method to delete from disk file. If
- * the page is found within page table, but pin_count != 0, return false
+ * the page is found within page table, but pin_count != 0, return false.
+ * Also false while the file is mapped, the mapping is read only
  */
 bool BufferPoolManager::DeletePage(page_id_t page_id) 
 {
-  lock_guard<mutex> lck(latch_);
-  Page* tar_page = nullptr;
-
-  if (page_table_->Find(page_id,tar_page)) 
+  if (mapped_data_ != nullptr)
   {
-    if (tar_page->pin_count_ > 0)      // pincount > 0  不能删除
-      return false;
-    replacer_->Erase(tar_page);
-    page_table_->Remove(page_id);
-    tar_page->is_dirty_= false;
-    tar_page->ResetMemory();
-    free_list_->push_back(tar_page);
+    metrics_.Add(BPM_MAPPED_WRITES);
+    return false;
+  }
+  {
+    acquireLatch();
+    lock_guard<mutex> lck(latch_, adopt_lock);
+    Page* tar_page = nullptr;
+
+    if (page_table_->Find(page_id,tar_page)) 
+    {
+      if (tar_page->pin_count_ > 0 || !lockFrame(tar_page))  // 有人钉着不能删除
+        return false;
+      replacer_->Erase(tar_page);
+      page_table_->Remove(page_id);
+      tar_page->is_dirty_= false;
+      clearRecLSN(tar_page);
+      verify_states_[frameIndex(tar_page)] = PAGE_VERIFIED;
+      tar_page->ResetMemory();
+      tar_page->page_id_ = INVALID_PAGE_ID;   // 回到空闲链表的页不属于任何页号
+      unlockFrame(tar_page);
+      free_list_->push_back(tar_page);
+    }
   }
+  // 位图页也要经过缓冲池，不能持有 latch_
+  if (free_space_map_ != nullptr)
+    free_space_map_->Free(page_id);
   disk_manager_->DeallocatePage(page_id);
+  metrics_.Add(BPM_DELETED_PAGES);
   return true;
 }
 
 /**
  * User should call this method if needs to create a new page. This routine
- * will call disk manager to allocate a page.
+ * will call disk manager to allocate a page (the free space map, if enabled,
+ * picks one near hint instead).
  * Buffer pool manager should be responsible to choose a victim page either
  * from free list or lru replacer(NOTE: always choose from free list first),
  * update new page's metadata, zero out memory and add corresponding entry
  * into page table. return nullptr if all the pages in pool are pinned
  */
-Page *BufferPoolManager::NewPage(page_id_t &page_id) 
+Page *BufferPoolManager::NewPage(page_id_t &page_id, page_id_t hint) 
 {
-  lock_guard<mutex> lck(latch_);
+  // 映射是只读的
+  if (mapped_data_ != nullptr)
+  {
+    metrics_.Add(BPM_MAPPED_WRITES);
+    return nullptr;
+  }
+  if (free_space_map_ != nullptr)
+  {
+    page_id = free_space_map_->Allocate(hint);
+    if (page_id == INVALID_PAGE_ID)
+      return nullptr;
+  }
+  acquireLatch();
+  unique_lock<mutex> lck(latch_, adopt_lock);
   Page* tar_page = nullptr;
   tar_page = findUsePage();
   if(tar_page == nullptr)
+  {
+    lck.unlock();
+    if (free_space_map_ != nullptr)
+      free_space_map_->Free(page_id);
     return tar_page;
+  }
 
-  
-
-  page_id = disk_manager_->AllocatePage();
+  if (free_space_map_ == nullptr)
+    page_id = disk_manager_->AllocatePage();
 
   if(tar_page->is_dirty_)
-    disk_manager_->WritePage(tar_page->GetPageId(),tar_page->data_);
+    writeBackPage(tar_page);
 
   page_table_->Remove(tar_page->GetPageId());   // 删除旧页
   page_table_->Insert(page_id,tar_page);        // 将新页放入
@@ -189,10 +403,297 @@ Page *BufferPoolManager::NewPage(page_id_t &page_id)
   tar_page->ResetMemory();
   tar_page->is_dirty_ = false;
   tar_page->pin_count_ = 1;
+  setRecLSN(tar_page);
+  verify_states_[frameIndex(tar_page)] = PAGE_VERIFIED;
+  unlockFrame(tar_page);
+  metrics_.Add(BPM_NEW_PAGES);
+  metrics_.Add(BPM_PINS);
 
   return tar_page; 
 }
 
+/*
+ * Used for test only, e.g. to detect pin leaks after a scan has finished.
+ * Return true if every frame in the buffer pool has pin count zero
+ */
+bool BufferPoolManager::CheckAllUnpinned()
+{
+  lock_guard<mutex> lck(latch_);
+  for (size_t i = 0; i < pool_size_; ++i)
+  {
+    if (frame(i)->pin_count_ != 0 || frame_pins_[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+void BufferPoolManager::EnableFreeSpaceMap()
+{
+  if (free_space_map_ == nullptr)
+    free_space_map_ = new FreeSpaceMap(this);
+}
+
+/*
+ * Only whole pages are mapped. Index lookups jump around the file, so the
+ * kernel's own readahead is turned off (MADV_RANDOM), scans ask for it
+ * explicitly through ReadAhead
+ */
+bool BufferPoolManager::MapFile(const std::string &file_name)
+{
+  UnmapFile();
+  {
+    // 映射以后不再写文件，写回脏页会改掉已经校验过的视图
+    lock_guard<mutex> lck(latch_);
+    for (size_t i = 0; i < pool_size_; ++i)
+    {
+      if (frame(i)->is_dirty_)
+        return false;
+    }
+  }
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  size_t pages = 0;
+  if (fstat(fd, &st) == 0)
+    pages = st.st_size / PAGE_SIZE;
+  void *data = MAP_FAILED;
+  if (pages > 0)
+    data = mmap(nullptr, pages * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);   // 映射不依赖这个 fd
+  if (data == MAP_FAILED)
+    return false;
+  madvise(data, pages * PAGE_SIZE, MADV_RANDOM);
+  view_states_ = new std::atomic<int>[pages];
+  for (size_t i = 0; i < pages; ++i)
+    view_states_[i] = PAGE_UNVERIFIED;
+  mapped_data_ = static_cast<char *>(data);
+  mapped_pages_ = pages;
+  return true;
+}
+
+void BufferPoolManager::UnmapFile()
+{
+  if (mapped_data_ == nullptr)
+    return;
+  munmap(mapped_data_, mapped_pages_ * PAGE_SIZE);
+  delete[] view_states_;
+  view_states_ = nullptr;
+  mapped_data_ = nullptr;
+  mapped_pages_ = 0;
+}
+
+/*
+ * Nothing writes the file while it is mapped, so a view checked once stays
+ * good until the file is mapped again
+ */
+const char *BufferPoolManager::FetchPageView(page_id_t page_id)
+{
+  const char *data = mappedPage(page_id);
+  if (data != nullptr && checksum_mode_ != ChecksumMode::NONE &&
+      !verifyState(view_states_[page_id], data))
+  {
+    metrics_.Add(BPM_CHECKSUM_FAILURES);
+    throw Exception(EXCEPTION_TYPE_INVALID,
+                    "checksum mismatch on page " + std::to_string(page_id));
+  }
+  return data;
+}
+
+const char *BufferPoolManager::mappedPage(page_id_t page_id)
+{
+  if (page_id < 0 || static_cast<size_t>(page_id) >= mapped_pages_)
+    return nullptr;
+  return mapped_data_ + static_cast<size_t>(page_id) * PAGE_SIZE;
+}
+
+void BufferPoolManager::ReadAhead(page_id_t page_id, int count)
+{
+  if (mapped_data_ == nullptr || page_id < 0 || count <= 0 ||
+      static_cast<size_t>(page_id) >= mapped_pages_)
+    return;
+  size_t end = std::min(mapped_pages_, static_cast<size_t>(page_id) + count);
+  // madvise 要求按系统页对齐
+  size_t os_page = sysconf(_SC_PAGESIZE);
+  size_t begin = static_cast<size_t>(page_id) * PAGE_SIZE / os_page * os_page;
+  madvise(mapped_data_ + begin, end * PAGE_SIZE - begin, MADV_WILLNEED);
+}
+
+/*
+ * The placement policy has to be set before the arena is first touched: the
+ * kernel picks a page's node when the page is faulted in. Without huge pages
+ * reserved, or without NUMA support, the frames still work, just without
+ * that benefit. The mapping starts on a huge page (or at least a
+ * DIRECT_IO_ALIGNMENT) boundary and the slots are PAGE_SIZE apart, so every
+ * slot is aligned for O_DIRECT
+ */
+void BufferPoolManager::allocateFrames()
+{
+  size_t bytes = std::max<size_t>(pool_size_, 1) * PAGE_SIZE;
+  arena_size_ = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  huge_pages_ = true;
+  void *arena = mmap(nullptr, arena_size_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (arena == MAP_FAILED)
+  {
+    huge_pages_ = false;
+    arena = mmap(nullptr, arena_size_, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+      throw std::bad_alloc();
+    madvise(arena, arena_size_, MADV_HUGEPAGE);
+  }
+
+  // 64 个节点以内
+  unsigned long node_mask = ~0UL;
+  int mode = MPOL_INTERLEAVE;
+  if (numa_node_ >= 0 && numa_node_ < static_cast<int>(8 * sizeof(node_mask)))
+  {
+    node_mask = 1UL << numa_node_;
+    mode = MPOL_BIND;
+  }
+  if (syscall(SYS_mbind, arena, arena_size_, mode, &node_mask,
+              8 * sizeof(node_mask) + 1, 0) != 0)
+    LOG_DEBUG("frames keep the default NUMA policy");
+
+  arena_ = static_cast<char *>(arena);
+  pages_ = new Page[pool_size_];
+  for (size_t i = 0; i < pool_size_; ++i)
+    pages_[i].data_ = arena_ + i * PAGE_SIZE;
+}
+
+void BufferPoolManager::freeFrames()
+{
+  delete[] pages_;
+  munmap(arena_, arena_size_);
+  pages_ = nullptr;
+  arena_ = nullptr;
+}
+
+/*
+ * The arena slots are already aligned (see allocateFrames), so this can be
+ * switched on with pages resident
+ */
+bool BufferPoolManager::OpenDirect(const std::string &file_name)
+{
+  CloseDirect();
+  direct_fd_ = open(file_name.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+  return direct_fd_ >= 0;
+}
+
+void BufferPoolManager::CloseDirect()
+{
+  if (direct_fd_ < 0)
+    return;
+  close(direct_fd_);
+  direct_fd_ = -1;
+}
+
+/*
+ * Fuzzy: entries may change while they are read. A frame that becomes dirty
+ * after it was read here got its recovery LSN after this call started, which
+ * is after the checkpoint's begin record
+ */
+void BufferPoolManager::GetDirtyPageTable(
+    std::vector<std::pair<page_id_t, lsn_t>> &dpt)
+{
+  dpt.clear();
+  for (size_t i = 0; i < pool_size_; ++i)
+  {
+    uint64_t entry = rec_lsns_[i];
+    if (entry == NO_REC_LSN)
+      continue;
+    dpt.emplace_back(static_cast<page_id_t>(entry >> 32),
+                     static_cast<lsn_t>(entry & 0xffffffff));
+  }
+}
+
+/*
+ * The pages are pinned and marked clean under latch_, then written with only
+ * their read latch held, so FetchPage/UnpinPage keep going meanwhile. A
+ * change made after the page was marked clean dirties it again on unpin.
+ * Pages pinned either way (pin_count_ or frame_pins_) are left alone
+ */
+size_t BufferPoolManager::FlushDirtyPages(lsn_t lsn, size_t max_pages)
+{
+  std::vector<std::pair<lsn_t, Page *>> victims;
+  {
+    lock_guard<mutex> lck(latch_);
+    for (size_t i = 0; i < pool_size_; ++i)
+    {
+      Page *page = frame(i);
+      if (!page->is_dirty_ || page->pin_count_ != 0 || frame_pins_[i] != 0)
+        continue;
+      lsn_t rec_lsn = static_cast<lsn_t>(rec_lsns_[i] & 0xffffffff);
+      if (rec_lsn < lsn)
+        victims.emplace_back(rec_lsn, page);
+    }
+    std::sort(victims.begin(), victims.end(),
+              [](const std::pair<lsn_t, Page *> &a,
+                 const std::pair<lsn_t, Page *> &b) { return a.first < b.first; });
+    if (victims.size() > max_pages)
+      victims.resize(max_pages);
+    for (auto &victim : victims)
+    {
+      Page *page = victim.second;
+      page->pin_count_++;
+      metrics_.Add(BPM_PINS);
+      replacer_->Erase(page);
+      page->is_dirty_ = false;
+      setRecLSN(page);
+    }
+  }
+
+  for (auto &victim : victims)
+  {
+    Page *page = victim.second;
+    page->RLatch();
+    writeBackPage(page);
+    page->RUnlatch();
+    UnpinPage(page->GetPageId(), false);
+  }
+  return victims.size();
+}
+
+/*
+ * bpm_pinned_pages is exact at the time of the call; bpm_pins - bpm_unpins
+ * drifts upwards over time only if somebody forgets to unpin
+ */
+void BufferPoolManager::GetMetrics(MetricsSnapshot &snapshot)
+{
+  int64_t pinned = 0;
+  int64_t dirty = 0;
+  {
+    lock_guard<mutex> lck(latch_);
+    for (size_t i = 0; i < pool_size_; ++i)
+    {
+      if (frame(i)->pin_count_ > 0 || frame_pins_[i] > 0)
+        ++pinned;
+      if (frame(i)->is_dirty_)
+        ++dirty;
+    }
+  }
+  metrics_.Snapshot(snapshot);
+  snapshot.values.emplace_back("bpm_pool_size", pool_size_);
+  snapshot.values.emplace_back("bpm_pinned_pages", pinned);
+  snapshot.values.emplace_back("bpm_dirty_pages", dirty);
+  snapshot.values.emplace_back("bpm_outstanding_pins",
+                               static_cast<int64_t>(metrics_.Get(BPM_PINS)) -
+                                   static_cast<int64_t>(metrics_.Get(BPM_UNPINS)));
+}
+
+/*
+ * Only a contended latch is timed, the common case costs one try_lock
+ */
+void BufferPoolManager::acquireLatch()
+{
+  if (latch_.try_lock())
+    return;
+  uint64_t start = MetricsNow();
+  latch_.lock();
+  metrics_.Record(BPM_LATCH_WAIT, MetricsNow() - start);
+}
+
 Page* BufferPoolManager::findUsePage()
 {
   Page* tar_page = nullptr;
@@ -201,15 +702,270 @@ Page* BufferPoolManager::findUsePage()
     tar_page = free_list_->front();
     free_list_->pop_front();
     assert(tar_page->GetPageId() == INVALID_PAGE_ID);
+    // 空闲帧上只会有过时引用的试探，它们马上就放掉
+    while (!lockFrame(tar_page))
+      std::this_thread::yield();
   }
   else   // 否则在replacer里面找
   {
-    if(replacer_->Size() == 0)
+    // 不拿 latch_ 钉着的帧还留在 replacer 里，跳过它们
+    std::vector<Page *> pinned;
+    Page *victim;
+    while (tar_page == nullptr && replacer_->Victim(victim))
+    {
+      if (lockFrame(victim))
+        tar_page = victim;
+      else
+        pinned.push_back(victim);
+    }
+    for (Page *page : pinned)
+      replacer_->Insert(page);
+    if (tar_page == nullptr)
       return nullptr;
-    replacer_->Victim(tar_page);
+    metrics_.Add(BPM_EVICTIONS);
   }
   assert(tar_page->GetPinCount() == 0);
   return tar_page;
 }
+
+Page *BufferPoolManager::pinFrame(page_id_t page_id, Page *frame)
+{
+  // 引用可能很久以前就过时了，先确认它是现在的一个帧
+  uintptr_t offset = reinterpret_cast<uintptr_t>(frame) -
+                     reinterpret_cast<uintptr_t>(pages_);
+  if (offset % sizeof(Page) != 0 || offset / sizeof(Page) >= pool_size_)
+    return nullptr;
+  // 锁着的帧 page_id_ 可能正在改，不能钉也不能读
+  std::atomic<int> &pins = frame_pins_[offset / sizeof(Page)];
+  int count = pins.load();
+  do
+  {
+    if (count < 0)
+      return nullptr;
+  } while (!pins.compare_exchange_weak(count, count + 1));
+  if (frame->page_id_ != page_id)
+  {
+    // 钉是不分彼此的，这个钉可能已经被别人放掉了，那就放掉他的
+    if (!releaseFramePin(frame))
+    {
+      acquireLatch();
+      lock_guard<mutex> lck(latch_, adopt_lock);
+      unpinFrame(frame, false);
+    }
+    return nullptr;
+  }
+  initRecLSN(frame);
+  return frame;
+}
+
+bool BufferPoolManager::releaseFramePin(Page *page)
+{
+  std::atomic<int> &pins = frame_pins_[frameIndex(page)];
+  int count = pins.load();
+  while (count > 0)
+  {
+    if (pins.compare_exchange_weak(count, count - 1))
+      return true;
+  }
+  return false;
+}
+
+bool BufferPoolManager::lockFrame(Page *page)
+{
+  int expected = 0;
+  return frame_pins_[frameIndex(page)].compare_exchange_strong(expected,
+                                                               FRAME_LOCKED);
+}
+
+void BufferPoolManager::unlockFrame(Page *page)
+{
+  frame_pins_[frameIndex(page)] = 0;
+}
+
+bool BufferPoolManager::unpinFrame(Page *page, bool is_dirty)
+{
+  // 映射是只读的，写回会改掉已经校验过的视图：钉照样放掉，但不置脏
+  bool refused = is_dirty && mapped_data_ != nullptr;
+  if (refused)
+  {
+    metrics_.Add(BPM_MAPPED_WRITES);
+    is_dirty = false;
+  }
+  // 只能置脏，不能把别人的修改清掉
+  page->is_dirty_ = page->is_dirty_ || is_dirty;
+  // 钉是不分彼此的，没拿 latch_ 钉的也可以在这里放掉
+  if (page->pin_count_ > 0)
+    page->pin_count_--;
+  else if (!releaseFramePin(page))
+    return false;
+  if (page->pin_count_ == 0)
+  {
+    replacer_->Insert(page);
+    clearIfQuiet(page);
+  }
+  metrics_.Add(BPM_UNPINS);
+  return !refused;
+}
+
+/*
+ * Called under latch_. A frame pinned without latch_ keeps its entry: the
+ * pinner may be about to change the page
+ */
+void BufferPoolManager::clearIfQuiet(Page *page)
+{
+  if (page->pin_count_ == 0 && !page->is_dirty_ && lockFrame(page))
+  {
+    clearRecLSN(page);
+    unlockFrame(page);
+  }
+}
+
+/*
+ * Write ahead logging: a page may only reach the disk after every log record
+ * that changed it. If the page LSN is not persistent yet, force the log up to
+ * it first (the log manager batches this with any pending commits). Only
+ * pages that carry an LSN are checked, see carriesLSN
+ */
+void BufferPoolManager::writeBackPage(Page *page)
+{
+  if (ENABLE_LOGGING && log_manager_ != nullptr &&
+      carriesLSN(page->GetPageId()) &&
+      page->GetLSN() > log_manager_->GetPersistentLSN())
+  {
+    log_manager_->Flush(page->GetLSN());
+  }
+  metrics_.Add(BPM_WRITE_BACKS);
+  if (checksum_mode_ == ChecksumMode::NONE)
+  {
+    writePage(page->GetPageId(), page->GetData());
+    return;
+  }
+  // 在副本上算校验和，写的字节和校验和一定对得上
+  alignas(DIRECT_IO_ALIGNMENT) char data[PAGE_SIZE];
+  memcpy(data, page->GetData(), PAGE_SIZE);
+  uint32_t checksum = Crc32c(data, PAGE_SIZE - PAGE_CHECKSUM_SIZE);
+  memcpy(data + PAGE_SIZE - PAGE_CHECKSUM_SIZE, &checksum, sizeof(uint32_t));
+  writePage(page->GetPageId(), data);
+}
+
+/*
+ * The header page keeps records and bitmap pages keep their used count where
+ * other pages keep the LSN. Neither is logged, so there is nothing to force
+ * before writing them (the header page is written by FlushRootPageId and the
+ * checkpoint, which force the log themselves)
+ */
+bool BufferPoolManager::carriesLSN(page_id_t page_id)
+{
+  if (page_id == HEADER_PAGE_ID)
+    return false;
+  return free_space_map_ == nullptr || !FreeSpaceMap::IsBitmapPage(page_id);
+}
+
+/*
+ * Same contract as DiskManager::ReadPage/WritePage: a page past the end of
+ * the file reads as zeros, I/O errors are only logged
+ */
+void BufferPoolManager::readPage(page_id_t page_id, char *page_data)
+{
+  uint64_t start = MetricsNow();
+  if (read_latency_us_ > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(read_latency_us_));
+  if (direct_fd_ < 0)
+  {
+    disk_manager_->ReadPage(page_id, page_data);
+    metrics_.Record(BPM_READ, MetricsNow() - start);
+    return;
+  }
+  // arena 里的页都是对齐的（见 allocateFrames），直接读进去
+  assert(reinterpret_cast<uintptr_t>(page_data) % DIRECT_IO_BLOCK == 0);
+  ssize_t n = pread(direct_fd_, page_data, PAGE_SIZE,
+                    static_cast<off_t>(page_id) * PAGE_SIZE);
+  if (n < 0)
+  {
+    LOG_DEBUG("I/O error while reading");
+    n = 0;
+  }
+  memset(page_data + n, 0, PAGE_SIZE - n);
+  metrics_.Record(BPM_READ, MetricsNow() - start);
+}
+
+void BufferPoolManager::writePage(page_id_t page_id, const char *page_data)
+{
+  uint64_t start = MetricsNow();
+  if (write_latency_us_ > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(write_latency_us_));
+  if (direct_fd_ < 0)
+  {
+    disk_manager_->WritePage(page_id, page_data);
+    metrics_.Record(BPM_WRITE, MetricsNow() - start);
+    return;
+  }
+  // arena 里的页或 writeBackPage 的对齐副本
+  assert(reinterpret_cast<uintptr_t>(page_data) % DIRECT_IO_BLOCK == 0);
+  if (pwrite(direct_fd_, page_data, PAGE_SIZE,
+             static_cast<off_t>(page_id) * PAGE_SIZE) != PAGE_SIZE)
+    LOG_DEBUG("I/O error while writing");
+  metrics_.Record(BPM_WRITE, MetricsNow() - start);
+}
+
+/*
+ * The caller holds a pin, so the frame keeps its page meanwhile. Whoever
+ * comes second waits for the first one to finish checking
+ */
+bool BufferPoolManager::verifyPage(Page *page)
+{
+  return verifyState(verify_states_[frameIndex(page)], page->GetData());
+}
+
+bool BufferPoolManager::verifyState(std::atomic<int> &state, const char *data)
+{
+  while (true)
+  {
+    int expected = PAGE_UNVERIFIED;
+    if (state.compare_exchange_strong(expected, PAGE_VERIFYING))
+    {
+      bool ok = checksumMatches(data);
+      state = ok ? PAGE_VERIFIED : PAGE_CORRUPT;
+      return ok;
+    }
+    if (expected == PAGE_VERIFIED)
+      return true;
+    if (expected == PAGE_CORRUPT)
+      return false;
+    std::this_thread::yield();
+  }
+}
+
+/*
+ * Called under latch_. Without a log manager there is nothing to recover,
+ * the entry is kept anyway with INVALID_LSN
+ */
+void BufferPoolManager::setRecLSN(Page *page)
+{
+  rec_lsns_[frameIndex(page)] = recLSNEntry(page);
+}
+
+/*
+ * Only if the frame has no entry yet: an older one covers changes somebody
+ * may already be making. Pinners without latch_ race here, the first wins
+ */
+void BufferPoolManager::initRecLSN(Page *page)
+{
+  uint64_t expected = NO_REC_LSN;
+  rec_lsns_[frameIndex(page)].compare_exchange_strong(expected,
+                                                      recLSNEntry(page));
+}
+
+uint64_t BufferPoolManager::recLSNEntry(Page *page)
+{
+  lsn_t lsn = log_manager_ != nullptr ? log_manager_->GetNextLSN() : INVALID_LSN;
+  return (static_cast<uint64_t>(static_cast<uint32_t>(page->page_id_)) << 32) |
+         static_cast<uint32_t>(lsn);
+}
+
+void BufferPoolManager::clearRecLSN(Page *page)
+{
+  rec_lsns_[frameIndex(page)] = NO_REC_LSN;
+}
 } // namespace scudb
 
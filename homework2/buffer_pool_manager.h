@@ -4,46 +4,226 @@
  * Functionality: The simplified Buffer Manager interface allows a client to
  * new/delete pages on disk, to read a disk page into the buffer pool and pin
  * it, also to unpin a page in the buffer pool.
+ *
+ * For fuzzy checkpoints every frame also remembers its recovery LSN: the next
+ * LSN of the log when the frame was first pinned while clean. Every change
+ * made to it since then has a larger LSN. The table is read without latch_,
+ * so a checkpoint never stops FetchPage/UnpinPage.
+ *
+ * Optionally the last PAGE_CHECKSUM_SIZE bytes of every page on disk hold a
+ * CRC-32C of the rest of it, so a torn or corrupted page is caught before
+ * anybody interprets it. Pages stored through a pool with checksums enabled
+ * must leave those bytes alone (B+ tree and header pages do).
+ *
+ * Read-only replicas can also map the database file. FetchPageView then
+ * returns a pointer straight into the mapping (no pin, no copy), and a
+ * FetchPage miss copies from the mapping instead of calling ReadPage. The
+ * views are only valid while the file does not change, so a mapped pool
+ * hands out no new pages, deletes none and takes no dirty pages back.
+ *
+ * With OpenDirect the pool reads and writes pages itself through an O_DIRECT
+ * descriptor, so they are not cached a second time by the kernel. The page
+ * data of all frames lives in one arena of pool_size * PAGE_SIZE bytes,
+ * apart from the Page bookkeeping, so every page is aligned as it is and the
+ * transfer goes straight to the frame without any padding.
+ *
+ * The arena is one anonymous mapping backed by 2 MB huge pages when the
+ * system has them reserved (otherwise transparent huge pages are requested),
+ * so scanning the pool does not miss the TLB on every frame. On NUMA machines
+ * it is spread over all nodes by default, or bound to one node when each
+ * node runs its own pool.
+ *
+ * Callers that keep references to frames (swizzled pointers) pass the frame
+ * a page was in last time to FetchPage. If the frame still holds the page it
+ * is pinned without latch_ or a page table lookup, otherwise the reference
+ * is stale and the page id is looked up as usual. Such pins are counted per
+ * frame next to the Page (Page::GetPinCount does not see them). A pinned
+ * page can be unpinned by its frame as well, a clean unpin of a pin taken
+ * without latch_ does not take it either.
+ *
+ * The pool counts hits, misses, evictions, write-backs and pins/unpins, and
+ * times its disk I/O and the waits for latch_ (see metrics.h). A pin count
+ * that keeps growing while the workload is steady is a pin leak.
  */
 
 #pragma once
+#include <atomic>
 #include <list>
 #include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "buffer/crc32c.h"
 #include "buffer/lru_replacer.h"
+#include "buffer/metrics.h"
 #include "disk/disk_manager.h"
 #include "hash/extendible_hash.h"
 #include "logging/log_manager.h"
 #include "page/page.h"
 
 namespace scudb {
+
+class FreeSpaceMap;
+
+// page trailer reserved for the checksum
+#define PAGE_CHECKSUM_SIZE 4
+// buffer alignment required by O_DIRECT
+#define DIRECT_IO_ALIGNMENT 4096
+// frames are allocated in multiples of this
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// numa_node: interleave frames over all nodes
+#define NUMA_INTERLEAVE -1
+
+enum class ChecksumMode {
+  NONE = 0,       // pages are written and read as they are
+  VERIFY_ON_READ, // checked right after the read, under the pool latch
+  VERIFY_LAZY     // checked by the first fetcher, outside the pool latch
+};
+
 class BufferPoolManager {
 public:
+  // numa_node >= 0 places every frame on that node
   BufferPoolManager(size_t pool_size, DiskManager *disk_manager,
-                          LogManager *log_manager = nullptr);
+                          LogManager *log_manager = nullptr,
+                          int numa_node = NUMA_INTERLEAVE);
 
   ~BufferPoolManager();
 
   Page *FetchPage(page_id_t page_id);
+  // frame: where page_id was resident before, may be stale or nullptr
+  Page *FetchPage(page_id_t page_id, Page *frame);
 
   bool UnpinPage(page_id_t page_id, bool is_dirty);
+  // page must be pinned by the caller
+  bool UnpinPage(Page *page, bool is_dirty);
 
   bool FlushPage(page_id_t page_id);
 
-  Page *NewPage(page_id_t &page_id);
+  // hint: allocate near this page if the free space map is enabled
+  Page *NewPage(page_id_t &page_id, page_id_t hint = INVALID_PAGE_ID);
 
   bool DeletePage(page_id_t page_id);
 
+  // test purpose: true if no frame in the pool is still pinned
+  bool CheckAllUnpinned();
+
+  inline size_t GetPoolSize() { return pool_size_; }
+
+  // nullptr when logging is disabled
+  inline LogManager *GetLogManager() { return log_manager_; }
+
+  // set before the first page is written; pages written without a checksum
+  // do not pass verification afterwards
+  inline void SetChecksumMode(ChecksumMode mode) { checksum_mode_ = mode; }
+  inline ChecksumMode GetChecksumMode() { return checksum_mode_; }
+
+  // map the database file read only, false if it can not be mapped or the
+  // pool still holds dirty pages (flush them first). Remap (after the file
+  // grew) only while nobody holds a view. While mapped, NewPage returns
+  // nullptr, DeletePage false, and a dirty unpin releases the pin without
+  // marking the page dirty and returns false (see bpm_mapped_writes)
+  bool MapFile(const std::string &file_name);
+  void UnmapFile();
+  inline bool IsMapped() { return mapped_data_ != nullptr; }
+  // read-only view of a page inside the mapping, nullptr if the page is past
+  // the mapped part of the file. Views are never pinned. With checksums on,
+  // the first touch of each view verifies it and a mismatch throws like
+  // FetchPage
+  const char *FetchPageView(page_id_t page_id);
+  // ask the kernel to read [page_id, page_id + count) in the background
+  void ReadAhead(page_id_t page_id, int count);
+
+  // bypass the OS page cache: page I/O goes to file_name opened with
+  // O_DIRECT instead of the disk manager. False if the file system does not
+  // support it. Page allocation still goes through the disk manager
+  bool OpenDirect(const std::string &file_name);
+  void CloseDirect();
+  inline bool IsDirect() { return direct_fd_ >= 0; }
+
+  // true if the arena sits on reserved (MAP_HUGETLB) huge pages
+  inline bool IsHugePageBacked() { return huge_pages_; }
+
+  // allocate and free pages through an on-disk bitmap instead of the disk
+  // manager. Only for files that have used it from the start: it owns page 1
+  // and every FSM_PAGES_PER_GROUP-th page after it
+  void EnableFreeSpaceMap();
+  inline FreeSpaceMap *GetFreeSpaceMap() { return free_space_map_; }
+
+  // checkpoint: page_id -> recovery LSN of every page that is dirty or
+  // pinned (a pinned page may be in the middle of a change)
+  void GetDirtyPageTable(std::vector<std::pair<page_id_t, lsn_t>> &dpt);
+  // write back at most max_pages unpinned dirty pages whose recovery LSN is
+  // below lsn, oldest first. Return how many were written
+  size_t FlushDirtyPages(lsn_t lsn, size_t max_pages);
+
+  // append the pool's counters, gauges and histograms to snapshot
+  void GetMetrics(MetricsSnapshot &snapshot);
+  inline void ResetMetrics() { metrics_.Reset(); }
+
+  // benchmarks: every page read / write takes this much longer, to model a
+  // slower device than the one the database file is on
+  inline void SetSimulatedLatency(uint32_t read_us, uint32_t write_us) {
+    read_latency_us_ = read_us;
+    write_latency_us_ = write_us;
+  }
+
 private:
   size_t pool_size_; // number of pages in buffer pool
   Page *pages_;      // array of pages
+  int numa_node_;
+  char *arena_;        // page data of pages_[i] at i * PAGE_SIZE
+  size_t arena_size_;  // bytes mapped for arena_
+  bool huge_pages_;
   DiskManager *disk_manager_;
   LogManager *log_manager_;
   HashTable<page_id_t, Page *> *page_table_; // to keep track of pages
   Replacer<Page *> *replacer_;   // to find an unpinned page for replacement
   std::list<Page *> *free_list_; // to find a free page for replacement
   std::mutex latch_;             // to protect shared data structure
+  // per frame: page id (high 32 bits) + recovery LSN (low 32 bits),
+  // written under latch_, read without it
+  std::atomic<uint64_t> *rec_lsns_;
+  ChecksumMode checksum_mode_;
+  // per frame, VERIFY_LAZY only: has the page read into it been checked
+  std::atomic<int> *verify_states_;
+  // per frame: pins taken through a frame reference without latch_, locked
+  // (-1) while the frame gets another page
+  std::atomic<int> *frame_pins_;
+  // read-only mapping of the database file
+  char *mapped_data_;
+  size_t mapped_pages_;
+  // per mapped page, like verify_states_: has its view been checked
+  std::atomic<int> *view_states_;
+  // O_DIRECT descriptor of the database file, -1 if not used
+  int direct_fd_;
+  FreeSpaceMap *free_space_map_; // nullptr: the disk manager allocates
+  Metrics metrics_;
+  uint32_t read_latency_us_;
+  uint32_t write_latency_us_;
 
-  Page* GetVictimePage();        // 辅助函数，找到可替代的页
+  void acquireLatch();                // 拿 latch_，等待时记下等了多久
+  void allocateFrames();              // arena 用大页 + NUMA 放置
+  inline Page *frame(size_t i) { return &pages_[i]; }
+  inline size_t frameIndex(Page *page) { return page - pages_; }
+  void freeFrames();
+  Page* findUsePage();           // 辅助函数，找到可替代的页，返回时帧已锁住
+  Page *pinFrame(page_id_t page_id, Page *frame); // 不拿 latch_ 钉住
+  bool releaseFramePin(Page *page);
+  bool lockFrame(Page *page);     // 换页前锁住帧，有人钉着时失败
+  void unlockFrame(Page *page);
+  bool unpinFrame(Page *page, bool is_dirty); // 持有 latch_ 时调用
+  void clearIfQuiet(Page *page);  // 持有 latch_ 时调用
+  void writeBackPage(Page *page); // 写回脏页，先保证日志落盘
+  bool carriesLSN(page_id_t page_id); // header page 和位图页偏移 4 不是 LSN
+  void setRecLSN(Page *page);     // frame 开始可能被修改，记下当前 LSN
+  void initRecLSN(Page *page);    // 同上，但不覆盖已有的
+  uint64_t recLSNEntry(Page *page);
+  void clearRecLSN(Page *page);   // frame 干净且没人用
+  bool verifyPage(Page *page);    // VERIFY_LAZY: 第一个拿到页的线程校验
+  bool verifyState(std::atomic<int> &state, const char *data);
+  const char *mappedPage(page_id_t page_id); // 不校验的映射视图
+  void readPage(page_id_t page_id, char *page_data);        // 读写磁盘，
+  void writePage(page_id_t page_id, const char *page_data); // 可能绕过 page cache
 };
 } // namespace scudb
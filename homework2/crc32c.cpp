@@ -0,0 +1,92 @@
+#include <cstring>
+
+#include "buffer/crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+namespace scudb {
+
+namespace {
+
+const uint32_t POLY = 0x82f63b78; // 反射后的 Castagnoli 多项式
+
+struct Crc32cTable {
+  uint32_t table[256];
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j)
+        crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+      table[i] = crc;
+    }
+  }
+};
+
+uint32_t crc32cSoftware(const char *data, size_t size, uint32_t crc) {
+  static const Crc32cTable t;
+  auto *p = reinterpret_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i)
+    crc = t.table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(CRC32C_X86)
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const char *data, size_t size, uint32_t crc) {
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; size > 0; --size, ++data)
+    crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+  return crc;
+}
+
+bool detectHardware() { return __builtin_cpu_supports("sse4.2"); }
+#elif defined(CRC32C_ARM)
+uint32_t crc32cHardware(const char *data, size_t size, uint32_t crc) {
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  for (; size > 0; --size, ++data)
+    crc = __crc32cb(crc, static_cast<unsigned char>(*data));
+  return crc;
+}
+
+bool detectHardware() { return true; }
+#else
+uint32_t crc32cHardware(const char *data, size_t size, uint32_t crc) {
+  return crc32cSoftware(data, size, crc);
+}
+
+bool detectHardware() { return false; }
+#endif
+
+} // namespace
+
+bool Crc32cHardware() {
+  static const bool hardware = detectHardware();
+  return hardware;
+}
+
+uint32_t Crc32c(const char *data, size_t size, uint32_t crc) {
+  crc = ~crc;
+  crc = Crc32cHardware() ? crc32cHardware(data, size, crc)
+                         : crc32cSoftware(data, size, crc);
+  return ~crc;
+}
+
+} // namespace scudb
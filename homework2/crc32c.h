@@ -0,0 +1,22 @@
+/**
+ * crc32c.h
+ *
+ * CRC-32C (Castagnoli polynomial), used to checksum pages on disk. Computed
+ * with the SSE4.2 / ARMv8 crc32c instructions when the CPU has them, with a
+ * lookup table otherwise.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace scudb {
+
+// crc of data[0, size), continuing from crc (0 to start a new checksum)
+uint32_t Crc32c(const char *data, size_t size, uint32_t crc = 0);
+
+// true if Crc32c runs on the hardware instruction
+bool Crc32cHardware();
+
+} // namespace scudb
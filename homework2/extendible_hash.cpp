@@ -25,10 +25,7 @@ ExtendibleHash<K, V>::ExtendibleHash(size_t size) :  globalDepth(0),bucketSize(s
 }
 
 template<typename K, typename V>
-ExtendibleHash<K, V>::ExtendibleHash() 
-{
-  ExtendibleHash(64);
-}
+ExtendibleHash<K, V>::ExtendibleHash() : ExtendibleHash(64) {}
 
 /*
  * helper function to calculate the hashing address of input key
@@ -83,9 +80,8 @@ int ExtendibleHash<K, V>::getIndex(const K &key) const
 {
   lock_guard<mutex> lck(latch);
   // 要找到放在哪个桶里，就是要看地址的后几位是多少，后几位的几根据全局深度来确定。
-  return HashKey(key) & (pow(2,globalDepth)-1);
-  // 参考中的位运算速度更快
-  // return HashKey(key) & ((1 << globalDepth)-1);
+  // pow 返回 double，不能和 size_t 做位运算，而且位运算更快
+  return HashKey(key) & ((1 << globalDepth)-1);
 }
 
 /*
@@ -175,7 +171,7 @@ void ExtendibleHash<K, V>::Insert(const K &key, const V &value)
       } 
       for(size_t i = 0; i < buckets.size(); i++)
         if(buckets[i] == cur && (i & mask))
-          buckets[i] == newBucket;
+          buckets[i] = newBucket;
     }
     index = getIndex(key);
     cur = buckets[index];
@@ -0,0 +1,200 @@
+/**
+ * free_space_map.cpp
+ */
+
+#include <cstring>
+
+#include "buffer/free_space_map.h"
+
+namespace scudb {
+
+static const uint32_t FSM_MAGIC = 0x46534d31;  // "FSM1"
+
+static_assert(FSM_PAGES_PER_GROUP % FSM_EXTENT_SIZE == 0,
+              "a group holds whole extents");
+
+// 第 i 位对应组内第 i 页
+static inline bool testBit(const char *bits, int i) {
+  return (bits[i / 8] >> (i % 8)) & 1;
+}
+static inline void setBit(char *bits, int i) { bits[i / 8] |= 1 << (i % 8); }
+static inline void clearBit(char *bits, int i) {
+  bits[i / 8] &= ~(1 << (i % 8));
+}
+
+/*
+ * A bitmap page that was never written reads back as zeros: the group is new,
+ * only its bitmap page is in use
+ */
+Page *FreeSpaceMap::fetchGroup(int group)
+{
+  page_id_t bitmap_page_id = group * FSM_PAGES_PER_GROUP + 1;
+  Page *page = buffer_pool_manager_->FetchPage(bitmap_page_id);
+  if (page == nullptr)
+    return nullptr;
+  char *data = page->GetData();
+  uint32_t magic;
+  memcpy(&magic, data, sizeof(uint32_t));
+  if (magic != FSM_MAGIC)
+  {
+    page->WLatch();
+    memset(data, 0, PAGE_SIZE);
+    uint32_t used = 1;
+    memcpy(data, &FSM_MAGIC, sizeof(uint32_t));
+    memcpy(data + 4, &used, sizeof(uint32_t));
+    setBit(data + FSM_HEADER_SIZE, 1);
+    page->WUnlatch();
+  }
+  return page;
+}
+
+/*
+ * Order of preference: hint's extent, the first extent after it with a free
+ * page, then any free page of the group. page_id is INVALID_PAGE_ID if the group is
+ * full, false if its bitmap page could not be fetched
+ */
+bool FreeSpaceMap::allocateInGroup(int group, page_id_t hint,
+                                   page_id_t &page_id)
+{
+  page_id = INVALID_PAGE_ID;
+  Page *page = fetchGroup(group);
+  if (page == nullptr)
+    return false;
+  char *data = page->GetData();
+  char *bits = data + FSM_HEADER_SIZE;
+  uint32_t used;
+  memcpy(&used, data + 4, sizeof(uint32_t));
+
+  int found = -1;
+  if (used < FSM_PAGES_PER_GROUP)
+  {
+    if (hint != INVALID_PAGE_ID)
+    {
+      int slot = hint % FSM_PAGES_PER_GROUP;
+      int extent_begin = slot / FSM_EXTENT_SIZE * FSM_EXTENT_SIZE;
+      for (int i = slot + 1; i < extent_begin + FSM_EXTENT_SIZE && found < 0; ++i)
+      {
+        if (!testBit(bits, i))
+          found = i;
+      }
+      for (int i = extent_begin; i < slot && found < 0; ++i)
+      {
+        if (!testBit(bits, i))
+          found = i;
+      }
+      // 之后第一个有空闲页的 extent：一个 extent 占两个字节
+      for (int e = extent_begin + FSM_EXTENT_SIZE;
+           e < FSM_PAGES_PER_GROUP && found < 0; e += FSM_EXTENT_SIZE)
+      {
+        if (static_cast<unsigned char>(bits[e / 8]) == 0xff &&
+            static_cast<unsigned char>(bits[e / 8 + 1]) == 0xff)
+          continue;
+        for (int i = e; i < e + FSM_EXTENT_SIZE; ++i)
+        {
+          if (!testBit(bits, i))
+          {
+            found = i;
+            break;
+          }
+        }
+      }
+    }
+    for (int b = 0; b < FSM_PAGES_PER_GROUP / 8 && found < 0; ++b)
+    {
+      if (static_cast<unsigned char>(bits[b]) == 0xff)
+        continue;
+      for (int i = b * 8; i < b * 8 + 8; ++i)
+      {
+        if (!testBit(bits, i))
+        {
+          found = i;
+          break;
+        }
+      }
+    }
+  }
+
+  if (found < 0)
+  {
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    return true;
+  }
+  page->WLatch();
+  setBit(bits, found);
+  ++used;
+  memcpy(data + 4, &used, sizeof(uint32_t));
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+  // 先让位图落盘，再把页交出去
+  buffer_pool_manager_->FlushPage(page->GetPageId());
+  page_id = group * FSM_PAGES_PER_GROUP + found;
+  return true;
+}
+
+page_id_t FreeSpaceMap::Allocate(page_id_t hint)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  page_id_t page_id;
+  if (hint != INVALID_PAGE_ID)
+  {
+    if (!allocateInGroup(hint / FSM_PAGES_PER_GROUP, hint, page_id))
+      return INVALID_PAGE_ID;
+    if (page_id != INVALID_PAGE_ID)
+      return page_id;
+  }
+  // 新组总有空闲页，所以这个循环一定会结束
+  for (int group = first_free_group_;; ++group)
+  {
+    if (!allocateInGroup(group, INVALID_PAGE_ID, page_id))
+      return INVALID_PAGE_ID;
+    if (page_id != INVALID_PAGE_ID)
+    {
+      first_free_group_ = group;
+      return page_id;
+    }
+  }
+}
+
+void FreeSpaceMap::Free(page_id_t page_id)
+{
+  if (page_id < 0 || IsBitmapPage(page_id))
+    return;
+  std::lock_guard<std::mutex> lck(latch_);
+  int group = page_id / FSM_PAGES_PER_GROUP;
+  Page *page = fetchGroup(group);
+  if (page == nullptr)
+    return;
+  char *data = page->GetData();
+  char *bits = data + FSM_HEADER_SIZE;
+  int slot = page_id % FSM_PAGES_PER_GROUP;
+  bool was_used = testBit(bits, slot);
+  if (was_used)
+  {
+    uint32_t used;
+    page->WLatch();
+    clearBit(bits, slot);
+    memcpy(&used, data + 4, sizeof(uint32_t));
+    --used;
+    memcpy(data + 4, &used, sizeof(uint32_t));
+    page->WUnlatch();
+    if (group < first_free_group_)
+      first_free_group_ = group;
+  }
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), was_used);
+}
+
+bool FreeSpaceMap::IsAllocated(page_id_t page_id)
+{
+  if (page_id < 0 || IsBitmapPage(page_id))
+    return false;
+  std::lock_guard<std::mutex> lck(latch_);
+  Page *page = fetchGroup(page_id / FSM_PAGES_PER_GROUP);
+  if (page == nullptr)
+    return false;
+  bool used = testBit(page->GetData() + FSM_HEADER_SIZE,
+                      page_id % FSM_PAGES_PER_GROUP);
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+  return used;
+}
+
+} // namespace scudb
@@ -0,0 +1,59 @@
+/**
+ * free_space_map.h
+ *
+ * On-disk record of which pages of the database file are in use, so deleted
+ * pages are handed out again instead of the file growing forever.
+ *
+ * The file is divided into groups of FSM_PAGES_PER_GROUP pages. The second
+ * page of every group (page 1 for the first one, so the header page keeps
+ * page 0) is a bitmap with one bit per page of the group. Groups are divided
+ * again into extents of FSM_EXTENT_SIZE pages: a caller allocating next to a
+ * page (the sibling of a split, the previous leaf of a bulk load) gets a page
+ * of the same extent, or else a free extent, so a leaf chain stays mostly
+ * sequential in the file.
+ *
+ * Bitmap pages go through the buffer pool like any other page and are not
+ * logged. An allocation is written to disk before the page is handed out, a
+ * free is not, so a crash can at worst leak pages.
+ */
+
+#pragma once
+#include <mutex>
+
+#include "buffer/buffer_pool_manager.h"
+
+namespace scudb {
+
+// bitmap page header: magic + number of used pages in the group
+#define FSM_HEADER_SIZE 8
+#define FSM_PAGES_PER_GROUP                                                    \
+  ((PAGE_SIZE - PAGE_CHECKSUM_SIZE - FSM_HEADER_SIZE) * 8)
+#define FSM_EXTENT_SIZE 16
+
+class FreeSpaceMap {
+public:
+  explicit FreeSpaceMap(BufferPoolManager *buffer_pool_manager)
+      : buffer_pool_manager_(buffer_pool_manager), first_free_group_(0) {}
+
+  // a free page, near hint if it is valid. INVALID_PAGE_ID if a bitmap page
+  // could not be brought into the buffer pool
+  page_id_t Allocate(page_id_t hint = INVALID_PAGE_ID);
+  void Free(page_id_t page_id);
+  // false for free pages and bitmap pages
+  bool IsAllocated(page_id_t page_id);
+
+  static inline bool IsBitmapPage(page_id_t page_id) {
+    return page_id % FSM_PAGES_PER_GROUP == 1;
+  }
+
+private:
+  Page *fetchGroup(int group);
+  bool allocateInGroup(int group, page_id_t hint, page_id_t &page_id);
+
+  BufferPoolManager *buffer_pool_manager_;
+  std::mutex latch_;
+  // groups below this one have no free page
+  int first_free_group_;
+};
+
+} // namespace scudb
@@ -16,7 +16,18 @@ template <typename T> LRUReplacer<T>::LRUReplacer()
   tail->pre = head;
 }
 
-template <typename T> LRUReplacer<T>::~LRUReplacer() {}
+// 链表前后互相持有 shared_ptr，成环了，要手动拆开才会释放
+template <typename T> LRUReplacer<T>::~LRUReplacer()
+{
+  shared_ptr<Node> cur = head;
+  while(cur)
+  {
+    shared_ptr<Node> suc = cur->next;
+    cur->pre.reset();
+    cur->next.reset();
+    cur = suc;
+  }
+}
 
 /*
  * Insert value into LRU
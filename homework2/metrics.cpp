@@ -0,0 +1,132 @@
+/**
+ * metrics.cpp
+ */
+
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+#include "buffer/metrics.h"
+
+namespace scudb {
+
+uint64_t HistogramSnapshot::Percentile(double p) const
+{
+  if (count == 0)
+    return 0;
+  uint64_t rank = static_cast<uint64_t>(count * p / 100);
+  if (rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i)
+  {
+    seen += buckets[i];
+    if (seen >= rank)
+      return (2ULL << i) - 1;
+  }
+  return (2ULL << (buckets.size() - 1)) - 1;
+}
+
+int64_t MetricsSnapshot::Get(const std::string &name) const
+{
+  for (auto &value : values)
+  {
+    if (value.first == name)
+      return value.second;
+  }
+  return 0;
+}
+
+std::string MetricsSnapshot::ToString() const
+{
+  std::ostringstream os;
+  for (auto &value : values)
+    os << value.first << " " << value.second << "\n";
+  for (auto &histogram : histograms)
+  {
+    os << histogram.name << " count " << histogram.count << " mean_ns "
+       << (histogram.count == 0 ? 0 : histogram.sum / histogram.count)
+       << " p50_ns " << histogram.Percentile(50) << " p99_ns "
+       << histogram.Percentile(99) << " max_ns " << histogram.Percentile(100)
+       << "\n";
+  }
+  return os.str();
+}
+
+/*
+ * Names are plain identifiers, nothing needs escaping
+ */
+std::string MetricsSnapshot::ToJson() const
+{
+  std::ostringstream os;
+  os << "{\"values\":{";
+  for (size_t i = 0; i < values.size(); ++i)
+    os << (i == 0 ? "" : ",") << "\"" << values[i].first
+       << "\":" << values[i].second;
+  os << "},\"histograms\":{";
+  for (size_t i = 0; i < histograms.size(); ++i)
+  {
+    const HistogramSnapshot &histogram = histograms[i];
+    os << (i == 0 ? "" : ",") << "\"" << histogram.name << "\":{\"count\":"
+       << histogram.count << ",\"sum_ns\":" << histogram.sum
+       << ",\"buckets\":[";
+    for (size_t j = 0; j < histogram.buckets.size(); ++j)
+      os << (j == 0 ? "" : ",") << histogram.buckets[j];
+    os << "]}";
+  }
+  os << "}}";
+  return os.str();
+}
+
+Metrics::Metrics(const char *const *counter_names, int num_counters,
+                 const char *const *histogram_names, int num_histograms)
+    : counter_names_(counter_names), num_counters_(num_counters),
+      histogram_names_(histogram_names), num_histograms_(num_histograms)
+{
+  // 每个分片占整数个 cache line，避免伪共享
+  const int per_line = 64 / sizeof(std::atomic<uint64_t>);
+  int cells = num_counters + num_histograms * (HISTOGRAM_BUCKETS + 2);
+  shard_size_ = (cells + per_line - 1) / per_line * per_line;
+  void *memory = aligned_alloc(64, METRICS_SHARDS * shard_size_ *
+                                       sizeof(std::atomic<uint64_t>));
+  if (memory == nullptr)
+    throw std::bad_alloc();
+  cells_ = static_cast<std::atomic<uint64_t> *>(memory);
+  for (int i = 0; i < METRICS_SHARDS * shard_size_; ++i)
+    new (&cells_[i]) std::atomic<uint64_t>(0);
+}
+
+Metrics::~Metrics()
+{
+  free(cells_);
+}
+
+void Metrics::Snapshot(MetricsSnapshot &snapshot) const
+{
+  for (int c = 0; c < num_counters_; ++c)
+    snapshot.values.emplace_back(counter_names_[c], Get(c));
+  for (int h = 0; h < num_histograms_; ++h)
+  {
+    HistogramSnapshot histogram;
+    histogram.name = histogram_names_[h];
+    histogram.buckets.assign(HISTOGRAM_BUCKETS, 0);
+    for (int i = 0; i < METRICS_SHARDS; ++i)
+    {
+      const std::atomic<uint64_t> *cell =
+          cells_ + i * shard_size_ + num_counters_ + h * (HISTOGRAM_BUCKETS + 2);
+      histogram.count += cell[0].load(std::memory_order_relaxed);
+      histogram.sum += cell[1].load(std::memory_order_relaxed);
+      for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+        histogram.buckets[b] += cell[2 + b].load(std::memory_order_relaxed);
+    }
+    snapshot.histograms.push_back(histogram);
+  }
+}
+
+void Metrics::Reset()
+{
+  for (int i = 0; i < METRICS_SHARDS * shard_size_; ++i)
+    cells_[i].store(0, std::memory_order_relaxed);
+}
+
+} // namespace scudb
@@ -0,0 +1,108 @@
+/**
+ * metrics.h
+ *
+ * Event counters and latency histograms cheap enough to stay on in
+ * production. Every thread adds to its own cache line aligned shard with a
+ * relaxed atomic, so recording never contends with other threads or with a
+ * snapshot; a snapshot sums the shards while the engine keeps running.
+ *
+ * Histogram bucket i counts samples in [2^i, 2^(i+1)) nanoseconds (bucket 0
+ * also takes 0).
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace scudb {
+
+#define METRICS_SHARDS 16
+#define HISTOGRAM_BUCKETS 40
+
+// shard of the calling thread, threads are spread round robin
+inline int MetricsShard() {
+  static std::atomic<int> next_shard(0);
+  static thread_local int shard = next_shard++ % METRICS_SHARDS;
+  return shard;
+}
+
+inline uint64_t MetricsNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct HistogramSnapshot {
+  std::string name;
+  uint64_t count = 0;
+  uint64_t sum = 0; // nanoseconds
+  std::vector<uint64_t> buckets;
+
+  // upper bound (ns) of the bucket holding the p-th percentile, 0 < p <= 100
+  uint64_t Percentile(double p) const;
+};
+
+struct MetricsSnapshot {
+  // counters and gauges, name -> value
+  std::vector<std::pair<std::string, int64_t>> values;
+  std::vector<HistogramSnapshot> histograms;
+
+  // value of name, 0 if there is none
+  int64_t Get(const std::string &name) const;
+  // one "name value" line per value, then count / mean / p50 / p99 / max
+  // bucket per histogram
+  std::string ToString() const;
+  std::string ToJson() const;
+};
+
+class Metrics {
+public:
+  // the names are kept, not copied: pass static arrays
+  Metrics(const char *const *counter_names, int num_counters,
+          const char *const *histogram_names, int num_histograms);
+  ~Metrics();
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+
+  inline void Add(int counter, uint64_t count = 1) {
+    cells_[MetricsShard() * shard_size_ + counter].fetch_add(
+        count, std::memory_order_relaxed);
+  }
+
+  inline void Record(int histogram, uint64_t nanoseconds) {
+    std::atomic<uint64_t> *cell = cells_ + MetricsShard() * shard_size_ +
+                                  num_counters_ +
+                                  histogram * (HISTOGRAM_BUCKETS + 2);
+    int bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    if (bucket >= HISTOGRAM_BUCKETS)
+      bucket = HISTOGRAM_BUCKETS - 1;
+    cell[0].fetch_add(1, std::memory_order_relaxed);
+    cell[1].fetch_add(nanoseconds, std::memory_order_relaxed);
+    cell[2 + bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // append the sums over all shards to snapshot
+  void Snapshot(MetricsSnapshot &snapshot) const;
+  void Reset();
+
+  inline uint64_t Get(int counter) const {
+    uint64_t sum = 0;
+    for (int i = 0; i < METRICS_SHARDS; ++i)
+      sum += cells_[i * shard_size_ + counter].load(std::memory_order_relaxed);
+    return sum;
+  }
+
+private:
+  const char *const *counter_names_;
+  int num_counters_;
+  const char *const *histogram_names_;
+  int num_histograms_;
+  int shard_size_; // cells per shard, a multiple of one cache line
+  std::atomic<uint64_t> *cells_;
+};
+
+} // namespace scudb
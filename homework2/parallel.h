@@ -0,0 +1,48 @@
+/**
+ * parallel.h
+ *
+ * Fork/join helper shared by the bulk load, the parallel scan and recovery:
+ * n workers, the calling thread being one of them, with exceptions carried
+ * back to the caller.
+ */
+
+#pragma once
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace scudb {
+
+// run f(0) ... f(n - 1) on n threads, f(0) on the calling thread. The first
+// exception thrown by any of them is rethrown once all threads are joined
+template <typename F> void RunInParallel(int n, const F &f)
+{
+  std::vector<std::exception_ptr> errors(n);
+  auto run = [&f, &errors](int i) {
+    try
+    {
+      f(i);
+    }
+    catch (...)
+    {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < n; ++i)
+  {
+    threads.emplace_back(run, i);
+  }
+  run(0);
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  for (auto &error : errors)
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
+
+} // namespace scudb
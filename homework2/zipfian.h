@@ -0,0 +1,64 @@
+/**
+ * zipfian.h
+ *
+ * Zipfian distributed item numbers for the benchmarks, after Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases", the generator YCSB
+ * uses. Item 0 is the hottest; callers scramble the result so hot items are
+ * not all next to each other.
+ */
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace scudb {
+
+// items can grow (inserts during the run), zeta is then extended
+// incrementally like YCSB does. Only growing changes the generator: threads
+// can share one over a fixed item count, otherwise every thread needs its own
+class ZipfianGenerator {
+public:
+  ZipfianGenerator(long items, double theta)
+      : items_(0), theta_(theta), zetan_(0)
+  {
+    zeta2_ = 1 + std::pow(0.5, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    grow(items);
+  }
+
+  long Next(std::mt19937_64 &rng) { return Next(items_, rng); }
+
+  // an item below items, which must not shrink between calls
+  long Next(long items, std::mt19937_64 &rng)
+  {
+    if (items > items_)
+      grow(items);
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    double uz = u * zetan_;
+    if (uz < 1.0)
+      return 0;
+    if (uz < zeta2_)
+      return 1;
+    long item = static_cast<long>(items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return std::min(item, items_ - 1);
+  }
+
+private:
+  void grow(long items)
+  {
+    for (long i = items_ + 1; i <= items; ++i)
+      zetan_ += 1 / std::pow(static_cast<double>(i), theta_);
+    items_ = items;
+    eta_ = (1 - std::pow(2.0 / items_, 1 - theta_)) / (1 - zeta2_ / zetan_);
+  }
+
+  long items_;
+  double theta_;
+  double zetan_;
+  double zeta2_;
+  double alpha_;
+  double eta_;
+};
+
+} // namespace scudb
@@ -1,9 +1,14 @@
 /**
  * b_plus_tree.cpp
  */
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 
+#include "buffer/parallel.h"
 #include "common/exception.h"
 #include "common/logger.h"
 #include "common/rid.h"
@@ -14,13 +19,62 @@
 
 namespace scudb {
 
+// metrics_
+enum {
+  TREE_SPLITS = 0,
+  TREE_ROOT_SPLITS,     // the tree grew by one level
+  TREE_MERGES,
+  TREE_REDISTRIBUTIONS,
+  TREE_ROOT_DROPS,      // the tree shrank by one level, or became empty
+  TREE_UPPER_LEVEL_HITS, // descents that started below the upper levels copy
+  TREE_UPPER_LEVEL_REBUILDS,
+  TREE_COUNTERS
+};
+static const char *const TREE_COUNTER_NAMES[TREE_COUNTERS] = {
+    "tree_splits", "tree_root_splits", "tree_merges",
+    "tree_redistributions", "tree_root_drops", "tree_upper_level_hits",
+    "tree_upper_level_rebuilds"};
+enum { TREE_ROOT_LATCH_WAIT = 0, TREE_HISTOGRAMS };
+static const char *const TREE_HISTOGRAM_NAMES[TREE_HISTOGRAMS] = {
+    "tree_root_latch_wait_ns"};
+
 INDEX_TEMPLATE_ARGUMENTS
 BPLUSTREE_TYPE::BPlusTree(const std::string &name,
                                 BufferPoolManager *buffer_pool_manager,
                                 const KeyComparator &comparator,
-                                page_id_t root_page_id)
-    : index_name_(name), root_page_id_(root_page_id),
-      buffer_pool_manager_(buffer_pool_manager), comparator_(comparator) {}
+                                page_id_t root_page_id, bool blink,
+                                bool cache_upper_levels, bool swizzle)
+    : index_name_(name), root_page_id_(root_page_id), root_pending_(false),
+      root_lsn_(INVALID_LSN), buffer_pool_manager_(buffer_pool_manager),
+      comparator_(comparator),
+      blink_(blink), cache_upper_levels_(cache_upper_levels),
+      structure_version_(0), frames_mask_(0),
+      metrics_(TREE_COUNTER_NAMES, TREE_COUNTERS, TREE_HISTOGRAM_NAMES,
+               TREE_HISTOGRAMS)
+{
+  if (!swizzle)
+    return;
+  // 直接映射，两倍于缓冲池大小，冲突只会让取页退回查页表
+  page_id_t size = 1;
+  while (static_cast<size_t>(size) < 2 * buffer_pool_manager->GetPoolSize())
+    size <<= 1;
+  frames_.reset(new std::atomic<Page *>[size]);
+  for (page_id_t i = 0; i < size; ++i)
+    frames_[i].store(nullptr);
+  frames_mask_ = size - 1;
+}
+
+/*
+ * A destructor can not report the failure, so it is only logged. Callers that
+ * need the root on disk call FlushRootPageId themselves and check it
+ */
+INDEX_TEMPLATE_ARGUMENTS
+BPLUSTREE_TYPE::~BPlusTree()
+{
+  if (!FlushRootPageId())
+    LOG_WARN("root page id of index %s not written, header page not pinned",
+             index_name_.c_str());
+}
 
 /*
  * Helper function to decide whether current b+tree is empty
@@ -43,35 +97,87 @@ bool BPLUSTREE_TYPE::GetValue(const KeyType &key,
                               std::vector<ValueType> &result,
                               Transaction *transaction) 
 {
+  // 只读映射：直接在文件映射上查，不 pin 不拷贝
+  bool found;
+  if (buffer_pool_manager_->IsMapped() && LookupInMapping(key, result, found))
+    return found;
+
   // 找到leaf
-  B_PLUS_TREE_LEAF_PAGE_TYPE *leaf = FindLeafPage(key,false,OpType::READ,transaction);
-  bool ret = false;
-  if (leaf == nullptr)
+  Page *page = FetchLeafPage(key, false, Operation::READONLY, transaction);
+  if (page == nullptr)
     return false;
- 
-  if (leaf != nullptr)
-  {
-        ValueType value;
-        if (leaf->Lookup(key, value, comparator_))
-        {
-            result.push_back(value);
-            ret = true;
-        }
 
-        UnlockUnpinPages(Operation::READONLY, transaction);
-
-        if (transaction == nullptr)
-        {
-            auto page_id = leaf->GetPageId();
-            buffer_pool_manager_->FetchPage(page_id)->RUnlatch();
-            buffer_pool_manager_->UnpinPage(page_id, false);
+  auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+  bool ret = false;
+  ValueType value;
+  if (leaf->Lookup(key, value, comparator_))
+  {
+    result.push_back(value);
+    ret = true;
+  }
 
-            buffer_pool_manager_->UnpinPage(page_id, false);
-        }
+  // leaf 只被 pin 了一次，释放一次即可
+  if (transaction == nullptr)
+  {
+    page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+  }
+  else
+  {
+    UnlockUnpinPages(Operation::READONLY, transaction);
   }
   return ret;
 }
 
+/*
+ * Zero-copy lookup for read-only replicas: walk down through page views of
+ * the mapped file. Nothing changes the file while it is mapped (the tree
+ * refuses modifications, see CheckWritable), so there is nothing to latch.
+ * Return false if some page is not in the mapping (the file grew), the
+ * caller then goes through the buffer pool
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::LookupInMapping(const KeyType &key,
+                                     std::vector<ValueType> &result,
+                                     bool &found)
+{
+  page_id_t page_id = root_page_id_;
+  found = false;
+  if (page_id == INVALID_PAGE_ID)
+    return true;
+  while (true)
+  {
+    const char *data = buffer_pool_manager_->FetchPageView(page_id);
+    if (data == nullptr)
+      return false;
+    auto *node = reinterpret_cast<const BPlusTreePage *>(data);
+    if (node->IsLeafPage())
+    {
+      auto *leaf = reinterpret_cast<const B_PLUS_TREE_LEAF_PAGE_TYPE *>(data);
+      ValueType value;
+      if (leaf->Lookup(key, value, comparator_))
+      {
+        result.push_back(value);
+        found = true;
+      }
+      return true;
+    }
+    auto *internal = reinterpret_cast<const B_PLUS_TREE_INTERNAL_PAGE *>(data);
+    page_id = internal->Lookup(key, comparator_);
+  }
+}
+
+/*
+ * Page views of a mapped file must not change under readers, so every
+ * modification is refused until the file is unmapped
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::CheckWritable()
+{
+  if (buffer_pool_manager_->IsMapped())
+    throw Exception(EXCEPTION_TYPE_INDEX, "index is read only while its file is mapped");
+}
+
 /*****************************************************************************
  * INSERTION
  *****************************************************************************/
@@ -86,12 +192,27 @@ INDEX_TEMPLATE_ARGUMENTS
 bool BPLUSTREE_TYPE::Insert(const KeyType &key, const ValueType &value,
                             Transaction *transaction) 
 {
-  std::lock_guard<std::mutex> lock(mutex_);
+  CheckWritable();
+  if (IsEmpty())
+  {
+    // 只在建树时拿树锁，拿到以后可能已经有别人建好了
+    std::lock_guard<std::mutex> lock(mutex_);
     if (IsEmpty())
     {
       StartNewTree(key, value);
       return true;
     }
+  }
+  if (blink_)
+  {
+    return InsertIntoLeafBLink(key, value);
+  }
+  // crabbing needs a page set to remember the latched ancestors
+  Transaction local_transaction(INVALID_TXN_ID);
+  if (transaction == nullptr)
+  {
+    transaction = &local_transaction;
+  }
   return InsertIntoLeaf(key, value, transaction);
 }
 /*
@@ -105,16 +226,17 @@ void BPLUSTREE_TYPE::StartNewTree(const KeyType &key, const ValueType &value)
 {
   page_id_t newPageId;
   Page *rootPage = buffer_pool_manager_->NewPage(newPageId);
-  assert(rootPage != nullptr);
+  if (rootPage == nullptr)
+    throw Exception(EXCEPTION_TYPE_INDEX, "out of memory");
 
   B_PLUS_TREE_LEAF_PAGE_TYPE *root = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(rootPage->GetData());
 
   root->Init(newPageId,INVALID_PAGE_ID);
-  root_page_id_ = newPageId;
-  UpdateRootPageId(true);
-  
-
   root->Insert(key,value,comparator_);
+  // 新页面没有旧内容，所有项都当作插入记下来
+  LogPageRange(LogRecordType::INDEX_SPLIT, root, 0, 0, root->GetSize(), nullptr);
+
+  UpdateRootPageId(newPageId);
 
   buffer_pool_manager_->UnpinPage(rootPage->GetPageId(),true);
 }
@@ -142,31 +264,13 @@ bool BPLUSTREE_TYPE::InsertIntoLeaf(const KeyType &key, const ValueType &value,
         UnlockUnpinPages(Operation::INSERT, transaction);
         return false;
     }
-    if (leaf->GetSize() < leaf->GetMaxSize())
-    {
-        leaf->Insert(key, value, comparator_);
-    }
-    else
+    // 先插入，超过 max size 再分裂
+    leaf->Insert(key, value, comparator_);
+    LogLeafEntry(LogRecordType::INDEX_INSERT, leaf,
+                 leaf->KeyIndex(key, comparator_), transaction);
+    if (leaf->GetSize() > leaf->GetMaxSize())
     {
-        auto* leaf2 = Split<BPlusTreeLeafPage<KeyType, ValueType, KeyComparator>>(leaf);
-        if (comparator_(key, leaf2->KeyAt(0)) < 0)
-        {
-            leaf->Insert(key, value, comparator_);
-        }
-        else
-        {
-            leaf2->Insert(key, value, comparator_);
-        }
-        if (comparator_(leaf->KeyAt(0), leaf2->KeyAt(0)) < 0)
-        {
-            leaf2->SetNextPageId(leaf->GetNextPageId());
-            leaf->SetNextPageId(leaf2->GetPageId());
-        }
-        else
-        {
-            leaf2->SetNextPageId(leaf->GetPageId());
-        }
-
+        auto* leaf2 = Split(leaf, transaction);
         InsertIntoParent(leaf, leaf2->KeyAt(0), leaf2, transaction);
     }
 
@@ -180,14 +284,33 @@ bool BPLUSTREE_TYPE::InsertIntoLeaf(const KeyType &key, const ValueType &value,
  * User needs to first ask for new page from buffer pool manager(NOTICE: throw
  * an "out of memory" exception if returned value is nullptr), then move half
  * of key & value pairs from input page to newly created page
+ * The new page is write latched and added to transaction's page set, so it is
+ * released together with the rest of the latched path. The children that move
+ * are pinned before anything changes; if that or the new page fails, the path
+ * is released and nothing has been modified.
  */
 INDEX_TEMPLATE_ARGUMENTS
-template <typename N> N *BPLUSTREE_TYPE::Split(N *node) 
+template <typename N> N *BPLUSTREE_TYPE::Split(N *node, Transaction *transaction) 
 { 
+  // 先钉住要搬走的孩子，结构改了一半就不能再因为缓冲池满而失败
+  std::vector<Page *> moved;
+  if (!node->IsLeafPage() &&
+      !PinChildren(reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node),
+                   node->GetSize() / 2, node->GetSize(), moved))
+  {
+    UnlockUnpinPages(Operation::INSERT, transaction);
+    throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while splitting");
+  }
   // 拿到新page
   page_id_t newPageId;
-  Page* const newPage = buffer_pool_manager_->NewPage(newPageId);
-  assert(newPage != nullptr);
+  Page* const newPage =
+      buffer_pool_manager_->NewPage(newPageId, node->GetPageId());
+  if (newPage == nullptr)
+  {
+    UnpinChildren(moved);
+    UnlockUnpinPages(Operation::INSERT, transaction);
+    throw Exception(EXCEPTION_TYPE_INDEX, "out of memory");
+  }
   newPage->WLatch();
   transaction->AddIntoPageSet(newPage);
   
@@ -195,8 +318,22 @@ template <typename N> N *BPLUSTREE_TYPE::Split(N *node)
   N *newNode = reinterpret_cast<N *>(newPage->GetData());
   newNode->Init(newPageId, node->GetParentPageId());
   node->MoveHalfTo(newNode, buffer_pool_manager_);
+  metrics_.Add(TREE_SPLITS);
+  if (!node->IsLeafPage())
+    StructureChanged();
 
- 
+  // 老页只记分裂点，搬走的项记在新页上
+  LogPageRange(LogRecordType::INDEX_SPLIT, node, node->GetSize(),
+               newNode->GetSize(), 0, transaction);
+  lsn_t lsn = LogPageRange(LogRecordType::INDEX_SPLIT, newNode, 0, 0,
+                           newNode->GetSize(), transaction);
+  if (!newNode->IsLeafPage())
+  {
+    // 搬走的孩子换了父结点
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(newNode);
+    ReparentChildren(internal, 0, internal->GetSize(), lsn);
+  }
+  UnpinChildren(moved);
   return newNode; 
 }
 
@@ -217,20 +354,368 @@ void BPLUSTREE_TYPE::InsertIntoParent(BPlusTreePage *old_node,
 {
     if (old_node->IsRootPage()) 
     {
-    Page* const newPage = buffer_pool_manager_->NewPage(root_page_id_);
-    assert(newPage != nullptr);
+      CreateNewRoot(old_node, key, new_node, transaction);
+      return;
+    }
+
+    // 父结点不安全，所以它还在 page set 里被写锁住、钉着，取页不会失败；
+    // 不多留这个 pin，上面一层出错时 UnlockUnpinPages 就能放干净
+    Page *page = buffer_pool_manager_->FetchPage(old_node->GetParentPageId());
+    assert(page != nullptr);
+    buffer_pool_manager_->UnpinPage(page, false);
+    auto *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
+    parent->InsertNodeAfter(old_node->GetPageId(), key, new_node->GetPageId());
+    new_node->SetParentPageId(parent->GetPageId());
+    LogPageRange(LogRecordType::INDEX_SPLIT, parent,
+                 parent->ValueIndex(new_node->GetPageId()), 0, 1, transaction);
+
+    // 这一层做完了，先放掉；父结点分裂时要给搬走的孩子加写锁，
+    // 拿着叶子再去锁它左边的叶子会和扫描互相等待
+    UnlockUnpinPage(old_node->GetPageId(), transaction);
+    UnlockUnpinPage(new_node->GetPageId(), transaction);
+
+    if (parent->GetSize() > parent->GetMaxSize())
+    {
+      auto *parent2 = Split(parent, transaction);
+      InsertIntoParent(parent, parent2->KeyAt(0), parent2, transaction);
+    }
+}
+
+/*
+ * Grow the tree by one level: old_node was the root and has just been split
+ * into old_node and new_node. The caller still holds old_node's write latch,
+ * so nobody else can split the old root before the new one is published.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::CreateNewRoot(BPlusTreePage *old_node,
+                                   const KeyType &key,
+                                   BPlusTreePage *new_node,
+                                   Transaction *transaction)
+{
+    page_id_t newRootId;
+    Page* const newPage = buffer_pool_manager_->NewPage(newRootId);
+    if (newPage == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "out of memory");
     assert(newPage->GetPinCount() == 1);
 
     B_PLUS_TREE_INTERNAL_PAGE *newRoot = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(newPage->GetData());
-    newRoot->Init(root_page_id_);
+    newRoot->Init(newRootId);
     newRoot->PopulateNewRoot(old_node->GetPageId(),key,new_node->GetPageId());
-    old_node->SetParentPageId(root_page_id_);
-    new_node->SetParentPageId(root_page_id_);
-    UpdateRootPageId();
+    // 两个孩子都还在调用者手里写锁着
+    old_node->SetParentPageId(newRootId);
+    new_node->SetParentPageId(newRootId);
+    lsn_t lsn = LogPageRange(LogRecordType::INDEX_SPLIT, newRoot, 0, 0,
+                             newRoot->GetSize(), transaction);
+    // 恢复从根的记录推出两个孩子的父结点，这条落盘以前它们不能写回
+    if (lsn != INVALID_LSN)
+    {
+      old_node->SetLSN(lsn);
+      new_node->SetLSN(lsn);
+    }
+    UpdateRootPageId(newRootId);
+    metrics_.Add(TREE_ROOT_SPLITS);
   
-    buffer_pool_manager_->UnpinPage(newRoot->GetPageId(),true);
-    return;
+    buffer_pool_manager_->UnpinPage(newRootId,true);
+}
+
+/*****************************************************************************
+ * B-LINK MODE
+ *****************************************************************************/
+/*
+ * In B-link mode every page carries a high key and a right link, so a page
+ * that has been split while nobody held a latch on its parent can still be
+ * reached by moving right. Readers and writers hold one latch at a time on
+ * the way down, and a split releases the child before latching the parent.
+ * Pages never merge in this mode (Lehman & Yao), deletes only shrink leaves.
+ */
+
+/*
+ * Follow right links while key is not smaller than the high key of page.
+ * The right sibling is latched before page is released.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::MoveRight(Page *page, const KeyType &key, bool exclusive)
+{
+  while (true)
+  {
+    auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+    page_id_t next_page_id;
+    KeyType high_key;
+    if (node->IsLeafPage())
+    {
+      auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(node);
+      next_page_id = leaf->GetNextPageId();
+      high_key = leaf->GetHighKey();
+    }
+    else
+    {
+      auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+      next_page_id = internal->GetNextPageId();
+      high_key = internal->GetHighKey();
+    }
+    if (next_page_id == INVALID_PAGE_ID || comparator_(key, high_key) < 0)
+      return page;
+
+    Page *next_page = FetchSwizzled(next_page_id);
+    if (next_page == nullptr)
+    {
+      if (exclusive)
+        page->WUnlatch();
+      else
+        page->RUnlatch();
+      buffer_pool_manager_->UnpinPage(page, false);
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while moving right");
+    }
+    if (exclusive)
+    {
+      next_page->WLatch();
+      page->WUnlatch();
+    }
+    else
+    {
+      next_page->RLatch();
+      page->RUnlatch();
+    }
+    buffer_pool_manager_->UnpinPage(page, false);
+    page = next_page;
+  }
+}
+
+/*
+ * Descend with one read latch at a time, from the parent of the leaves if
+ * the copy of the upper levels has one. The leaf is returned pinned once and
+ * read latched for READONLY, write latched otherwise.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::FetchLeafPageBLink(const KeyType &key, bool leftMost,
+                                         Operation op)
+{
+  Page *page = LatchFromUpperLevels(key, leftMost);
+  if (page == nullptr)
+  {
+    page_id_t root_page_id = root_page_id_;
+    if (root_page_id == INVALID_PAGE_ID)
+      return nullptr;
+    page = FetchSwizzled(root_page_id);
+    if (page == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while searching");
+    page->RLatch();
+  }
+  while (true)
+  {
+    if (!leftMost)
+      page = MoveRight(page, key, false);
+    auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+    if (node->IsLeafPage())
+      break;
+
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+    page_id_t child_page_id = leftMost ? internal->ValueAt(0)
+                                       : internal->Lookup(key, comparator_);
+    Page *child = FetchSwizzled(child_page_id);
+    if (child == nullptr)
+    {
+      page->RUnlatch();
+      buffer_pool_manager_->UnpinPage(page, false);
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while searching");
+    }
+    child->RLatch();
+    page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page, false);
+    page = child;
+  }
+
+  if (op != Operation::READONLY)
+  {
+    // 读锁换写锁，中间叶子可能被分裂，所以要再向右移动
+    page->RUnlatch();
+    page->WLatch();
+    if (!leftMost)
+      page = MoveRight(page, key, true);
+  }
+  return page;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::InsertIntoLeafBLink(const KeyType &key,
+                                         const ValueType &value)
+{
+  Page *page = FetchLeafPageBLink(key, false, Operation::INSERT);
+  if (page == nullptr)
+    return false;
+  auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+  ValueType v;
+  if (leaf->Lookup(key, v, comparator_))
+  {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    return false;
+  }
+  leaf->Insert(key, value, comparator_);
+  LogLeafEntry(LogRecordType::INDEX_INSERT, leaf,
+               leaf->KeyIndex(key, comparator_), nullptr);
+  if (leaf->GetSize() <= leaf->GetMaxSize())
+  {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+    return true;
+  }
+
+  // split: the new right half is linked in before anybody can see it, so the
+  // leaf latch can go before the parent is touched
+  page_id_t new_page_id;
+  Page *new_page = buffer_pool_manager_->NewPage(new_page_id, leaf->GetPageId());
+  if (new_page == nullptr)
+  {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+    throw Exception(EXCEPTION_TYPE_INDEX, "out of memory");
+  }
+  auto *leaf2 = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(new_page->GetData());
+  leaf2->Init(new_page_id, leaf->GetParentPageId());
+  leaf->MoveHalfTo(leaf2, buffer_pool_manager_);
+  metrics_.Add(TREE_SPLITS);
+  KeyType separator = leaf2->KeyAt(0);
+  LogPageRange(LogRecordType::INDEX_SPLIT, leaf, leaf->GetSize(),
+               leaf2->GetSize(), 0, nullptr);
+  LogPageRange(LogRecordType::INDEX_SPLIT, leaf2, 0, 0, leaf2->GetSize(),
+               nullptr);
+
+  if (leaf->IsRootPage())
+  {
+    CreateNewRoot(leaf, separator, leaf2);
+    buffer_pool_manager_->UnpinPage(new_page_id, true);
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+    return true;
+  }
+
+  page_id_t parent_page_id = leaf->GetParentPageId();
+  buffer_pool_manager_->UnpinPage(new_page_id, true);
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+  InsertIntoParentBLink(parent_page_id, separator, new_page_id);
+  return true;
+}
+
+/*
+ * Add <key, child_page_id> to the internal level above child. parent_page_id
+ * is the parent recorded in the split page: it is on the right level and at
+ * or left of the real parent, moving right finds the page that owns key.
+ * Splits propagate upwards iteratively, one latch held at a time.
+ * Everything a level needs (the child, the new page and the children that
+ * move to it) is pinned before the parent changes. If the pool can not
+ * supply them the parent is left as it was and the exception is thrown: the
+ * new child is still reachable through the right link of its left sibling.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::InsertIntoParentBLink(page_id_t parent_page_id,
+                                           KeyType key,
+                                           page_id_t child_page_id)
+{
+  while (true)
+  {
+    Page *child = buffer_pool_manager_->FetchPage(child_page_id);
+    if (child == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while inserting");
+    Page *page = buffer_pool_manager_->FetchPage(parent_page_id);
+    if (page == nullptr)
+    {
+      buffer_pool_manager_->UnpinPage(child, false);
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while inserting");
+    }
+    page->WLatch();
+    page = MoveRight(page, key, true);
+    auto *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
+
+    // 插入以后要分裂：新页和会搬走的孩子先拿到。插入点可能在搬走的那一半
+    // 前面，所以从前一个孩子开始钉
+    std::vector<Page *> moved;
+    page_id_t new_page_id = INVALID_PAGE_ID;
+    Page *new_page = nullptr;
+    if (parent->GetSize() >= parent->GetMaxSize())
+    {
+      int begin = std::max(0, (parent->GetSize() + 1) / 2 - 1);
+      if (PinChildren(parent, begin, parent->GetSize(), moved))
+        new_page = buffer_pool_manager_->NewPage(new_page_id, parent->GetPageId());
+      if (new_page == nullptr)
+      {
+        UnpinChildren(moved);
+        page->WUnlatch();
+        buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+        buffer_pool_manager_->UnpinPage(child, false);
+        throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while splitting");
+      }
     }
+
+    parent->InsertByKey(key, child_page_id, comparator_);
+    lsn_t lsn = LogPageRange(LogRecordType::INDEX_SPLIT, parent,
+                             parent->ValueIndex(child_page_id), 0, 1, nullptr);
+
+    // 孩子分裂完就解锁了，别的线程可能正拿着它的锁读父结点
+    Reparent(child_page_id, parent->GetPageId(), lsn);
+    buffer_pool_manager_->UnpinPage(child, false);
+
+    if (new_page == nullptr)
+    {
+      page->WUnlatch();
+      buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+      return;
+    }
+
+    // 孩子一改指向 parent2，别的线程就能顺着孩子找上来，改完之前一直锁着
+    new_page->WLatch();
+    auto *parent2 = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(new_page->GetData());
+    parent2->Init(new_page_id, parent->GetParentPageId());
+    parent->MoveHalfTo(parent2, buffer_pool_manager_);
+    metrics_.Add(TREE_SPLITS);
+    StructureChanged();
+    KeyType separator = parent2->KeyAt(0);
+    LogPageRange(LogRecordType::INDEX_SPLIT, parent, parent->GetSize(),
+                 parent2->GetSize(), 0, nullptr);
+    lsn = LogPageRange(LogRecordType::INDEX_SPLIT, parent2, 0, 0,
+                       parent2->GetSize(), nullptr);
+    ReparentChildren(parent2, 0, parent2->GetSize(), lsn);
+    UnpinChildren(moved);
+
+    if (parent->IsRootPage())
+    {
+      CreateNewRoot(parent, separator, parent2);
+      new_page->WUnlatch();
+      buffer_pool_manager_->UnpinPage(new_page_id, true);
+      page->WUnlatch();
+      buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+      return;
+    }
+
+    parent_page_id = parent->GetParentPageId();
+    new_page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(new_page_id, true);
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+    key = separator;
+    child_page_id = new_page_id;
+  }
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::RemoveBLink(const KeyType &key)
+{
+  Page *page = FetchLeafPageBLink(key, false, Operation::DELETE);
+  if (page == nullptr)
+    return;
+  auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+  int slot = leaf->KeyIndex(key, comparator_);
+  bool dirty = slot < leaf->GetSize() &&
+               comparator_(leaf->KeyAt(slot), key) == 0;
+  if (dirty)
+  {
+    // 删除前记录，撤销时需要原来的值
+    LogLeafEntry(LogRecordType::INDEX_DELETE, leaf, slot, nullptr);
+    leaf->RemoveAndDeleteRecord(key, comparator_);
+  }
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), dirty);
 }
 
 /*****************************************************************************
@@ -246,22 +731,36 @@ void BPLUSTREE_TYPE::InsertIntoParent(BPlusTreePage *old_node,
 INDEX_TEMPLATE_ARGUMENTS
 void BPLUSTREE_TYPE::Remove(const KeyType &key, Transaction *transaction) 
 {
+  CheckWritable();
   if (IsEmpty())
     return;
+  if (blink_)
+  {
+    RemoveBLink(key);
+    return;
+  }
+  // crabbing needs a page set to remember the latched ancestors
+  Transaction local_transaction(INVALID_TXN_ID);
+  if (transaction == nullptr)
+  {
+    transaction = &local_transaction;
+  }
 
   auto* leaf = FindLeafPage(key, false, Operation::DELETE, transaction);
-  if (leaf != nullptr)
+  if (leaf == nullptr)
+    return;
+  int slot = leaf->KeyIndex(key, comparator_);
+  if (slot < leaf->GetSize() && comparator_(leaf->KeyAt(slot), key) == 0)
   {
-      int size_before_deletion = leaf->GetSize();
-      if (leaf->RemoveAndDeleteRecord(key, comparator_) != size_before_deletion)
-      {
-          if (CoalesceOrRedistribute(leaf, transaction))
-          {
-              transaction->AddIntoDeletedPageSet(leaf->GetPageId());
-          }
-      }
-      UnlockUnpinPages(Operation::DELETE, transaction);
+    // 删除前记录，撤销时需要原来的值
+    LogLeafEntry(LogRecordType::INDEX_DELETE, leaf, slot, transaction);
+    leaf->RemoveAndDeleteRecord(key, comparator_);
+    if (CoalesceOrRedistribute(leaf, transaction))
+    {
+      transaction->AddIntoDeletedPageSet(leaf->GetPageId());
+    }
   }
+  UnlockUnpinPages(Operation::DELETE, transaction);
 }
 
 /*
@@ -275,190 +774,113 @@ INDEX_TEMPLATE_ARGUMENTS
 template <typename N>
 bool BPLUSTREE_TYPE::CoalesceOrRedistribute(N *node, Transaction *transaction) 
 {
-  auto *leaf = FindLeafPage(key_t, false, Operation::INSERT, transaction);
-    if (leaf == nullptr)
+  if (node->IsRootPage())
+  {
+    return AdjustRoot(node);
+  }
+  if (node->GetSize() >= node->GetMinSize())
+  {
+    return false;
+  }
+
+  // node 不安全，所以父结点还在 page set 里被写锁住、钉着，取页不会失败。
+  // 上一层可能会先放掉 parent，页号先记下来
+  page_id_t parent_page_id = node->GetParentPageId();
+  Page *parent_page = buffer_pool_manager_->FetchPage(parent_page_id);
+  assert(parent_page != nullptr);
+  buffer_pool_manager_->UnpinPage(parent_page, false);
+  auto *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(parent_page->GetData());
+  int index = parent->ValueIndex(node->GetPageId());
+  assert(index < parent->GetSize());
+
+  // 优先找左兄弟，最左边的孩子找右兄弟
+  page_id_t sibling_page_id = parent->ValueAt(index == 0 ? 1 : index - 1);
+  Page *sibling_page = buffer_pool_manager_->FetchPage(sibling_page_id);
+  if (sibling_page == nullptr)
+  {
+    UnlockUnpinPages(Operation::DELETE, transaction);
+    throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while deleting");
+  }
+  if (index > 0)
+  {
+    // 扫描沿叶子链表从左往右拿锁，拿着自己再等左兄弟会和扫描互相等待。
+    // 先放掉自己，按从左往右的顺序重新拿；父结点一直写锁着，别的写者进不来
+    Page *node_page = buffer_pool_manager_->FetchPage(node->GetPageId());
+    node_page->WUnlatch();
+    sibling_page->WLatch();
+    node_page->WLatch();
+    buffer_pool_manager_->UnpinPage(node->GetPageId(), false);
+  }
+  else
+  {
+    sibling_page->WLatch();
+  }
+  transaction->AddIntoPageSet(sibling_page);
+  auto *sibling = reinterpret_cast<N *>(sibling_page->GetData());
+
+  bool node_should_delete = false;
+  if (sibling->GetSize() + node->GetSize() > node->GetMaxSize())
+  {
+    // 借过来的孩子先钉住，理由同 Split
+    std::vector<Page *> moved;
+    if (!node->IsLeafPage())
     {
-      if (node->IsRootPage())
+      auto *donor = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(sibling);
+      int child = index == 0 ? 0 : donor->GetSize() - 1;
+      if (!PinChildren(donor, child, child + 1, moved))
       {
-        return AdjustRoot(node);
+        UnlockUnpinPages(Operation::DELETE, transaction);
+        throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while deleting");
       }
-    if (node->IsLeafPage())
-    {
-        if (node->GetSize() >= node->GetMinSize())
-        {
-            return false;
-        }
-    }
-    else
-    {
-        if (node->GetSize() > node->GetMinSize())
-        {
-            return false;
-        }
     }
-
-    auto* page = buffer_pool_manager_->FetchPage(node->GetParentPageId());
-
-    auto parent = reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t,KeyComparator>*>(page->GetData());
-    int value_index = parent->ValueIndex(node->GetPageId());
-
-    assert(value_index != parent->GetSize());
-
-    int sibling_page_id;
-    if (value_index == 0)
+    Redistribute(sibling, node, index);
+    // 内部页第 0 个 key 没有意义，借出的第一项和借进的第一项旁边那一项也变了
+    int extra = node->IsLeafPage() ? 0 : 1;
+    lsn_t lsn;
+    if (index == 0)
     {
-        sibling_page_id = parent->ValueAt(value_index + 1);
+      LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, sibling, 0, 1 + extra,
+                   extra, transaction);
+      lsn = LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, node,
+                         node->GetSize() - 1, 0, 1, transaction);
     }
     else
     {
-        sibling_page_id = parent->ValueAt(value_index - 1);
+      LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, sibling,
+                   sibling->GetSize(), 1, 0, transaction);
+      lsn = LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, node, 0, extra,
+                         1 + extra, transaction);
     }
-
-    page = buffer_pool_manager_->FetchPage(sibling_page_id);
-    
-    page->WLatch();
-    transaction->AddIntoPageSet(page);
-    auto sibling = reinterpret_cast<N*>(page->GetData());
-    bool redistribute = false;
-
-    if (sibling->GetSize() + node->GetSize() > node->GetMaxSize())
+    LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, parent,
+                 index == 0 ? 1 : index, 1, 1, transaction);
+    if (!node->IsLeafPage())
     {
-        redistribute = true;
-        buffer_pool_manager_->UnpinPage(parent->GetPageId(), true);
+      // 借过来的孩子换了父结点
+      auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+      int child = index == 0 ? internal->GetSize() - 1 : 0;
+      ReparentChildren(internal, child, child + 1, lsn);
     }
-    if (redistribute) 
+    UnpinChildren(moved);
+  }
+  else
+  {
+    // 总是把右边的页并进左边的页
+    bool parent_should_delete;
+    if (index == 0)
     {
-        if (value_index == 0)
-        {
-            Redistribute<N>(sibling, node, 1);
-        }
-        return false;
+      parent_should_delete = Coalesce(node, sibling, parent, 1, transaction);
     }
-
-    bool ret;
-    if (value_index == 0) 
+    else
     {
-        Coalesce<N>(node, sibling, parent, 1, transaction);
-        transaction->AddIntoDeletedPageSet(sibling_page_id);
-        ret = false;
+      parent_should_delete = Coalesce(sibling, node, parent, index, transaction);
+      node_should_delete = true;
     }
-    else 
+    if (parent_should_delete)
     {
-        Coalesce<N>(sibling, node, parent, value_index, transaction);
-        ret = true;
+      transaction->AddIntoDeletedPageSet(parent_page_id);
     }
-    buffer_pool_manager_->UnpinPage(parent->GetPageId(), true);
-    return ret;
-    }
-    ValueType v;
-    if (leaf->Lookup(key, v, comparator_))
-    {
-      UnlockUnpinPages(Operation::INSERT, transaction);
-      if (node->IsRootPage())
-      {
-        return AdjustRoot(node);
-      }
-    if (node->IsLeafPage())
-    {
-        if (node->GetSize() >= node->GetMinSize())
-        {
-            return false;
-        }
-    }
-    else
-    {
-        if (node->GetSize() > node->GetMinSize())
-        {
-            return false;
-        }
-    }
-
-    auto* page = buffer_pool_manager_->FetchPage(node->GetParentPageId());
-    if (page == nullptr)
-
-    auto parent =
-        reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t,KeyComparator>*>(page->GetData());
-    int value_index = parent->ValueIndex(node->GetPageId());
-
-    assert(value_index != parent->GetSize());
-
-    int sibling_page_id;
-    if (value_index == 0)
-    {
-        sibling_page_id = parent->ValueAt(value_index + 1);
-    }
-    else
-    {
-        sibling_page_id = parent->ValueAt(value_index - 1);
-    }
-
-    page = buffer_pool_manager_->FetchPage(sibling_page_id);
-
-    
-    page->WLatch();
-    transaction->AddIntoPageSet(page);
-    auto sibling = reinterpret_cast<N*>(page->GetData());
-    bool redistribute = false;
-
-    if (sibling->GetSize() + node->GetSize() > node->GetMaxSize())
-    {
-        redistribute = true;
-        buffer_pool_manager_->UnpinPage(parent->GetPageId(), true);
-    }
-    if (redistribute) 
-    {
-        if (value_index == 0)
-        {
-            Redistribute<N>(sibling, node, 1);
-        }
-        return false;
-    }
-
-    bool ret;
-    if (value_index == 0) 
-    {
-        Coalesce<N>(node, sibling, parent, 1, transaction);
-        transaction->AddIntoDeletedPageSet(sibling_page_id);
-        ret = false;
-    }
-    else 
-    {
-        Coalesce<N>(sibling, node, parent, value_index, transaction);
-        ret = true;
-    }
-    buffer_pool_manager_->UnpinPage(parent->GetPageId(), true);
-    return ret;
-    }
-    if (leaf->GetSize() < leaf->GetMaxSize())
-    {
-      leaf->Insert(key, value, comparator_);
-    }
-    else
-    {
-      auto *leaf2 = Split<BPlusTreeLeafPage<KeyType, ValueType, KeyComparator>>(leaf);
-      if (comparator_(key, leaf2->KeyAt(0)) < 0)
-      {
-        leaf->Insert(key, value, comparator_);
-      }
-      else
-      {
-        leaf2->Insert(key, value, comparator_);
-      }
-      if (comparator_(leaf->KeyAt(0), leaf2->KeyAt(0)) < 0)
-      {
-        leaf2->SetNextPageId(leaf->GetNextPageId());
-        leaf->SetNextPageId(leaf2->GetPageId());
-      }
-      else
-      {
-        leaf2->SetNextPageId(leaf->GetPageId());
-      }
-
-      InsertIntoParent(leaf, leaf2->KeyAt(0), leaf2, transaction);
-    }
-
-    UnlockUnpinPages(Operation::INSERT, transaction);
-    return true;
+  }
+  return node_should_delete;
 }
 
 /*
@@ -482,15 +904,38 @@ bool BPLUSTREE_TYPE::Coalesce(
 {
   
   assert(node->GetSize() + neighbor_node->GetSize() <= node->GetMaxSize());
-  
+
+  // 搬走的孩子先钉住，理由同 Split
+  std::vector<Page *> moved;
+  if (!node->IsLeafPage() &&
+      !PinChildren(reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node), 0,
+                   node->GetSize(), moved))
+  {
+    UnlockUnpinPages(Operation::DELETE, transaction);
+    throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while deleting");
+  }
   // 移动后一个
+  int start = neighbor_node->GetSize();
   node->MoveAllTo(neighbor_node,index,buffer_pool_manager_);
+  metrics_.Add(TREE_MERGES);
+  if (!node->IsLeafPage())
+    StructureChanged();
   transaction->AddIntoDeletedPageSet(node->GetPageId());
   parent->Remove(index);
-  if (parent->GetSize() <= parent->GetMinSize()) {
-    return CoalesceOrRedistribute(parent,transaction);
+
+  lsn_t lsn = LogPageRange(LogRecordType::INDEX_MERGE, neighbor_node, start, 0,
+                           neighbor_node->GetSize() - start, transaction);
+  LogPageRange(LogRecordType::INDEX_MERGE, parent, index, 1, 0, transaction);
+  if (!neighbor_node->IsLeafPage())
+  {
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(neighbor_node);
+    ReparentChildren(internal, start, internal->GetSize(), lsn);
   }
-  return false;
+  UnpinChildren(moved);
+  // 留下来的页这一层做完了，先放掉，理由同 InsertIntoParent；
+  // 被删的页还要锁到最后
+  UnlockUnpinPage(neighbor_node->GetPageId(), transaction);
+  return CoalesceOrRedistribute(parent, transaction);
 }
 
 /*
@@ -512,18 +957,12 @@ void BPLUSTREE_TYPE::Redistribute(N *neighbor_node, N *node, int index)
   }
   else
   {
-      auto* page = buffer_pool_manager_->FetchPage(node->GetParentPageId());
-      if (page == nullptr)
-      {
-          throw Exception(EXCEPTION_TYPE_INDEX,
-              "all page are pinned while Redistribute");
-      }
-      auto parent =
-          reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t,KeyComparator>*>(page->GetData());
-      int idx = parent->ValueIndex(node->GetPageId());
-      buffer_pool_manager_->UnpinPage(parent->GetPageId(), false);
-      neighbor_node->MoveLastToFrontOf(node, idx, buffer_pool_manager_);
+      // index 就是 node 在父结点中的位置
+      neighbor_node->MoveLastToFrontOf(node, index, buffer_pool_manager_);
   }
+  metrics_.Add(TREE_REDISTRIBUTIONS);
+  if (!node->IsLeafPage())
+    StructureChanged();
 }
 /*
  * Update root page if necessary
@@ -532,6 +971,8 @@ void BPLUSTREE_TYPE::Redistribute(N *neighbor_node, N *node, int index)
  * case 1: when you delete the last element in root page, but root page still
  * has one last child
  * case 2: when you delete the last element in whole b+ tree
+ * If the only child can not be pinned the root is left as it is: a root with
+ * one child is still a valid tree, and a later delete drops it.
  * @return : true means root page should be deleted, false means no deletion
  * happend
  */
@@ -540,32 +981,365 @@ bool BPLUSTREE_TYPE::AdjustRoot(BPlusTreePage *old_root_node)
 {
   if (old_root_node->IsLeafPage()) 
   {
-    assert(old_root_node->GetSize() == 0);
+    if (old_root_node->GetSize() > 0)
+      return false;
     assert (old_root_node->GetParentPageId() == INVALID_PAGE_ID);
-    root_page_id_ = INVALID_PAGE_ID;
-    UpdateRootPageId();
+    UpdateRootPageId(INVALID_PAGE_ID);
+    metrics_.Add(TREE_ROOT_DROPS);
     return true;
   }
 
   if (old_root_node->GetSize() == 1) 
   {
     B_PLUS_TREE_INTERNAL_PAGE *root = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(old_root_node);
+    std::vector<Page *> child;
+    if (!PinChildren(root, 0, 1, child))
+      return false;
     const page_id_t newRootId = root->RemoveAndReturnOnlyChild();
-    root_page_id_ = newRootId;
-    UpdateRootPageId();
-    
-    // 设置为无效
-    Page *page = buffer_pool_manager_->FetchPage(newRootId);
-    assert(page != nullptr);
-    B_PLUS_TREE_INTERNAL_PAGE *newRoot =
-            reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
-    newRoot->SetParentPageId(INVALID_PAGE_ID);
-    buffer_pool_manager_->UnpinPage(newRootId, true);
+    // 先把孩子改成根再发布，拿到新根的线程看到的一定是根。
+    // 恢复从根的记录推出它没有父结点，它的 LSN 要跟上那一条
+    Reparent(newRootId, INVALID_PAGE_ID, INVALID_LSN);
+    lsn_t lsn = UpdateRootPageId(newRootId);
+    Reparent(newRootId, INVALID_PAGE_ID, lsn);
+    UnpinChildren(child);
+    metrics_.Add(TREE_ROOT_DROPS);
     return true;
   }
   return false;
 }
 
+/*****************************************************************************
+ * COMPACTION
+ *****************************************************************************/
+/*
+ * Online compaction, one level at a time from the leaves up: the children of
+ * every node are repacked to fill_factor of their capacity, so under-filled
+ * siblings merge, and a root left with a single child is dropped, which
+ * shrinks the tree. With the free space map, leaves are also moved right
+ * behind their left neighbour under the same parent, so a scan reads
+ * ascending pages.
+ * Every step couples down to one node like a safe delete, releasing each
+ * ancestor once the child is latched, and then holds only that node and
+ * the children it works on. A node never goes below its min size through
+ * compaction (the root aside), so it never needs its parent, and reads and
+ * writes elsewhere in the tree go on. B-link trees never merge pages (their
+ * readers hold no parent latch), nothing is done for them.
+ * @return: number of pages freed
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int BPLUSTREE_TYPE::Compact(double fill_factor)
+{
+  CheckWritable();
+  if (blink_)
+    return 0;
+  int freed = 0;
+  for (int level = 1;; ++level)
+  {
+    KeyType cursor;
+    bool leftMost = true;
+    bool more = true;
+    while (more)
+    {
+      if (!CompactStep(level, leftMost, cursor, fill_factor, freed, more))
+        return freed;
+      leftMost = false;
+    }
+  }
+}
+
+/*
+ * Repack the children of the node on level (leaves are level 0) that covers
+ * cursor, or of the leftmost one. Only the root is latched while the height
+ * is read: levels count from the leaves, so the node stays on its level
+ * after the root is released. cursor is then set to the first key right of
+ * the node, more is false if there is none
+ * @return: false if the tree is not that high (any more)
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::CompactStep(int level, bool leftMost, KeyType &cursor,
+                                 double fill_factor, int &freed, bool &more)
+{
+  more = false;
+  Transaction transaction(INVALID_TXN_ID);
+  Page *page = LatchRoot(true);
+  if (page == nullptr)
+    return false;
+  transaction.AddIntoPageSet(page);
+
+  // 根结点写锁住时树高不会变
+  int height = 0;
+  Page *cur = nullptr;
+  auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+  while (!node->IsLeafPage())
+  {
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+    Page *child = buffer_pool_manager_->FetchPage(internal->ValueAt(0));
+    if (child == nullptr)
+    {
+      // 放掉路径上已经拿到的锁和 pin 再报错
+      if (cur != nullptr)
+      {
+        cur->RUnlatch();
+        buffer_pool_manager_->UnpinPage(cur->GetPageId(), false);
+      }
+      UnlockUnpinPages(Operation::DELETE, &transaction);
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while compacting");
+    }
+    child->RLatch();
+    if (cur != nullptr)
+    {
+      cur->RUnlatch();
+      buffer_pool_manager_->UnpinPage(cur->GetPageId(), false);
+    }
+    cur = child;
+    node = reinterpret_cast<BPlusTreePage *>(child->GetData());
+    ++height;
+  }
+  if (cur != nullptr)
+  {
+    cur->RUnlatch();
+    buffer_pool_manager_->UnpinPage(cur->GetPageId(), false);
+  }
+  if (height < level)
+  {
+    UnlockUnpinPages(Operation::DELETE, &transaction);
+    return false;
+  }
+
+  // 一层一层换锁往下走：目标结点只会少孩子，而且不会少过 min size（根除外），
+  // 用不着它上面的结点
+  KeyType next;
+  auto *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
+  for (int l = height; l > level; --l)
+  {
+    page_id_t child_page_id = leftMost ? parent->ValueAt(0)
+                                       : parent->Lookup(cursor, comparator_);
+    int branch = parent->ValueIndex(child_page_id);
+    if (branch + 1 < parent->GetSize())
+    {
+      next = parent->KeyAt(branch + 1);
+      more = true;
+    }
+    Page *child = buffer_pool_manager_->FetchPage(child_page_id);
+    if (child == nullptr)
+    {
+      UnlockUnpinPages(Operation::DELETE, &transaction);
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while compacting");
+    }
+    child->WLatch();
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    transaction.GetPageSet()->clear();
+    transaction.AddIntoPageSet(child);
+    page = child;
+    parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(child->GetData());
+  }
+  if (more)
+    cursor = next;
+
+  if (level == 1)
+    freed += CompactChildren<B_PLUS_TREE_LEAF_PAGE_TYPE>(parent, fill_factor,
+                                                         &transaction);
+  else
+    freed += CompactChildren<B_PLUS_TREE_INTERNAL_PAGE>(parent, fill_factor,
+                                                        &transaction);
+  if (parent->IsRootPage() && AdjustRoot(parent))
+  {
+    transaction.AddIntoDeletedPageSet(parent->GetPageId());
+    ++freed;
+  }
+  UnlockUnpinPages(Operation::DELETE, &transaction);
+  return true;
+}
+
+/*
+ * Walk the children of parent left to right, topping up each one from the
+ * next until it holds fill_factor of its capacity; a sibling that fits
+ * completely is merged and deleted, one that does not keeps at least its
+ * min size (merging past capacity if both can not). Merges stop while parent
+ * is at its min size, unless it is the root. At most the previous, current
+ * and next child are latched at a time, always in chain order like the
+ * iterator. If a child can not be fetched, or the grandchildren a merge or
+ * top-up moves can not be pinned beforehand, the children held and the pages
+ * in transaction are released before throwing.
+ * @return: number of pages merged away
+ */
+INDEX_TEMPLATE_ARGUMENTS
+template <typename N>
+int BPLUSTREE_TYPE::CompactChildren(B_PLUS_TREE_INTERNAL_PAGE *parent,
+                                    double fill_factor,
+                                    Transaction *transaction)
+{
+  std::vector<Page *> held;
+  Page *prev_page = nullptr;
+  auto release = [this, &held](Page *page) {
+    held.erase(std::find(held.begin(), held.end(), page));
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+  };
+  auto fail = [this, &held, &release, transaction]() {
+    while (!held.empty())
+      release(held.back());
+    UnlockUnpinPages(Operation::DELETE, transaction);
+    throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while compacting");
+  };
+  auto fetch = [this, &held, &fail](page_id_t page_id) {
+    Page *page = buffer_pool_manager_->FetchPage(page_id);
+    if (page == nullptr)
+      fail();
+    page->WLatch();
+    held.push_back(page);
+    return page;
+  };
+
+  int freed = 0;
+  int index = 0;
+  Page *out_page = fetch(parent->ValueAt(0));
+  while (true)
+  {
+    N *out = reinterpret_cast<N *>(out_page->GetData());
+    int capacity = std::max(2, std::min(out->GetMaxSize(),
+        static_cast<int>(out->GetMaxSize() * fill_factor)));
+    Page *next_page = nullptr;
+    while (next_page == nullptr && index + 1 < parent->GetSize() &&
+           out->GetSize() < capacity)
+    {
+      Page *page = fetch(parent->ValueAt(index + 1));
+      N *node = reinterpret_cast<N *>(page->GetData());
+      int start = out->GetSize();
+      // 两页都得留够 min size：总数不到两页的 min 时超过 capacity 也合并
+      int total = start + node->GetSize();
+      bool can_merge = parent->IsRootPage() ||
+                       parent->GetSize() > parent->GetMinSize();
+      bool merge = can_merge &&
+                   (total <= capacity || total < 2 * node->GetMinSize());
+      // 要搬的孙子先钉住，理由同 Split
+      std::vector<Page *> moved;
+      if (!node->IsLeafPage())
+      {
+        int count = merge ? node->GetSize()
+                          : std::min(capacity - start,
+                                     node->GetSize() - node->GetMinSize());
+        if (!PinChildren(reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node),
+                         0, std::max(0, count), moved))
+          fail();
+      }
+      lsn_t lsn = INVALID_LSN;
+      if (merge)
+      {
+        page_id_t page_id = node->GetPageId();
+        node->MoveAllTo(out, index + 1, buffer_pool_manager_);
+        parent->Remove(index + 1);
+        // 合并掉的页马上就解锁了，读者得在那之前知道结构变了
+        if (!out->IsLeafPage())
+          StructureChanged();
+        release(page);
+        transaction->AddIntoDeletedPageSet(page_id);
+        metrics_.Add(TREE_MERGES);
+        ++freed;
+        lsn = LogPageRange(LogRecordType::INDEX_MERGE, out, start, 0,
+                           out->GetSize() - start, transaction);
+        LogPageRange(LogRecordType::INDEX_MERGE, parent, index + 1, 1, 0,
+                     transaction);
+      }
+      else
+      {
+        while (out->GetSize() < capacity && node->GetSize() > node->GetMinSize())
+          node->MoveFirstToEndOf(out, buffer_pool_manager_);
+        metrics_.Add(TREE_REDISTRIBUTIONS);
+        if (!out->IsLeafPage())
+          StructureChanged();
+        next_page = page;
+        int count = out->GetSize() - start;
+        if (count > 0)
+        {
+          // 同 CoalesceOrRedistribute，内部页借出的第一项旁边那一项也变了
+          int extra = node->IsLeafPage() ? 0 : 1;
+          LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, node, 0,
+                       count + extra, extra, transaction);
+          lsn = LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, out, start, 0,
+                             count, transaction);
+          LogPageRange(LogRecordType::INDEX_REDISTRIBUTE, parent, index + 1, 1,
+                       1, transaction);
+        }
+      }
+      if (!out->IsLeafPage())
+      {
+        auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(out);
+        ReparentChildren(internal, start, internal->GetSize(), lsn);
+      }
+      UnpinChildren(moved);
+    }
+
+    if (out->IsLeafPage() && prev_page != nullptr)
+    {
+      Page *moved = RelocateLeaf(out_page, prev_page, parent, index, transaction);
+      std::replace(held.begin(), held.end(), out_page, moved);
+      out_page = moved;
+    }
+    if (prev_page != nullptr)
+      release(prev_page);
+    prev_page = out_page;
+    if (next_page == nullptr)
+    {
+      if (index + 1 >= parent->GetSize())
+        break;
+      next_page = fetch(parent->ValueAt(index + 1));
+    }
+    out_page = next_page;
+    ++index;
+  }
+  release(prev_page);
+  return freed;
+}
+
+/*
+ * Move the leaf in page (child index of parent) to a free page right behind
+ * the leaf in prev_page, if the free space map has one closer than where it
+ * is now. All three are write latched. Return the frame holding the leaf
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::RelocateLeaf(Page *page, Page *prev_page,
+                                   B_PLUS_TREE_INTERNAL_PAGE *parent,
+                                   int index, Transaction *transaction)
+{
+  page_id_t page_id = page->GetPageId();
+  page_id_t prev_page_id = prev_page->GetPageId();
+  if (buffer_pool_manager_->GetFreeSpaceMap() == nullptr ||
+      page_id == prev_page_id + 1)
+    return page;
+  page_id_t new_page_id;
+  Page *new_page = buffer_pool_manager_->NewPage(new_page_id, prev_page_id);
+  if (new_page == nullptr)
+    return page;
+  // 只搬到左边叶子后面、而且比原来更近的地方
+  if (new_page_id < prev_page_id ||
+      (page_id > prev_page_id && new_page_id > page_id))
+  {
+    buffer_pool_manager_->UnpinPage(new_page_id, false);
+    buffer_pool_manager_->DeletePage(new_page_id);
+    return page;
+  }
+
+  new_page->WLatch();
+  memcpy(new_page->GetData(), page->GetData(), PAGE_SIZE);
+  auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(new_page->GetData());
+  auto *prev = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(prev_page->GetData());
+  leaf->SetPageId(new_page_id);
+  prev->SetNextPageId(new_page_id);
+  parent->SetValueAt(index, new_page_id);
+  LogPageRange(LogRecordType::INDEX_SPLIT, leaf, 0, 0, leaf->GetSize(),
+               transaction);
+  // 左边的叶子只改了页头里的右指针
+  LogPageRange(LogRecordType::INDEX_MERGE, prev, 0, 0, 0, transaction);
+  LogPageRange(LogRecordType::INDEX_MERGE, parent, index, 1, 1, transaction);
+
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page_id, true);
+  transaction->AddIntoDeletedPageSet(page_id);
+  return new_page;
+}
+
 /*****************************************************************************
  * INDEX ITERATOR
  *****************************************************************************/
@@ -578,7 +1352,8 @@ INDEX_TEMPLATE_ARGUMENTS
 INDEXITERATOR_TYPE BPLUSTREE_TYPE::Begin() 
 { 
   KeyType key{};
-  return IndexIterator<KeyType, ValueType, KeyComparator>(FindLeafPage(key, true), 0, buffer_pool_manager_);
+  Page *page = FetchLeafPage(key, true, Operation::READONLY, nullptr);
+  return INDEXITERATOR_TYPE(page, 0, buffer_pool_manager_);
 }
 
 /*
@@ -589,130 +1364,1362 @@ INDEXITERATOR_TYPE BPLUSTREE_TYPE::Begin()
 INDEX_TEMPLATE_ARGUMENTS
 INDEXITERATOR_TYPE BPLUSTREE_TYPE::Begin(const KeyType &key) 
 {
-    auto* leaf = FindLeafPage(key, false);
-    int index = 0;
-    if (leaf != nullptr)
-      index = leaf->KeyIndex(key, comparator_);
-
-    return IndexIterator<KeyType, ValueType, KeyComparator>(leaf, index, buffer_pool_manager_);
+  Page *page = FetchLeafPage(key, false, Operation::READONLY, nullptr);
+  int index = 0;
+  if (page != nullptr)
+  {
+    auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+    index = leaf->KeyIndex(key, comparator_);
+  }
+  return INDEXITERATOR_TYPE(page, index, buffer_pool_manager_);
 }
 
 /*****************************************************************************
- * UTILITIES AND DEBUG
+ * BULK LOAD
  *****************************************************************************/
 /*
- * Find leaf page containing particular key, if leftMost flag == true, find
- * the left most leaf page
+ * Parallel bulk load:
+ * 1. pick partition bounds from a sorted sample of the input
+ * 2. every thread scatters its slice of the input into per-partition buckets
+ * 3. every partition is gathered, sorted and de-duplicated on its own thread
+ * 4. the leaf count is fixed over all partitions together, and the leaves
+ *    starting in a partition are written out as a chain on its thread
+ * 5. the partition chains are linked together and the internal levels are
+ *    built over all leaves up to a common root
+ * The tree mutex is held for the whole build, so it must start out empty.
  */
 INDEX_TEMPLATE_ARGUMENTS
-B_PLUS_TREE_LEAF_PAGE_TYPE *FindLeafPage(const KeyType &key,
-                                           bool leftMost = false,
-                                           OpType op = OpType::READ,
-                                           Transaction *transaction = nullptr)
+bool BPLUSTREE_TYPE::BulkLoad(const std::vector<MappingType> &items,
+                              int num_threads,
+                              __attribute__((unused)) Transaction *transaction)
 {
-  if (op != Operation::READONLY)
-  {
-    lockRoot();
-    root_is_locked = true;
-  }
+  CheckWritable();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsEmpty())
+    return false;
+  if (items.empty())
+    return true;
 
-  if (IsEmpty())
+  auto key_less = [this](const KeyType &a, const KeyType &b) {
+    return comparator_(a, b) < 0;
+  };
+  auto item_less = [this](const MappingType &a, const MappingType &b) {
+    return comparator_(a.first, b.first) < 0;
+  };
+  auto item_equal = [this](const MappingType &a, const MappingType &b) {
+    return comparator_(a.first, b.first) == 0;
+  };
+
+  // 1. 采样确定分区边界
+  num_threads = std::max(1, std::min<int>(num_threads, items.size()));
+  std::vector<KeyType> splitters;
+  if (num_threads > 1)
   {
-    return nullptr;
+    size_t sample_size = std::min(items.size(), (size_t)num_threads * 32);
+    size_t stride = items.size() / sample_size;
+    std::vector<KeyType> sample;
+    for (size_t i = 0; i < sample_size; ++i)
+    {
+      sample.push_back(items[i * stride].first);
+    }
+    std::sort(sample.begin(), sample.end(), key_less);
+    for (int p = 1; p < num_threads; ++p)
+    {
+      splitters.push_back(sample[p * sample_size / num_threads]);
+    }
   }
+  int partitions = splitters.size() + 1;
 
-  auto* parent = buffer_pool_manager_->FetchPage(root_page_id_);
-  
-  if (op == Operation::READONLY)
+  // 2. 每个线程把自己那一段输入分到各个分区
+  std::vector<std::vector<std::vector<MappingType>>> buckets(
+      num_threads, std::vector<std::vector<MappingType>>(partitions));
+  RunInParallel(num_threads, [&](int t) {
+    size_t begin = items.size() * t / num_threads;
+    size_t end = items.size() * (t + 1) / num_threads;
+    for (size_t i = begin; i < end; ++i)
+    {
+      int p = std::upper_bound(splitters.begin(), splitters.end(),
+                               items[i].first, key_less) -
+              splitters.begin();
+      buckets[t][p].push_back(items[i]);
+    }
+  });
+
+  // 3. 每个分区排序、去重
+  std::vector<std::vector<MappingType>> runs(partitions);
+  RunInParallel(partitions, [&](int p) {
+    std::vector<MappingType> &run = runs[p];
+    for (int t = 0; t < num_threads; ++t)
+    {
+      run.insert(run.end(), buckets[t][p].begin(), buckets[t][p].end());
+      std::vector<MappingType>().swap(buckets[t][p]);
+    }
+    // stable, so that the first occurrence of a duplicate key wins
+    std::stable_sort(run.begin(), run.end(), item_less);
+    run.erase(std::unique(run.begin(), run.end(), item_equal), run.end());
+  });
+
+  // 4. 叶子数按所有分区一起算，每片叶子一样满；跨分区的叶子由它开头所在的
+  //    分区来建，这样分区边界上不会剩下不到 min size 的叶子
+  std::vector<int64_t> offsets(partitions + 1, 0);
+  for (int p = 0; p < partitions; ++p)
+    offsets[p + 1] = offsets[p] + runs[p].size();
+  int64_t total = offsets.back();
+  int max_size = B_PLUS_TREE_LEAF_PAGE_TYPE::Capacity() - 1;
+  int num_leaves = (total + max_size - 1) / max_size;
+  // 第一片开头不早于 offset 的叶子
+  auto first_leaf = [total, num_leaves](int64_t offset) {
+    return static_cast<int>((offset * num_leaves + total - 1) / total);
+  };
+  std::vector<std::vector<std::pair<KeyType, page_id_t>>> leaves(partitions);
+  RunInParallel(partitions, [&](int p) {
+    BuildLeafLevel(runs, offsets, num_leaves, first_leaf(offsets[p]),
+                   first_leaf(offsets[p + 1]), leaves[p]);
+  });
+  std::vector<std::vector<MappingType>>().swap(runs);
+
+  // 5. 把各分区的叶子链首尾相连，再自底向上建立内部结点
+  std::vector<std::pair<KeyType, page_id_t>> level;
+  for (int p = 0; p < partitions; ++p)
   {
-      parent->RLatch();
+    if (leaves[p].empty())
+      continue;
+    if (!level.empty())
+    {
+      Page *page = buffer_pool_manager_->FetchPage(level.back().second);
+      if (page == nullptr)
+        throw Exception(EXCEPTION_TYPE_INDEX,
+                        "all page are pinned while bulk loading");
+      auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+      leaf->SetNextPageId(leaves[p].front().second);
+      leaf->SetHighKey(leaves[p].front().first);
+      buffer_pool_manager_->UnpinPage(page->GetPageId(), true);
+    }
+    level.insert(level.end(), leaves[p].begin(), leaves[p].end());
   }
-  else
+  // 新建的页面不写日志，发布根之前直接刷盘
+  std::vector<page_id_t> built;
+  for (auto &entry : level)
+    built.push_back(entry.second);
+  while (level.size() > 1)
   {
-      parent->WLatch();
+    std::vector<std::pair<KeyType, page_id_t>> parents;
+    BuildInternalLevel(level, parents);
+    level.swap(parents);
+    for (auto &entry : level)
+      built.push_back(entry.second);
   }
-  if (transaction != nullptr)
+  if (LoggingEnabled())
   {
-      transaction->AddIntoPageSet(parent);
+    for (page_id_t page_id : built)
+      buffer_pool_manager_->FlushPage(page_id);
   }
-  auto* node = reinterpret_cast<BPlusTreePage*>(parent->GetData());
-  while (!node->IsLeafPage()) 
-  {
-      auto internal =
-          reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t,
-          KeyComparator>*>(node);
-      page_id_t parent_page_id = node->GetPageId(); 
-      page_id_t child_page_id;
-      if (leftMost)
-      {
-          child_page_id = internal->ValueAt(0);
-      }
-      else 
-      {
-          child_page_id = internal->Lookup(key, comparator_);
-      }
-      auto* child = buffer_pool_manager_->FetchPage(child_page_id);
 
-      if (op == Operation::READONLY)
-      {
-          child->RLatch();
-          UnlockUnpinPages(op, transaction);
-      }
-      else
-      {
-          child->WLatch();
-      }
-      node = reinterpret_cast<BPlusTreePage*>(child->GetData());
-      assert(node->GetParentPageId() == parent_page_id);
-      if (op != Operation::READONLY && isSafe(node, op))
-      {
-          UnlockUnpinPages(op, transaction);
-      }
-      if (transaction != nullptr)
-      {
-          transaction->AddIntoPageSet(child);
-      }
-      else
-      {
-          parent->RUnlatch();
-          buffer_pool_manager_->UnpinPage(parent->GetPageId(), false);
-          parent = child;
-      }
-  }
-  return reinterpret_cast<BPlusTreeLeafPage<KeyType,
-      ValueType, KeyComparator>*>(node);
+  UpdateRootPageId(level.front().second);
+  return true;
 }
 
-
-
 /*
- * Update/Insert root page id in header page(where page_id = 0, header_page is
- * defined under include/page/header_page.h)
- * Call this method everytime root page id is changed.
- * @parameter: insert_record      defualt value is false. When set to true,
- * insert a record <index_name, root_page_id> into header page instead of
- * updating it.
+ * Write leaves [first, last) of num_leaves out as a chain of leaf pages. The
+ * entries are the sorted, duplicate free runs one after the other (run r
+ * starts at offsets[r]) and are spread evenly over all num_leaves leaves, so
+ * no leaf ends up below min size unless all of them fit in one page; a leaf
+ * may take entries from more than one run. <first key, page id> of every leaf
+ * is appended to leaves. Only the previous and the current leaf are pinned at
+ * any time.
  */
 INDEX_TEMPLATE_ARGUMENTS
-void BPLUSTREE_TYPE::UpdateRootPageId(int insert_record) 
+void BPLUSTREE_TYPE::BuildLeafLevel(
+    const std::vector<std::vector<MappingType>> &runs,
+    const std::vector<int64_t> &offsets, int num_leaves, int first, int last,
+    std::vector<std::pair<KeyType, page_id_t>> &leaves)
 {
-  HeaderPage *header_page = static_cast<HeaderPage *>(
-      buffer_pool_manager_->FetchPage(HEADER_PAGE_ID));
-  if (insert_record)
-    // create a new record<index_name + root_page_id> in header_page
-    header_page->InsertRecord(index_name_, root_page_id_);
-  else
-    // update root_page_id in header_page
-    header_page->UpdateRecord(index_name_, root_page_id_);
-  buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, true);
+  int64_t total = offsets.back();
+  B_PLUS_TREE_LEAF_PAGE_TYPE *prev = nullptr;
+  for (int i = first; i < last; ++i)
+  {
+    page_id_t page_id;
+    // 连续的叶子尽量放在连续的页里
+    Page *page = buffer_pool_manager_->NewPage(
+        page_id, prev == nullptr ? INVALID_PAGE_ID : prev->GetPageId());
+    if (page == nullptr)
+    {
+      if (prev != nullptr)
+        buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+      throw Exception(EXCEPTION_TYPE_INDEX, "out of memory while bulk loading");
+    }
+    auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+    leaf->Init(page_id, INVALID_PAGE_ID);
+
+    int64_t begin = total * i / num_leaves;
+    int64_t end = total * (i + 1) / num_leaves;
+    // 开头所在的那一段，空的段跳过
+    int r = std::upper_bound(offsets.begin(), offsets.end(), begin) -
+            offsets.begin() - 1;
+    const KeyType &first_key = runs[r][begin - offsets[r]].first;
+    for (int64_t pos = begin; pos < end; ++r)
+    {
+      int64_t stop = std::min(end, offsets[r + 1]);
+      leaf->AppendSorted(runs[r].data() + (pos - offsets[r]), stop - pos);
+      pos = stop;
+    }
+    leaves.emplace_back(first_key, page_id);
+
+    if (prev != nullptr)
+    {
+      prev->SetNextPageId(page_id);
+      prev->SetHighKey(first_key);
+      buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+    }
+    prev = leaf;
+  }
+  if (prev != nullptr)
+    buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
 }
 
 /*
- * This method is used for debug only
- * print out whole b+tree sturcture, rank by rank
+ * Build one internal level over children (<first key, page id> pairs in key
+ * order), spreading them evenly, and return the new level in parents.
+ * Pages of the level are linked by their right links like the leaves.
  */
 INDEX_TEMPLATE_ARGUMENTS
-std::string BPLUSTREE_TYPE::ToString(bool verbose) { return "Empty tree"; }
+void BPLUSTREE_TYPE::BuildInternalLevel(
+    const std::vector<std::pair<KeyType, page_id_t>> &children,
+    std::vector<std::pair<KeyType, page_id_t>> &parents)
+{
+  int total = children.size();
+  int num_nodes = 1;
+  B_PLUS_TREE_INTERNAL_PAGE *prev = nullptr;
+  for (int i = 0; i < num_nodes; ++i)
+  {
+    page_id_t page_id;
+    Page *page = buffer_pool_manager_->NewPage(
+        page_id, prev == nullptr ? INVALID_PAGE_ID : prev->GetPageId());
+    if (page == nullptr)
+    {
+      if (prev != nullptr)
+        buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+      throw Exception(EXCEPTION_TYPE_INDEX, "out of memory while bulk loading");
+    }
+    auto *node = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
+    node->Init(page_id, INVALID_PAGE_ID);
+    if (i == 0)
+    {
+      num_nodes = (total + node->GetMaxSize() - 1) / node->GetMaxSize();
+    }
+
+    int begin = (long)total * i / num_nodes;
+    int end = (long)total * (i + 1) / num_nodes;
+    node->PopulateFromSorted(children.data() + begin, end - begin);
+    // 树还没发布，不用写日志；后台刷盘可能正读着孩子，照样加写锁
+    for (int c = begin; c < end; ++c)
+    {
+      Page *child_page = buffer_pool_manager_->FetchPage(children[c].second);
+      if (child_page == nullptr)
+      {
+        // 孩子取不到：放掉这一层手里的两页再往外抛
+        buffer_pool_manager_->UnpinPage(page_id, true);
+        if (prev != nullptr)
+          buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+        throw Exception(EXCEPTION_TYPE_INDEX,
+                        "all page are pinned while bulk loading");
+      }
+      child_page->WLatch();
+      reinterpret_cast<BPlusTreePage *>(child_page->GetData())
+          ->SetParentPageId(page_id);
+      child_page->WUnlatch();
+      buffer_pool_manager_->UnpinPage(children[c].second, true);
+    }
+    parents.emplace_back(children[begin].first, page_id);
+
+    if (prev != nullptr)
+    {
+      prev->SetNextPageId(page_id);
+      prev->SetHighKey(children[begin].first);
+      buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+    }
+    prev = node;
+  }
+  buffer_pool_manager_->UnpinPage(prev->GetPageId(), true);
+}
+
+/*****************************************************************************
+ * PARALLEL SCAN
+ *****************************************************************************/
+/*
+ * Collect separator keys level by level, starting from the root, until there
+ * are enough of them to cut the key space into num_partitions pieces (or the
+ * leaf level is reached). Every page is read latched only while its keys are
+ * copied, so this does not block writers for long. Partitions are only as
+ * even as the subtrees below the chosen separators.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::GetPartitionKeys(int num_partitions,
+                                      std::vector<KeyType> &bounds)
+{
+  bounds.clear();
+  page_id_t root_page_id = root_page_id_;
+  if (num_partitions <= 1 || root_page_id == INVALID_PAGE_ID)
+    return;
+
+  std::vector<KeyType> separators;    // 当前层各结点之间的分隔键
+  std::vector<page_id_t> level{root_page_id};
+  while ((int)separators.size() < num_partitions - 1)
+  {
+    std::vector<KeyType> next_separators;
+    std::vector<page_id_t> next_level;
+    bool reached_leaf = false;
+    for (size_t i = 0; i < level.size(); ++i)
+    {
+      Page *page = buffer_pool_manager_->FetchPage(level[i]);
+      if (page == nullptr)
+        throw Exception(EXCEPTION_TYPE_INDEX,
+                        "all page are pinned while partitioning");
+      page->RLatch();
+      auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+      if (node->IsLeafPage())
+      {
+        reached_leaf = true;
+      }
+      else
+      {
+        auto *internal = reinterpret_cast<
+            BPlusTreeInternalPage<KeyType, page_id_t, KeyComparator> *>(node);
+        if (i > 0)
+          next_separators.push_back(separators[i - 1]);
+        for (int j = 0; j < internal->GetSize(); ++j)
+        {
+          if (j > 0)
+            next_separators.push_back(internal->KeyAt(j));
+          next_level.push_back(internal->ValueAt(j));
+        }
+      }
+      page->RUnlatch();
+      buffer_pool_manager_->UnpinPage(level[i], false);
+      if (reached_leaf)
+        break;
+    }
+    if (reached_leaf)
+      break;
+    separators.swap(next_separators);
+    level.swap(next_level);
+  }
+
+  // pages were read one at a time, a concurrent split may have left the
+  // collected keys slightly out of order
+  auto less = [this](const KeyType &a, const KeyType &b) {
+    return comparator_(a, b) < 0;
+  };
+  auto equal = [this](const KeyType &a, const KeyType &b) {
+    return comparator_(a, b) == 0;
+  };
+  std::sort(separators.begin(), separators.end(), less);
+  separators.erase(std::unique(separators.begin(), separators.end(), equal),
+                   separators.end());
+
+  int total = separators.size();
+  int parts = std::min(num_partitions, total + 1);
+  for (int i = 1; i < parts; ++i)
+  {
+    bounds.push_back(separators[(long)i * total / parts]);
+  }
+}
+
+/*
+ * Scan partition [low, high) in every worker thread with its own iterator.
+ * The first worker starts at the left most leaf and the last one runs to the
+ * end of the leaf chain. Entries are handed to func a batch at a time.
+ * If a worker throws (func included), the first exception is rethrown after
+ * every worker has finished.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::ParallelScan(
+    int num_threads,
+    const std::function<void(int, const KeyType *, const ValueType *, int)>
+        &func)
+{
+  std::vector<KeyType> bounds;
+  GetPartitionKeys(num_threads, bounds);
+  int partitions = bounds.size() + 1;
+
+  auto worker = [&](int id) {
+    const int batch_size = 256;
+    std::vector<KeyType> keys(batch_size);
+    std::vector<ValueType> values(batch_size);
+    const KeyType *high = id < partitions - 1 ? &bounds[id] : nullptr;
+    INDEXITERATOR_TYPE iter = id == 0 ? Begin() : Begin(bounds[id - 1]);
+    while (true)
+    {
+      int count = iter.NextBatch(keys.data(), values.data(), batch_size);
+      if (count == 0)
+        break;
+      bool done = false;
+      if (high != nullptr && comparator_(keys[count - 1], *high) >= 0)
+      {
+        // 只有最后一批会越过上界，二分找到截断位置
+        count = std::lower_bound(keys.begin(), keys.begin() + count, *high,
+                                 [this](const KeyType &a, const KeyType &b) {
+                                   return comparator_(a, b) < 0;
+                                 }) -
+                keys.begin();
+        done = true;
+      }
+      if (count > 0)
+        func(id, keys.data(), values.data(), count);
+      if (done)
+        break;
+    }
+  };
+  RunInParallel(partitions, worker);
+}
+
+/*****************************************************************************
+ * METRICS
+ *****************************************************************************/
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::GetMetrics(MetricsSnapshot &snapshot)
+{
+  int64_t height = Height();
+  metrics_.Snapshot(snapshot);
+  snapshot.values.emplace_back("tree_height", height);
+}
+
+/*****************************************************************************
+ * CHECK AND STATISTICS
+ *****************************************************************************/
+/*
+ * Check, GetStats and ToString share one depth first walk. It latches pages
+ * like a reader, top-down and left to right, and keeps the path from the
+ * root read latched, so the subtree it is in can not change under it:
+ * readers never wait for it, crabbing writers only when it holds their path.
+ * Every page is checked while it is latched:
+ *   - page id and max size, min size unless it is the root or the tree is in
+ *     B-link mode (no merges), internal pages have at least two children
+ *   - keys are sorted and lie within the separators of the parent, the page
+ *     points back at its parent, all leaves are on the same level
+ *   - the right links of every level visit the pages in key order, the high
+ *     key is the separator right of the page and above all of its keys
+ * In B-link mode a page split off while its parent was not latched can only
+ * be reached through the right link of its left sibling for a while, such
+ * pages are visited along the right links and checked the same way.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::Check(std::vector<std::string> *errors)
+{
+  Checker checker;
+  checker.errors = errors;
+  WalkTree(checker);
+  return checker.error_count == 0;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::GetStats(Stats &stats, bool leaf_ranges)
+{
+  Checker checker;
+  checker.leaf_ranges = leaf_ranges;
+  WalkTree(checker);
+  stats = std::move(checker.stats);
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+std::string BPLUSTREE_TYPE::Stats::ToString() const
+{
+  if (height < 0)
+    return "Empty tree";
+  std::ostringstream os;
+  os << "height " << height << ", " << keys << " keys" << std::endl;
+  os << std::fixed << std::setprecision(1);
+  for (int level = height; level >= 0; --level)
+  {
+    os << "level " << level << ": " << pages[level] << " pages, "
+       << entries[level] << (level == 0 ? " keys" : " children") << ", fill "
+       << fill[level] * 100 << "%" << std::endl;
+  }
+  os << "leaf chain: " << leaf_sequential << " of " << pages[0] - 1
+     << " right links to the next page id, " << leaf_ascending
+     << " to a higher one" << std::endl;
+  for (const LeafRange &leaf : leaves)
+  {
+    os << "leaf " << leaf.page_id << " <" << leaf.size << ">";
+    if (leaf.size > 0)
+      os << " " << leaf.low << " .. " << leaf.high;
+    os << std::endl;
+  }
+  return os.str();
+}
+
+/*
+ * @return: false if the tree is empty
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::WalkTree(Checker &checker)
+{
+  Page *page = LatchRoot();
+  if (page == nullptr)
+    return false;
+  CheckPage(page, INVALID_PAGE_ID, nullptr, nullptr, 0, checker);
+  page->RUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+
+  // 每一层最后一页不能再有右链接
+  for (size_t depth = 0; depth < checker.levels.size(); ++depth)
+    WalkRightLinks(depth, INVALID_PAGE_ID, checker);
+
+  Stats &stats = checker.stats;
+  stats.height = static_cast<int>(checker.levels.size()) - 1;
+  for (auto level = checker.levels.rbegin(); level != checker.levels.rend();
+       ++level)
+  {
+    stats.pages.push_back(level->pages);
+    stats.entries.push_back(level->entries);
+    stats.fill.push_back(level->capacity == 0 ? 0.0
+                                              : static_cast<double>(level->entries) /
+                                                    level->capacity);
+  }
+  return true;
+}
+
+/*
+ * Check the read latched page and its subtree, whose keys must lie in
+ * [*low, *high) (nullptr is unbounded). The caller unlatches the page.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::CheckPage(Page *page, page_id_t parent_page_id,
+                               const KeyType *low, const KeyType *high,
+                               int depth, Checker &checker)
+{
+  if (checker.levels.size() <= static_cast<size_t>(depth))
+    checker.levels.resize(depth + 1);
+  page_id_t page_id = page->GetPageId();
+  auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+  if (!CheckNode(page, depth, checker))
+    return;
+
+  if (node->GetParentPageId() != parent_page_id)
+    CheckFailed(checker, page_id,
+                "parent is page " + std::to_string(node->GetParentPageId()) +
+                    " instead of " + std::to_string(parent_page_id));
+  // 页内的顺序 CheckNode 已经查过，只要看首尾两个 key
+  int first = node->IsLeafPage() ? 0 : 1;
+  int size = node->GetSize();
+  if (size > first)
+  {
+    KeyType first_key, last_key;
+    if (node->IsLeafPage())
+    {
+      auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(node);
+      first_key = leaf->KeyAt(first);
+      last_key = leaf->KeyAt(size - 1);
+    }
+    else
+    {
+      auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+      first_key = internal->KeyAt(first);
+      last_key = internal->KeyAt(size - 1);
+    }
+    if ((low != nullptr && comparator_(first_key, *low) < 0) ||
+        (high != nullptr && comparator_(last_key, *high) >= 0))
+      CheckFailed(checker, page_id, "keys outside the separators of the parent");
+  }
+  if (high != nullptr)
+  {
+    // 右边还有兄弟，high key 就是父结点（或更上层）的分隔键，B-link 模式下
+    // 刚分裂出来还没插进父结点的页在中间，high key 可以更小
+    const typename Checker::Level &level = checker.levels[depth];
+    if (level.next == INVALID_PAGE_ID)
+      CheckFailed(checker, page_id, "no right link but a separator right of it");
+    else if (blink_ ? comparator_(level.high, *high) > 0
+                    : comparator_(level.high, *high) != 0)
+      CheckFailed(checker, page_id, "high key is not the separator right of it");
+  }
+  if (node->IsLeafPage())
+    return;
+
+  auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+  for (int i = 0; i < size; ++i)
+  {
+    KeyType child_low, child_high;
+    if (i > 0)
+      child_low = internal->KeyAt(i);
+    if (i + 1 < size)
+      child_high = internal->KeyAt(i + 1);
+    page_id_t child_page_id = internal->ValueAt(i);
+    // 先把只能经右链接到达的页查完再锁 child: 持有 child 的读锁再去锁它左边
+    // 的页，会和持有左边页写锁、正向右移动的 B-link 插入互相等待
+    if (checker.levels.size() > static_cast<size_t>(depth + 1) &&
+        checker.levels[depth + 1].last != INVALID_PAGE_ID &&
+        checker.levels[depth + 1].next != child_page_id)
+      WalkRightLinks(depth + 1, child_page_id, checker);
+    Page *child = buffer_pool_manager_->FetchPage(child_page_id);
+    if (child == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while checking");
+    child->RLatch();
+    CheckPage(child, page_id, i == 0 ? low : &child_low,
+              i + 1 == size ? high : &child_high, depth + 1, checker);
+    child->RUnlatch();
+    buffer_pool_manager_->UnpinPage(child->GetPageId(), false);
+  }
+}
+
+/*
+ * Checks that need nothing but the read latched page itself and the page
+ * left of it on the same level, then count the page in the stats.
+ * @return: false if the page has been visited before
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::CheckNode(Page *page, int depth, Checker &checker)
+{
+  page_id_t page_id = page->GetPageId();
+  if (!checker.visited.insert(page_id).second)
+  {
+    CheckFailed(checker, page_id, "reached twice");
+    return false;
+  }
+  auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+  int size = node->GetSize();
+  if (node->GetPageId() != page_id)
+    CheckFailed(checker, page_id,
+                "page id is " + std::to_string(node->GetPageId()));
+  if (size > node->GetMaxSize())
+    CheckFailed(checker, page_id, "size " + std::to_string(size) +
+                                      " over max size " +
+                                      std::to_string(node->GetMaxSize()));
+  if (!blink_ && depth > 0 && size < node->GetMinSize())
+    CheckFailed(checker, page_id, "size " + std::to_string(size) +
+                                      " under min size " +
+                                      std::to_string(node->GetMinSize()));
+
+  // 页内 key 严格递增，内部结点的第 0 个 key 没有意义
+  int first;
+  page_id_t next_page_id;
+  KeyType high_key, first_key, last_key;
+  bool sorted = true;
+  if (node->IsLeafPage())
+  {
+    if (checker.leaf_depth < 0)
+      checker.leaf_depth = depth;
+    else if (depth != checker.leaf_depth)
+      CheckFailed(checker, page_id, "leaf on depth " + std::to_string(depth) +
+                                        ", others on depth " +
+                                        std::to_string(checker.leaf_depth));
+    auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(node);
+    first = 0;
+    for (int i = 1; i < size && sorted; ++i)
+      sorted = comparator_(leaf->KeyAt(i - 1), leaf->KeyAt(i)) < 0;
+    if (size > 0)
+    {
+      first_key = leaf->KeyAt(0);
+      last_key = leaf->KeyAt(size - 1);
+    }
+    next_page_id = leaf->GetNextPageId();
+    high_key = leaf->GetHighKey();
+  }
+  else
+  {
+    if (checker.leaf_depth >= 0 && depth >= checker.leaf_depth)
+      CheckFailed(checker, page_id, "internal page on the leaf level");
+    if (size < 2)
+      CheckFailed(checker, page_id, "internal page with " +
+                                        std::to_string(size) + " children");
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+    first = 1;
+    for (int i = 2; i < size && sorted; ++i)
+      sorted = comparator_(internal->KeyAt(i - 1), internal->KeyAt(i)) < 0;
+    if (size > 1)
+    {
+      first_key = internal->KeyAt(1);
+      last_key = internal->KeyAt(size - 1);
+    }
+    next_page_id = internal->GetNextPageId();
+    high_key = internal->GetHighKey();
+  }
+  if (!sorted)
+    CheckFailed(checker, page_id, "keys out of order");
+
+  typename Checker::Level &level = checker.levels[depth];
+  if (size > first)
+  {
+    if (level.last != INVALID_PAGE_ID && comparator_(first_key, level.high) < 0)
+      CheckFailed(checker, page_id, "keys below the high key of page " +
+                                        std::to_string(level.last));
+    if (next_page_id != INVALID_PAGE_ID && comparator_(last_key, high_key) >= 0)
+      CheckFailed(checker, page_id, "keys not below its high key");
+  }
+
+  level.pages++;
+  level.entries += size;
+  level.capacity += node->GetMaxSize();
+  if (node->IsLeafPage())
+  {
+    Stats &stats = checker.stats;
+    stats.keys += size;
+    if (next_page_id != INVALID_PAGE_ID && next_page_id == page_id + 1)
+      stats.leaf_sequential++;
+    if (next_page_id != INVALID_PAGE_ID && next_page_id > page_id)
+      stats.leaf_ascending++;
+    if (checker.leaf_ranges)
+      stats.leaves.push_back(LeafRange{page_id, size, first_key, last_key});
+  }
+  if (checker.print)
+  {
+    if (!level.line.empty())
+      level.line += " | ";
+    level.line += node->IsLeafPage()
+        ? reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(node)->ToString(checker.verbose)
+        : reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node)->ToString(checker.verbose);
+  }
+  level.last = page_id;
+  level.next = next_page_id;
+  level.high = high_key;
+  return true;
+}
+
+/*
+ * Follow the right links from the last page seen on level depth until stop.
+ * Anything in between is an error, except in B-link mode, where it is a page
+ * its parent does not know yet: it is checked without its parent and its
+ * children are reached the same way on the next level.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::WalkRightLinks(int depth, page_id_t stop,
+                                    Checker &checker)
+{
+  while (checker.levels[depth].next != stop)
+  {
+    const typename Checker::Level &level = checker.levels[depth];
+    if (!blink_ || level.next == INVALID_PAGE_ID)
+    {
+      CheckFailed(checker, level.last,
+                  "right link to page " + std::to_string(level.next) +
+                      " instead of page " + std::to_string(stop));
+      return;
+    }
+    Page *page = buffer_pool_manager_->FetchPage(level.next);
+    if (page == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while checking");
+    page->RLatch();
+    bool first_visit = CheckNode(page, depth, checker);
+    page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    if (!first_visit)
+      return;
+  }
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::CheckFailed(Checker &checker, page_id_t page_id,
+                                 const std::string &message)
+{
+  checker.error_count++;
+  if (checker.errors != nullptr)
+    checker.errors->push_back("page " + std::to_string(page_id) + ": " +
+                              message);
+}
+
+/*****************************************************************************
+ * UTILITIES AND DEBUG
+ *****************************************************************************/
+/*
+ * The frame hint is read and written without ordering: FetchPage pins the
+ * frame and then checks that it still holds page_id, so a stale hint only
+ * costs the page table lookup
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::FetchSwizzled(page_id_t page_id)
+{
+  if (frames_ == nullptr)
+    return buffer_pool_manager_->FetchPage(page_id);
+  std::atomic<Page *> &frame = frames_[page_id & frames_mask_];
+  Page *hint = frame.load(std::memory_order_relaxed);
+  Page *page = buffer_pool_manager_->FetchPage(page_id, hint);
+  if (page != nullptr && page != hint)
+    frame.store(page, std::memory_order_relaxed);
+  return page;
+}
+
+/*
+ * Nobody takes the tree mutex to find the root: the root may split or be
+ * replaced before its page latch is granted, then start over with the new
+ * one. The root page id only changes while the old root is write latched,
+ * so once the latch is granted and it is still the root, it stays the root
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::LatchRoot(bool exclusive)
+{
+  while (!IsEmpty())
+  {
+    page_id_t root_page_id = root_page_id_.load();
+    Page *page = FetchSwizzled(root_page_id);
+    if (page == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while searching");
+    if (exclusive)
+    {
+      // 写者之间只在根结点的写锁上排队
+      uint64_t start = MetricsNow();
+      page->WLatch();
+      metrics_.Record(TREE_ROOT_LATCH_WAIT, MetricsNow() - start);
+    }
+    else
+    {
+      page->RLatch();
+    }
+    if (page->GetPageId() == root_page_id_.load())
+      return page;
+    if (exclusive)
+      page->WUnlatch();
+    else
+      page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page, false);
+  }
+  return nullptr;
+}
+
+/*
+ * The height is read like a scan would, with read latches coupled down the
+ * leftmost path, so it never blocks writers for long. It is -1 for an empty
+ * tree, 0 when the root is a leaf
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int BPLUSTREE_TYPE::Height()
+{
+  Page *page = LatchRoot();
+  if (page == nullptr)
+    return -1;
+  int height = 0;
+  auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+  while (!node->IsLeafPage())
+  {
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+    Page *child = buffer_pool_manager_->FetchPage(internal->ValueAt(0));
+    if (child == nullptr)
+      break;
+    child->RLatch();
+    page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+    page = child;
+    node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+    ++height;
+  }
+  page->RUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+  return height;
+}
+
+/*
+ * Read latch the parent of the leaves that covers key (or the leftmost one)
+ * through the copy of the upper levels, without touching the pages above it.
+ * In crabbing mode the page is only used if no internal page changed since
+ * the copy was made: every such change bumps the structure version before
+ * the changed pages are unlatched, and the version is read again once the
+ * latch is granted. In B-link mode a page only ever hands keys over to its
+ * right, so an outdated copy still gives a page at or left of the right one
+ * and MoveRight does the rest.
+ * @return: nullptr if the copy can not be used, descend from the root then
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::LatchFromUpperLevels(const KeyType &key, bool leftMost)
+{
+  if (!cache_upper_levels_)
+    return nullptr;
+  uint64_t version = structure_version_.load();
+  std::shared_ptr<const UpperLevels> upper = std::atomic_load(&upper_levels_);
+  if (upper == nullptr || upper->version != version)
+  {
+    RebuildUpperLevels();
+    version = structure_version_.load();
+    upper = std::atomic_load(&upper_levels_);
+    if (upper == nullptr || (!blink_ && upper->version != version))
+      return nullptr;
+  }
+  if (upper->pages.empty())
+    return nullptr;
+
+  // 最后一个 <= key 的位置，keys[0] 不参与比较
+  size_t index = 0;
+  if (!leftMost)
+  {
+    auto it = std::upper_bound(upper->keys.begin() + 1, upper->keys.end(), key,
+                               [this](const KeyType &a, const KeyType &b) {
+                                 return comparator_(a, b) < 0;
+                               });
+    index = it - upper->keys.begin() - 1;
+  }
+  page_id_t page_id = upper->pages[index];
+  // 已经过期就别去取可能被删掉的页
+  if (!blink_ && structure_version_.load() != version)
+    return nullptr;
+  Page *page = FetchSwizzled(page_id);
+  if (page == nullptr)
+    throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while searching");
+  page->RLatch();
+  if (!blink_ && structure_version_.load() != version)
+  {
+    page->RUnlatch();
+    buffer_pool_manager_->UnpinPage(page, false);
+    return nullptr;
+  }
+  metrics_.Add(TREE_UPPER_LEVEL_HITS);
+  return page;
+}
+
+/*
+ * Make a new copy of the upper levels for the current structure version.
+ * Only one thread rebuilds at a time, the others descend from the root
+ * meanwhile. The walk holds one read latch at a time, so the copy is only
+ * published if the structure version did not move while it ran. A tree
+ * lower than two levels above the leaves gets an empty copy, which keeps
+ * readers from trying again until it grows.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::RebuildUpperLevels()
+{
+  std::unique_lock<std::mutex> lock(upper_levels_mutex_, std::try_to_lock);
+  if (!lock.owns_lock())
+    return;
+  uint64_t version = structure_version_.load();
+  std::shared_ptr<const UpperLevels> current = std::atomic_load(&upper_levels_);
+  if (current != nullptr && current->version == version)
+    return;
+
+  auto upper = std::make_shared<UpperLevels>();
+  upper->version = version;
+  int height = Height();
+  if (height >= 2)
+  {
+    Page *root = LatchRoot();
+    if (root == nullptr ||
+        !CollectUpperLevels(root, 0, height - 1, KeyType(), version, *upper))
+      return;
+  }
+  if (structure_version_.load() != version)
+    return;
+  std::atomic_store(&upper_levels_,
+                    std::shared_ptr<const UpperLevels>(std::move(upper)));
+  metrics_.Add(TREE_UPPER_LEVEL_REBUILDS);
+}
+
+/*
+ * Add the children of the read latched internal page on depth (the root is
+ * depth 0) to upper if they are on entry_depth, otherwise walk into them
+ * left to right. low is the first key routed to page. The page is released
+ * before its children are latched.
+ * @return: false if the structure changed under the walk
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::CollectUpperLevels(Page *page, int depth, int entry_depth,
+                                        const KeyType &low, uint64_t version,
+                                        UpperLevels &upper)
+{
+  auto *node = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(page->GetData());
+  // 版本没变说明这一页还是树里原来那一页
+  bool valid = structure_version_.load() == version && !node->IsLeafPage();
+  std::vector<std::pair<KeyType, page_id_t>> children;
+  if (valid)
+  {
+    children.reserve(node->GetSize());
+    for (int i = 0; i < node->GetSize(); ++i)
+      children.emplace_back(i == 0 ? low : node->KeyAt(i), node->ValueAt(i));
+  }
+  page->RUnlatch();
+  buffer_pool_manager_->UnpinPage(page->GetPageId(), false);
+  if (!valid)
+    return false;
+
+  if (depth + 1 == entry_depth)
+  {
+    for (auto &child : children)
+    {
+      upper.keys.push_back(child.first);
+      upper.pages.push_back(child.second);
+    }
+    return true;
+  }
+  for (auto &child : children)
+  {
+    Page *child_page = buffer_pool_manager_->FetchPage(child.second);
+    if (child_page == nullptr)
+      return false;
+    child_page->RLatch();
+    if (!CollectUpperLevels(child_page, depth + 1, entry_depth, child.first,
+                            version, upper))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Find leaf page containing particular key, if leftMost flag == true, find
+ * the left most leaf page
+ */
+INDEX_TEMPLATE_ARGUMENTS
+B_PLUS_TREE_LEAF_PAGE_TYPE *BPLUSTREE_TYPE::FindLeafPage(const KeyType &key,
+                                                         bool leftMost,
+                                                         Operation op,
+                                                         Transaction *transaction)
+{
+  Page *page = FetchLeafPage(key, leftMost, op, transaction);
+  if (page == nullptr)
+    return nullptr;
+  return reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page->GetData());
+}
+
+/*
+ * Descend from the root to the target leaf with latch crabbing. Readers
+ * start at the parent of the leaves when the copy of the upper levels is
+ * current.
+ * If transaction is nullptr the ancestors are released on the way down and
+ * the returned leaf frame is pinned exactly once and latched (read or write
+ * according to op), so the caller only has to unlatch and unpin it once.
+ * Otherwise every page still held is kept in transaction's page set.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+Page *BPLUSTREE_TYPE::FetchLeafPage(const KeyType &key, bool leftMost,
+                                    Operation op, Transaction *transaction)
+{
+  if (blink_)
+  {
+    Page *page = FetchLeafPageBLink(key, leftMost, op);
+    if (page != nullptr && transaction != nullptr)
+      transaction->AddIntoPageSet(page);
+    return page;
+  }
+
+  // 根只在旧根写锁住时改变，锁住以后还是根就不会再变
+  Page *parent = nullptr;
+  if (op == Operation::READONLY)
+      parent = LatchFromUpperLevels(key, leftMost);
+  if (parent == nullptr)
+      parent = LatchRoot(op != Operation::READONLY);
+  if (parent == nullptr)
+      return nullptr;
+  if (transaction != nullptr)
+  {
+      transaction->AddIntoPageSet(parent);
+  }
+  auto* node = reinterpret_cast<BPlusTreePage*>(parent->GetData());
+  while (!node->IsLeafPage()) 
+  {
+      auto internal =
+          reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t,
+          KeyComparator>*>(node);
+      page_id_t parent_page_id = node->GetPageId(); 
+      page_id_t child_page_id;
+      if (leftMost)
+      {
+          child_page_id = internal->ValueAt(0);
+      }
+      else 
+      {
+          child_page_id = internal->Lookup(key, comparator_);
+      }
+      auto* child = FetchSwizzled(child_page_id);
+      if (child == nullptr)
+      {
+          // 放掉路径上已经拿到的锁和 pin 再报错
+          if (transaction != nullptr)
+          {
+              UnlockUnpinPages(op, transaction);
+          }
+          else
+          {
+              if (op == Operation::READONLY)
+              {
+                  parent->RUnlatch();
+              }
+              else
+              {
+                  parent->WUnlatch();
+              }
+              buffer_pool_manager_->UnpinPage(parent, false);
+          }
+          throw Exception(EXCEPTION_TYPE_INDEX, "all page are pinned while searching");
+      }
+
+      if (op == Operation::READONLY)
+      {
+          child->RLatch();
+          UnlockUnpinPages(op, transaction);
+      }
+      else
+      {
+          child->WLatch();
+      }
+      node = reinterpret_cast<BPlusTreePage*>(child->GetData());
+      assert(node->GetParentPageId() == parent_page_id);
+      if (op != Operation::READONLY && isSafe(node, op))
+      {
+          UnlockUnpinPages(op, transaction);
+      }
+      if (transaction != nullptr)
+      {
+          transaction->AddIntoPageSet(child);
+      }
+      else
+      {
+          if (op == Operation::READONLY)
+          {
+              parent->RUnlatch();
+          }
+          else
+          {
+              parent->WUnlatch();
+          }
+          buffer_pool_manager_->UnpinPage(parent, false);
+      }
+      parent = child;
+  }
+  return parent;
+}
+
+
+
+/*
+ * Call this method everytime root page id is changed. The header page is not
+ * touched here: the change is logged (INDEX_ROOT) and FlushRootPageId writes
+ * the latest root once, however many changes came before it
+ */
+INDEX_TEMPLATE_ARGUMENTS
+lsn_t BPLUSTREE_TYPE::UpdateRootPageId(page_id_t root_page_id)
+{
+  std::lock_guard<std::mutex> lock(root_mutex_);
+  StructureChanged();
+  root_page_id_.store(root_page_id);
+  root_pending_ = true;
+  if (!LoggingEnabled())
+    return INVALID_LSN;
+  LogRecord log_record(INVALID_TXN_ID, INVALID_LSN, LogRecordType::INDEX_ROOT,
+                       index_name_, root_page_id);
+  root_lsn_ = AppendLog(log_record, nullptr);
+  return root_lsn_;
+}
+
+/*
+ * Update/Insert root page id in header page(where page_id = 0, header_page is
+ * defined under include/page/header_page.h). The record is inserted if the
+ * tree has none yet and kept when the tree is emptied.
+ * The header page has no LSN the buffer pool could check before writing it
+ * back, so the log is forced before the root goes in. Recovery skips
+ * INDEX_ROOT records older than a checkpoint unless the header page was
+ * dirty before them; the checkpoint calls this after its begin record, so
+ * the header page it writes out holds them.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::FlushRootPageId()
+{
+  std::lock_guard<std::mutex> lock(root_mutex_);
+  if (!root_pending_)
+    return true;
+  if (LoggingEnabled())
+    buffer_pool_manager_->GetLogManager()->Flush(root_lsn_);
+  Page *page = buffer_pool_manager_->FetchPage(HEADER_PAGE_ID);
+  if (page == nullptr)
+    return false;
+  // 检查点也会改 header page
+  page->WLatch();
+  auto *header_page = reinterpret_cast<HeaderPage *>(page);
+  page_id_t root_page_id = root_page_id_.load();
+  if (!header_page->UpdateRecord(index_name_, root_page_id))
+    header_page->InsertRecord(index_name_, root_page_id);
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, true);
+  root_pending_ = false;
+  return true;
+}
+
+/*****************************************************************************
+ * LOGGING
+ *****************************************************************************/
+/*
+ * Every modification of a tree page is described by a log record before the
+ * page latch is released, and the record's LSN is stamped on the page so the
+ * buffer pool can flush the log far enough before writing the page back.
+ * Leaf inserts and deletes are logged as single entries (redo and undo),
+ * structure modifications as the entry range each page lost and gained
+ * (redo only). Parent page ids are not logged: recovery derives them from
+ * the children an internal page gained, so a reparented child only takes
+ * the LSN of that record, under its write latch and before it is unpinned,
+ * and can never reach the disk ahead of it.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::LoggingEnabled()
+{
+  return ENABLE_LOGGING && buffer_pool_manager_->GetLogManager() != nullptr;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+lsn_t BPLUSTREE_TYPE::AppendLog(LogRecord &log_record,
+                                Transaction *transaction)
+{
+  lsn_t lsn = buffer_pool_manager_->GetLogManager()->AppendLogRecord(log_record);
+  if (transaction != nullptr)
+    transaction->SetPrevLSN(lsn);
+  return lsn;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::LogLeafEntry(LogRecordType type,
+                                  B_PLUS_TREE_LEAF_PAGE_TYPE *leaf, int slot,
+                                  Transaction *transaction)
+{
+  if (!LoggingEnabled())
+    return;
+  const char *base = reinterpret_cast<const char *>(leaf);
+  const char *items = reinterpret_cast<const char *>(leaf->GetItems(0));
+  LogRecord log_record(
+      transaction == nullptr ? INVALID_TXN_ID : transaction->GetTransactionId(),
+      transaction == nullptr ? INVALID_LSN : transaction->GetPrevLSN(), type,
+      leaf->GetPageId(), items - base, slot,
+      reinterpret_cast<const char *>(leaf->GetItems(slot)),
+      sizeof(MappingType));
+  leaf->SetLSN(AppendLog(log_record, transaction));
+}
+
+/*
+ * Log the entries [slot, slot + remove_count) node lost and the entries
+ * [slot, slot + insert_count) it holds now, together with its header. The
+ * split point of a page that was split is a range with nothing inserted.
+ * Returns the record's LSN, INVALID_LSN while logging is disabled
+ */
+INDEX_TEMPLATE_ARGUMENTS
+lsn_t BPLUSTREE_TYPE::LogPageRange(LogRecordType type, BPlusTreePage *node,
+                                   int slot, int remove_count,
+                                   int insert_count, Transaction *transaction)
+{
+  if (!LoggingEnabled())
+    return INVALID_LSN;
+  const char *base = reinterpret_cast<const char *>(node);
+  // 叶子只有一个数组，内部页的 key 和孩子分开存
+  std::vector<std::pair<int32_t, int32_t>> arrays;
+  if (node->IsLeafPage())
+  {
+    auto *leaf = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(node);
+    arrays.emplace_back(
+        reinterpret_cast<const char *>(leaf->GetItems(0)) - base,
+        sizeof(MappingType));
+  }
+  else
+  {
+    auto *internal = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE *>(node);
+    arrays.emplace_back(
+        reinterpret_cast<const char *>(internal->GetKeys(0)) - base,
+        sizeof(KeyType));
+    arrays.emplace_back(
+        reinterpret_cast<const char *>(internal->GetChildren(0)) - base,
+        sizeof(page_id_t));
+  }
+  LogRecord log_record(
+      transaction == nullptr ? INVALID_TXN_ID : transaction->GetTransactionId(),
+      transaction == nullptr ? INVALID_LSN : transaction->GetPrevLSN(), type,
+      node->GetPageId(), base, arrays.front().first, slot, remove_count,
+      insert_count, arrays);
+  lsn_t lsn = AppendLog(log_record, transaction);
+  node->SetLSN(lsn);
+  return lsn;
+}
+
+/*
+ * Point a child that is not latched by the caller at a new parent, and
+ * raise its LSN to lsn, the record recovery derives the parent from. The
+ * caller holds the new parent's write latch and none below it, and has
+ * pinned the child with PinChildren before changing the structure, so the
+ * fetch here is a hit and can not fail
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::Reparent(page_id_t page_id, page_id_t parent_page_id,
+                              lsn_t lsn)
+{
+  Page *page = buffer_pool_manager_->FetchPage(page_id);
+  assert(page != nullptr);
+  page->WLatch();
+  auto *node = reinterpret_cast<BPlusTreePage *>(page->GetData());
+  node->SetParentPageId(parent_page_id);
+  if (lsn != INVALID_LSN && node->GetLSN() < lsn)
+    node->SetLSN(lsn);
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page_id, true);
+}
+
+/*
+ * Reparent children [begin, end) of node to node, one latch at a time
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::ReparentChildren(B_PLUS_TREE_INTERNAL_PAGE *node,
+                                      int begin, int end, lsn_t lsn)
+{
+  for (int i = begin; i < end; ++i)
+  {
+    Reparent(node->ValueAt(i), node->GetPageId(), lsn);
+  }
+}
+
+/*
+ * Pin children [begin, end) of node ahead of a structure change that moves
+ * them to another parent. On failure nothing stays pinned and false is
+ * returned, so the caller can back out before it has modified anything
+ */
+INDEX_TEMPLATE_ARGUMENTS
+bool BPLUSTREE_TYPE::PinChildren(B_PLUS_TREE_INTERNAL_PAGE *node, int begin,
+                                 int end, std::vector<Page *> &pinned)
+{
+  for (int i = begin; i < end; ++i)
+  {
+    Page *page = buffer_pool_manager_->FetchPage(node->ValueAt(i));
+    if (page == nullptr)
+    {
+      UnpinChildren(pinned);
+      return false;
+    }
+    pinned.push_back(page);
+  }
+  return true;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::UnpinChildren(std::vector<Page *> &pinned)
+{
+  for (Page *page : pinned)
+  {
+    buffer_pool_manager_->UnpinPage(page, false);
+  }
+  pinned.clear();
+}
+
+/*
+ * Logical undo: the entry may have moved to another leaf since it was logged,
+ * so it is looked up by key again. Removing a missing key and inserting an
+ * existing one are both no-ops, which makes undo safe to repeat
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void BPLUSTREE_TYPE::UndoLogRecord(LogRecord &log_record)
+{
+  const std::vector<char> &data = log_record.GetIndexData();
+  if (data.size() != sizeof(MappingType))
+    throw Exception(EXCEPTION_TYPE_INDEX, "log record is not from this index");
+  // 日志里就是叶子页上的原始字节
+  MappingType entry = *reinterpret_cast<const MappingType *>(data.data());
+  if (log_record.GetLogRecordType() == LogRecordType::INDEX_INSERT)
+    Remove(entry.first);
+  else if (log_record.GetLogRecordType() == LogRecordType::INDEX_DELETE)
+    Insert(entry.first, entry.second);
+}
+
+/*
+ * This method is used for debug only
+ * print out whole b+tree sturcture, rank by rank
+ */
+INDEX_TEMPLATE_ARGUMENTS
+std::string BPLUSTREE_TYPE::ToString(bool verbose)
+{
+  Checker checker;
+  checker.print = true;
+  checker.verbose = verbose;
+  if (!WalkTree(checker))
+    return "Empty tree";
+  std::string result;
+  for (const auto &level : checker.levels)
+    result += level.line + "\n";
+  return result;
+}
 
 /*
  * This method is used for test only
@@ -756,5 +2763,11 @@ template class BPlusTree<GenericKey<8>, RID, GenericComparator<8>>;
 template class BPlusTree<GenericKey<16>, RID, GenericComparator<16>>;
 template class BPlusTree<GenericKey<32>, RID, GenericComparator<32>>;
 template class BPlusTree<GenericKey<64>, RID, GenericComparator<64>>;
+template class BPlusTree<Int32Key, RID, Int32Comparator>;
+template class BPlusTree<Int64Key, RID, Int64Comparator>;
+template class BPlusTree<MemcmpKey<8>, RID, MemcmpComparator<8>>;
+template class BPlusTree<MemcmpKey<16>, RID, MemcmpComparator<16>>;
+template class BPlusTree<MemcmpKey<32>, RID, MemcmpComparator<32>>;
+template class BPlusTree<MemcmpKey<64>, RID, MemcmpComparator<64>>;
 
 } // namespace scudb
@@ -7,28 +7,81 @@
  * (2) support insert & remove
  * (3) The structure should shrink and grow dynamically
  * (4) Implement index iterator for range scan
+ * (5) Optional B-link mode: readers and writers follow right links instead
+ *     of crabbing, splits never hold two levels latched at the same time
+ * (6) Page modifications are write ahead logged when the buffer pool has a
+ *     log manager and logging is enabled
+ * (7) Splits, merges and root changes are counted and waits for the root
+ *     latch are timed, see GetMetrics
+ * (8) The structure can be checked and measured online, see Check and
+ *     GetStats
+ * (9) Descents start below an in-memory copy of the upper levels, so only
+ *     the parents of the leaves and the leaves go through the buffer pool
+ * (10) Descents reach resident pages through the frames they were found in
+ *     before (swizzled references), falling back to the page id once the
+ *     page has been evicted
+ * (11) The root page id is atomic. Readers and writers latch the root they
+ *     read and check it is still the root, no descent takes the tree mutex.
+ *     Root changes are only logged; the header page gets the latest root
+ *     at the next checkpoint or FlushRootPageId, whichever comes first
  */
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <unordered_set>
 #include <vector>
 
+#include "buffer/metrics.h"
 #include "concurrency/transaction.h"
 #include "index/index_iterator.h"
+#include "logging/log_record.h"
 #include "page/b_plus_tree_internal_page.h"
 #include "page/b_plus_tree_leaf_page.h"
 
 namespace scudb {
 
 #define BPLUSTREE_TYPE BPlusTree<KeyType, ValueType, KeyComparator>
+#define B_PLUS_TREE_INTERNAL_PAGE                                              \
+  BPlusTreeInternalPage<KeyType, page_id_t, KeyComparator>
 // Main class providing the API for the Interactive B+ Tree.
 INDEX_TEMPLATE_ARGUMENTS
 class BPlusTree {
 public:
+  // key range of one leaf, see GetStats
+  struct LeafRange {
+    page_id_t page_id;
+    int size;
+    KeyType low;  // first and last key, meaningless if the leaf is empty
+    KeyType high;
+  };
+  // shape of the tree, levels are counted from the leaves (level 0) up
+  struct Stats {
+    int height = -1;               // levels above the leaves, -1 if empty
+    int64_t keys = 0;
+    std::vector<int> pages;        // pages per level
+    std::vector<int64_t> entries;  // keys or children per level
+    std::vector<double> fill;      // entries / max size per level
+    int leaf_sequential = 0;       // leaves whose right link is page id + 1
+    int leaf_ascending = 0;        // leaves whose right link is a higher id
+    std::vector<LeafRange> leaves; // in key order, only if asked for
+    std::string ToString() const;
+  };
+
   explicit BPlusTree(const std::string &name,
                            BufferPoolManager *buffer_pool_manager,
                            const KeyComparator &comparator,
-                           page_id_t root_page_id = INVALID_PAGE_ID);
+                           page_id_t root_page_id = INVALID_PAGE_ID,
+                           bool blink = false,
+                           bool cache_upper_levels = true,
+                           bool swizzle = true);
+
+  // tries to write the root page id out, see FlushRootPageId; a failure is
+  // only logged
+  ~BPlusTree();
 
   // Returns true if this B+ tree has no keys and values.
   bool IsEmpty() const;
@@ -48,7 +101,52 @@ public:
   INDEXITERATOR_TYPE Begin();
   INDEXITERATOR_TYPE Begin(const KeyType &key);
 
-  // Print this B+ tree to stdout using a simple command-line
+  // Build the tree from unsorted data with num_threads workers, only allowed
+  // on an empty tree. Duplicate keys keep their first occurrence.
+  bool BulkLoad(const std::vector<MappingType> &items, int num_threads,
+                Transaction *transaction = nullptr);
+
+  // parallel scan: split the key space with separator keys taken from the
+  // upper levels, bounds[i] is the first key of partition i + 1
+  void GetPartitionKeys(int num_partitions, std::vector<KeyType> &bounds);
+  // scan the whole tree with num_threads workers, each on its own key range.
+  // func(worker_id, keys, values, count) is called with batches of entries
+  void ParallelScan(int num_threads,
+                    const std::function<void(int, const KeyType *,
+                                             const ValueType *, int)> &func);
+
+  // write the root page id into the header page if it changed since the last
+  // time, forcing the log up to the change first. Register it with the
+  // checkpoint manager (AddFlushCallback) so checkpoints pick up root changes.
+  // Return false if the header page could not be pinned, the change stays
+  // pending then. Without a log manager there are no checkpoints and no
+  // INDEX_ROOT records to recover the root from: call this yourself once the
+  // tree is changed and check the result
+  bool FlushRootPageId();
+
+  // online compaction: merge under-filled pages up to fill_factor of their
+  // capacity and drop levels that became unnecessary, while reads and writes
+  // go on. Return the number of pages freed. A B-link tree is left as it is
+  // (returns 0): it never merges pages, so it only gets emptier; rebuild it
+  // with BulkLoad into a new tree to shrink it
+  int Compact(double fill_factor = 0.9);
+
+  // append the tree's counters, the root latch wait histogram and the
+  // current height (levels above the leaves) to snapshot
+  void GetMetrics(MetricsSnapshot &snapshot);
+  inline void ResetMetrics() { metrics_.Reset(); }
+
+  // walk the whole tree with read latches and check its structure. Every
+  // problem found is appended to errors (if given), return true if none
+  bool Check(std::vector<std::string> *errors = nullptr);
+  // collect stats with the same walk, leaf_ranges also records every leaf
+  void GetStats(Stats &stats, bool leaf_ranges = false);
+
+  // crash recovery: roll back one INDEX_INSERT/INDEX_DELETE record of an
+  // unfinished transaction, see LogRecovery::Undo
+  void UndoLogRecord(LogRecord &log_record);
+
+  // Print this B+ tree level by level, one line per level
   std::string ToString(bool verbose = false);
 
   // read data from file and insert one by one
@@ -61,9 +159,17 @@ public:
   // expose for test purpose
   B_PLUS_TREE_LEAF_PAGE_TYPE *FindLeafPage(const KeyType &key,
                                            bool leftMost = false,
-                                           OpType op = OpType::READ,
+                                           Operation op = Operation::READONLY,
                                            Transaction *transaction = nullptr);
 private:
+  // same as FindLeafPage, but hand back the latched and pinned frame itself
+  Page *FetchLeafPage(const KeyType &key, bool leftMost, Operation op,
+                      Transaction *transaction);
+
+  bool LookupInMapping(const KeyType &key, std::vector<ValueType> &result,
+                       bool &found);
+  void CheckWritable();
+
   void StartNewTree(const KeyType &key, const ValueType &value);
 
   bool InsertIntoLeaf(const KeyType &key, const ValueType &value,
@@ -73,7 +179,19 @@ private:
                         BPlusTreePage *new_node,
                         Transaction *transaction = nullptr);
 
-  template <typename N> N *Split(N *node);
+  void CreateNewRoot(BPlusTreePage *old_node, const KeyType &key,
+                     BPlusTreePage *new_node,
+                     Transaction *transaction = nullptr);
+
+  // B-link mode (right links and high keys instead of latch crabbing)
+  Page *MoveRight(Page *page, const KeyType &key, bool exclusive);
+  Page *FetchLeafPageBLink(const KeyType &key, bool leftMost, Operation op);
+  bool InsertIntoLeafBLink(const KeyType &key, const ValueType &value);
+  void InsertIntoParentBLink(page_id_t parent_page_id, KeyType key,
+                             page_id_t child_page_id);
+  void RemoveBLink(const KeyType &key);
+
+  template <typename N> N *Split(N *node, Transaction *transaction);
 
   template <typename N>
   bool CoalesceOrRedistribute(N *node, Transaction *transaction = nullptr);
@@ -88,7 +206,84 @@ private:
 
   bool AdjustRoot(BPlusTreePage *node);
 
-  void UpdateRootPageId(int insert_record = false);
+  // bulk load helpers
+  void BuildLeafLevel(const std::vector<std::vector<MappingType>> &runs,
+                      const std::vector<int64_t> &offsets, int num_leaves,
+                      int first, int last,
+                      std::vector<std::pair<KeyType, page_id_t>> &leaves);
+  void BuildInternalLevel(
+      const std::vector<std::pair<KeyType, page_id_t>> &children,
+      std::vector<std::pair<KeyType, page_id_t>> &parents);
+
+  // compaction helpers
+  bool CompactStep(int level, bool leftMost, KeyType &cursor,
+                   double fill_factor, int &freed, bool &more);
+  template <typename N>
+  int CompactChildren(B_PLUS_TREE_INTERNAL_PAGE *parent, double fill_factor,
+                      Transaction *transaction);
+  Page *RelocateLeaf(Page *page, Page *prev_page,
+                     B_PLUS_TREE_INTERNAL_PAGE *parent, int index,
+                     Transaction *transaction);
+
+  // publish a new root, the caller holds the write latch of the old root
+  // (if there is one) and the tree mutex when the tree was empty. Returns
+  // the LSN of the INDEX_ROOT record, INVALID_LSN while logging is disabled
+  lsn_t UpdateRootPageId(page_id_t root_page_id);
+
+  // pin page_id through the frame it was last fetched into, see frames_
+  Page *FetchSwizzled(page_id_t page_id);
+
+  // pin and latch the current root, nullptr if the tree is empty
+  Page *LatchRoot(bool exclusive = false);
+  // levels above the leaves by a walk down the leftmost path, -1 if empty
+  int Height();
+
+  // copy of the upper levels: pages[i] is a parent of leaves and gets the
+  // keys from keys[i] (keys[0] is unused) up to keys[i + 1]. It describes
+  // the tree as of structure version `version` and is never changed
+  struct UpperLevels {
+    uint64_t version;
+    std::vector<KeyType> keys;
+    std::vector<page_id_t> pages;
+  };
+  Page *LatchFromUpperLevels(const KeyType &key, bool leftMost);
+  void RebuildUpperLevels();
+  bool CollectUpperLevels(Page *page, int depth, int entry_depth,
+                          const KeyType &low, uint64_t version,
+                          UpperLevels &upper);
+  // every split, merge or redistribution of an internal page and every root
+  // change calls this before it releases the pages it changed
+  inline void StructureChanged() { structure_version_.fetch_add(1); }
+
+  // structure walk shared by Check, GetStats and ToString
+  struct Checker;
+  bool WalkTree(Checker &checker);
+  void CheckPage(Page *page, page_id_t parent_page_id, const KeyType *low,
+                 const KeyType *high, int depth, Checker &checker);
+  bool CheckNode(Page *page, int depth, Checker &checker);
+  void WalkRightLinks(int depth, page_id_t stop, Checker &checker);
+  void CheckFailed(Checker &checker, page_id_t page_id,
+                   const std::string &message);
+
+  // write ahead logging, every helper is a no-op while logging is disabled.
+  // The caller holds the write latch of the page being logged
+  bool LoggingEnabled();
+  lsn_t AppendLog(LogRecord &log_record, Transaction *transaction);
+  void LogLeafEntry(LogRecordType type, B_PLUS_TREE_LEAF_PAGE_TYPE *leaf,
+                    int slot, Transaction *transaction);
+  lsn_t LogPageRange(LogRecordType type, BPlusTreePage *node, int slot,
+                     int remove_count, int insert_count,
+                     Transaction *transaction);
+  // change the parent page id of children the caller does not hold, under
+  // their write latch (the internal page methods leave moved children alone)
+  void Reparent(page_id_t page_id, page_id_t parent_page_id, lsn_t lsn);
+  void ReparentChildren(B_PLUS_TREE_INTERNAL_PAGE *node, int begin, int end,
+                        lsn_t lsn);
+  // pin the children a structure change is about to move, so Reparent can
+  // not fail once the change has started
+  bool PinChildren(B_PLUS_TREE_INTERNAL_PAGE *node, int begin, int end,
+                   std::vector<Page *> &pinned);
+  void UnpinChildren(std::vector<Page *> &pinned);
 
 
   void UnlockUnpinPages(Operation op, Transaction* transaction)
@@ -116,11 +311,24 @@ private:
         buffer_pool_manager_->DeletePage(page_id);
     }
     transaction->GetDeletedPageSet()->clear();
+  }
+
+  // release one write latched page of the path ahead of the others
+  void UnlockUnpinPage(page_id_t page_id, Transaction* transaction)
+  {
+    if (transaction == nullptr)
+        return;
 
-    if (root_is_locked) 
+    auto page_set = transaction->GetPageSet();
+    for (auto it = page_set->begin(); it != page_set->end(); ++it)
     {
-        root_is_locked = false;
-        unlockRoot();
+        if ((*it)->GetPageId() == page_id)
+        {
+            (*it)->WUnlatch();
+            buffer_pool_manager_->UnpinPage(page_id, true);
+            page_set->erase(it);
+            return;
+        }
     }
   }
 
@@ -138,23 +346,47 @@ private:
     return true;
   }
 
-  inline void lockRoot() { mutex_.lock(); }
-  inline void unlockRoot() { mutex_.unlock(); }
-
   // member variable
-  class Checker {
-  public:
-      explicit Checker(BufferPoolManager* b) : buffer(b) {}
-      ~Checker() {}
-  private:
-      BufferPoolManager* buffer;
+  struct Checker {
+    struct Level {
+      page_id_t last = INVALID_PAGE_ID; // last page seen on this level
+      page_id_t next = INVALID_PAGE_ID; // its right link and high key
+      KeyType high;
+      int pages = 0;
+      int64_t entries = 0;
+      int64_t capacity = 0;
+      std::string line;                 // ToString
+    };
+    std::vector<Level> levels;          // by depth, the root is depth 0
+    std::unordered_set<page_id_t> visited;
+    int leaf_depth = -1;
+    std::vector<std::string> *errors = nullptr;
+    int error_count = 0;
+    Stats stats;
+    bool leaf_ranges = false;
+    bool print = false;
+    bool verbose = false;
   };
-  std::mutex mutex_;                       // 保证线程安全
-  static thread_local bool root_is_locked; 
+  std::mutex mutex_;                       // 空树上建树 (Insert, BulkLoad)
   std::string index_name_;
-  page_id_t root_page_id_;
+  std::atomic<page_id_t> root_page_id_;
+  std::mutex root_mutex_;                  // 串行化根的变更和 header page 的更新
+  bool root_pending_;                      // 根变了还没写进 header page
+  lsn_t root_lsn_;                         // 最后一条 INDEX_ROOT 日志
   BufferPoolManager *buffer_pool_manager_;
   KeyComparator comparator_;
+  bool blink_;                             // B-link mode, see b_plus_tree.cpp
+  bool cache_upper_levels_;
+  std::atomic<uint64_t> structure_version_;
+  // 只通过 std::atomic_load / std::atomic_store 访问
+  std::shared_ptr<const UpperLevels> upper_levels_;
+  std::mutex upper_levels_mutex_;          // 同一时间只有一个线程重建
+  // swizzled references: frames_[page_id & frames_mask_] is the frame the
+  // page was last fetched into. Only a hint, the buffer pool checks that the
+  // frame still holds the page. nullptr if swizzling is off
+  std::unique_ptr<std::atomic<Page *>[]> frames_;
+  page_id_t frames_mask_;
+  Metrics metrics_;
 };
 
 } // namespace scudb
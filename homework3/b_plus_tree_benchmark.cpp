@@ -0,0 +1,470 @@
+/**
+ * b_plus_tree_benchmark.cpp
+ *
+ * YCSB style workload driver for BPlusTree, so index changes can be compared
+ * on the same mixes run after run. Build it as its own executable next to
+ * the library.
+ *
+ *   b_plus_tree_benchmark                          load report + A-F sweep
+ *   b_plus_tree_benchmark workload=a threads=16 records=1000000 ...
+ *
+ * Every run loads `records` keys with BulkLoad into a fresh tree behind a
+ * pool of `pool` frames, then `threads` threads run `ops` operations of the
+ * workload:
+ *
+ *   a  50% read  50% update           zipfian
+ *   b  95% read   5% update           zipfian
+ *   c 100% read                       zipfian
+ *   d  95% read   5% insert           latest
+ *   e  95% scan   5% insert           zipfian, scans of 1..scan_length keys
+ *   f  50% read  50% read-modify-write zipfian
+ *
+ * Record i has key scramble(i), like YCSB's hashed keys, so inserts land all
+ * over the tree. An update points the key at a new RID (Remove + Insert, the
+ * index side of moving a tuple), read-modify-write is GetValue and then an
+ * update. Each line reports throughput, p50 / p99 latency of every
+ * operation kind, the buffer pool hit rate and the tree height afterwards.
+ *
+ * workload=load compares BulkLoad with concurrent Insert for every thread
+ * count instead. workload=node times Lookup inside one full internal page,
+ * no pool and no latches, to see the in-page search on its own.
+ *
+ * key_type picks the key: generic (GenericKey of key_size bytes, compared
+ * through the key schema), int64 (Int64Key) or memcmp (MemcmpKey of
+ * key_size bytes). key_size takes a comma separated list, key_size=all runs
+ * every size. upper_cache=0 makes every descent start at the root instead of
+ * below the tree's copy of its upper levels, swizzle=0 makes every fetch look
+ * the page up in the buffer pool's page table.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_pool_manager.h"
+#include "buffer/metrics.h"
+#include "buffer/zipfian.h"
+#include "index/b_plus_tree.h"
+#include "page/b_plus_tree_internal_page.h"
+#include "vtable/virtual_table.h"
+
+namespace scudb {
+
+enum { OP_READ = 0, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW, OPS };
+static const char *const OP_NAMES[OPS] = {"read", "update", "insert", "scan",
+                                          "rmw"};
+static const char *const OP_HISTOGRAM_NAMES[OPS] = {
+    "read_ns", "update_ns", "insert_ns", "scan_ns", "rmw_ns"};
+
+struct WorkloadMix {
+  int percent[OPS]; // read update insert scan rmw
+  bool latest;      // latest instead of zipfian
+};
+
+static bool getMix(char workload, WorkloadMix &mix)
+{
+  switch (workload)
+  {
+  case 'a': mix = {{50, 50, 0, 0, 0}, false}; return true;
+  case 'b': mix = {{95, 5, 0, 0, 0}, false}; return true;
+  case 'c': mix = {{100, 0, 0, 0, 0}, false}; return true;
+  case 'd': mix = {{95, 0, 5, 0, 0}, true}; return true;
+  case 'e': mix = {{0, 0, 5, 95, 0}, false}; return true;
+  case 'f': mix = {{50, 0, 0, 0, 50}, false}; return true;
+  }
+  return false;
+}
+
+struct BenchConfig {
+  std::string workloads = "abcdef";
+  std::vector<int> threads = {1, 2, 4, 8, 16, 32, 64};
+  long records = 100000;
+  long ops = 200000; // over all threads
+  size_t pool = 1000;
+  std::string key_type = "generic";
+  std::vector<int> key_sizes = {8};
+  int scan_length = 100;
+  double theta = 0.99;
+  bool blink = false;
+  bool upper_cache = true;
+  bool swizzle = true;
+  std::string file = "/dev/shm/scudb_bench.db";
+};
+
+static inline int64_t scramble(uint64_t x)
+{
+  // FNV-1a over the 8 bytes
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < 8; ++i)
+  {
+    hash ^= (x >> (i * 8)) & 0xff;
+    hash *= 0x100000001b3ULL;
+  }
+  return static_cast<int64_t>(hash);
+}
+
+template <typename KeyType, typename KeyComparator> class TreeBenchmark {
+  using Tree = BPlusTree<KeyType, RID, KeyComparator>;
+  using InternalPage = BPlusTreeInternalPage<KeyType, page_id_t, KeyComparator>;
+
+public:
+  TreeBenchmark(const BenchConfig &config, const std::string &key_name)
+      : config_(config), key_name_(key_name),
+        key_schema_(ParseCreateStatement("a bigint")),
+        comparator_(key_schema_) {}
+  ~TreeBenchmark() { delete key_schema_; }
+
+  void RunWorkload(char workload, int threads)
+  {
+    WorkloadMix mix;
+    if (!getMix(workload, mix))
+    {
+      printf("unknown workload %c\n", workload);
+      return;
+    }
+    std::remove(config_.file.c_str());
+    DiskManager disk_manager(config_.file);
+    BufferPoolManager bpm(config_.pool, &disk_manager);
+    Tree tree("bench", &bpm, comparator_, INVALID_PAGE_ID, config_.blink,
+              config_.upper_cache, config_.swizzle);
+    if (!load(bpm, tree, threads))
+      return;
+    bpm.ResetMetrics();
+
+    Metrics metrics(OP_NAMES, OPS, OP_HISTOGRAM_NAMES, OPS);
+    std::atomic<long> inserted(config_.records);
+    std::vector<std::thread> workers;
+    uint64_t start = MetricsNow();
+    for (int t = 0; t < threads; ++t)
+    {
+      workers.emplace_back([&, t] {
+        std::mt19937_64 rng(t * 7919 + 1);
+        ZipfianGenerator zipf(inserted.load(), config_.theta);
+        std::vector<RID> result;
+        long n = config_.ops / threads;
+        for (long i = 0; i < n; ++i)
+        {
+          int dice = rng() % 100;
+          int op = 0;
+          while (dice >= mix.percent[op])
+            dice -= mix.percent[op++];
+          long items = inserted.load(std::memory_order_relaxed);
+          long record = zipf.Next(items, rng);
+          if (mix.latest)
+            record = items - 1 - record;
+          KeyType key;
+          key.SetFromInteger(scramble(record));
+
+          uint64_t begin = MetricsNow();
+          switch (op)
+          {
+          case OP_READ:
+            result.clear();
+            tree.GetValue(key, result);
+            break;
+          case OP_UPDATE:
+            update(tree, key, record, i);
+            break;
+          case OP_INSERT:
+            record = inserted.fetch_add(1);
+            key.SetFromInteger(scramble(record));
+            tree.Insert(key, RID(record >> 16, record & 0xffff));
+            break;
+          case OP_SCAN:
+            scan(tree, key, 1 + rng() % config_.scan_length);
+            break;
+          case OP_RMW:
+            result.clear();
+            tree.GetValue(key, result);
+            update(tree, key, record, i);
+            break;
+          }
+          metrics.Record(op, MetricsNow() - begin);
+          metrics.Add(op);
+        }
+      });
+    }
+    for (auto &worker : workers)
+      worker.join();
+    double seconds = (MetricsNow() - start) / 1e9;
+
+    MetricsSnapshot snapshot;
+    metrics.Snapshot(snapshot);
+    bpm.GetMetrics(snapshot);
+    tree.GetMetrics(snapshot);
+    std::ostringstream os;
+    int64_t total = 0;
+    for (int op = 0; op < OPS; ++op)
+    {
+      const HistogramSnapshot &latency = snapshot.histograms[op];
+      total += latency.count;
+      if (latency.count > 0)
+        os << "  " << OP_NAMES[op] << " p50/p99 " << latency.Percentile(50)
+           << "/" << latency.Percentile(99) << " ns";
+    }
+    double fetches = std::max<int64_t>(1, snapshot.Get("bpm_fetches"));
+    printf("%c key %-9s threads %2d %10.0f ops/s%s  hit %.1f%%  height %ld\n",
+           workload, key_name_.c_str(), threads, total / seconds, os.str().c_str(),
+           100.0 * snapshot.Get("bpm_hits") / fetches,
+           static_cast<long>(snapshot.Get("tree_height")));
+    std::remove(config_.file.c_str());
+  }
+
+  // BulkLoad against Insert from the same number of threads
+  void RunLoad(int threads)
+  {
+    double bulk_seconds = 0;
+    double insert_seconds = 0;
+    for (int bulk = 1; bulk >= 0; --bulk)
+    {
+      std::remove(config_.file.c_str());
+      DiskManager disk_manager(config_.file);
+      BufferPoolManager bpm(config_.pool, &disk_manager);
+      Tree tree("bench", &bpm, comparator_, INVALID_PAGE_ID, config_.blink,
+                config_.upper_cache, config_.swizzle);
+      uint64_t start = MetricsNow();
+      if (bulk)
+      {
+        if (!load(bpm, tree, threads))
+          return;
+        bulk_seconds = (MetricsNow() - start) / 1e9;
+      }
+      else
+      {
+        newHeaderPage(bpm);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t)
+        {
+          workers.emplace_back([&, t] {
+            for (long i = t; i < config_.records; i += threads)
+            {
+              KeyType key;
+              key.SetFromInteger(scramble(i));
+              tree.Insert(key, RID(i >> 16, i & 0xffff));
+            }
+          });
+        }
+        for (auto &worker : workers)
+          worker.join();
+        insert_seconds = (MetricsNow() - start) / 1e9;
+      }
+    }
+    printf("load key %-9s threads %2d  bulk %10.0f keys/s  insert %10.0f keys/s"
+           "  speedup %.1fx\n", key_name_.c_str(), threads, config_.records / bulk_seconds,
+           config_.records / insert_seconds, insert_seconds / bulk_seconds);
+    std::remove(config_.file.c_str());
+  }
+
+  // Lookup over a full internal page with random probe keys
+  void RunNode()
+  {
+    std::vector<char> buffer(PAGE_SIZE);
+    InternalPage *node = reinterpret_cast<InternalPage *>(buffer.data());
+    node->Init(1);
+    std::vector<KeyType> keys(node->GetMaxSize());
+    for (size_t i = 0; i < keys.size(); ++i)
+      keys[i].SetFromInteger(scramble(i));
+    std::sort(keys.begin(), keys.end(),
+              [this](const KeyType &a, const KeyType &b) {
+                return comparator_(a, b) < 0;
+              });
+    // child i 的 key 是 keys[i]，slot 0 的 key 不用
+    node->PopulateNewRoot(0, keys[1], 1);
+    for (page_id_t i = 2; i < static_cast<page_id_t>(keys.size()); ++i)
+      node->InsertNodeAfter(i - 1, keys[i], i);
+
+    std::vector<KeyType> probes(4096);
+    std::mt19937_64 rng(1);
+    for (auto &probe : probes)
+      probe.SetFromInteger(scramble(rng() % (2 * keys.size())));
+    long sum = 0;
+    uint64_t start = MetricsNow();
+    for (long i = 0; i < config_.ops; ++i)
+      sum += node->Lookup(probes[i & (probes.size() - 1)], comparator_);
+    double ns = static_cast<double>(MetricsNow() - start) / config_.ops;
+    printf("node key %-9s fanout %4d  lookup %6.1f ns  (checksum %ld)\n",
+           key_name_.c_str(), node->GetSize(), ns, sum);
+  }
+
+private:
+  // index_name 的根页号记录在 header page 里
+  void newHeaderPage(BufferPoolManager &bpm)
+  {
+    page_id_t header_page_id;
+    bpm.NewPage(header_page_id);
+    bpm.UnpinPage(header_page_id, true);
+  }
+
+  bool load(BufferPoolManager &bpm, Tree &tree, int threads)
+  {
+    newHeaderPage(bpm);
+    std::vector<std::pair<KeyType, RID>> items(config_.records);
+    for (long i = 0; i < config_.records; ++i)
+    {
+      items[i].first.SetFromInteger(scramble(i));
+      items[i].second = RID(i >> 16, i & 0xffff);
+    }
+    if (!tree.BulkLoad(items, threads))
+    {
+      printf("BulkLoad failed, is the pool too small?\n");
+      return false;
+    }
+    return true;
+  }
+
+  void update(Tree &tree, const KeyType &key, long record, long i)
+  {
+    tree.Remove(key);
+    tree.Insert(key, RID(record >> 16, (record + i) & 0xffff));
+  }
+
+  void scan(Tree &tree, const KeyType &key, int length)
+  {
+    int count = 0;
+    for (auto it = tree.Begin(key); !it.isEnd() && count < length; ++it)
+      ++count;
+  }
+
+  const BenchConfig &config_;
+  std::string key_name_;
+  Schema *key_schema_;
+  KeyComparator comparator_;
+};
+
+template <typename KeyType, typename KeyComparator>
+static void runAll(const BenchConfig &config, const std::string &key_name)
+{
+  TreeBenchmark<KeyType, KeyComparator> benchmark(config, key_name);
+  for (char workload : config.workloads)
+  {
+    // 单线程, 与线程数无关
+    if (workload == 'n')
+    {
+      benchmark.RunNode();
+      continue;
+    }
+    for (int threads : config.threads)
+    {
+      if (workload == 'l')
+        benchmark.RunLoad(threads);
+      else
+        benchmark.RunWorkload(workload, threads);
+    }
+  }
+}
+
+template <size_t N>
+static void runSized(const BenchConfig &config, const std::string &key_name)
+{
+  if (config.key_type == "memcmp")
+    runAll<MemcmpKey<N>, MemcmpComparator<N>>(config, key_name);
+  else
+    runAll<GenericKey<N>, GenericComparator<N>>(config, key_name);
+}
+
+} // namespace scudb
+
+int main(int argc, char **argv)
+{
+  using namespace scudb;
+  BenchConfig config;
+  bool explicit_workloads = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+    {
+      fprintf(stderr, "usage: %s [name=value]..., see the top of "
+                      "b_plus_tree_benchmark.cpp\n", argv[0]);
+      return 1;
+    }
+    std::string name = arg.substr(0, eq);
+    std::string value = arg.substr(eq + 1);
+    if (name == "workload")
+    {
+      // a..f, "load" for the BulkLoad report, "node" for the page search
+      config.workloads = value == "load" ? "l" : value == "node" ? "n" : value;
+      explicit_workloads = true;
+    }
+    else if (name == "threads")
+    {
+      // 逗号分隔的线程数列表
+      config.threads.clear();
+      std::istringstream is(value);
+      std::string item;
+      while (std::getline(is, item, ','))
+        config.threads.push_back(std::max(1, atoi(item.c_str())));
+    }
+    else if (name == "records")
+      config.records = atol(value.c_str());
+    else if (name == "ops")
+      config.ops = atol(value.c_str());
+    else if (name == "pool")
+      config.pool = atol(value.c_str());
+    else if (name == "key_type")
+      config.key_type = value;
+    else if (name == "key_size")
+    {
+      config.key_sizes.clear();
+      if (value == "all")
+        value = "8,16,32,64";
+      std::istringstream is(value);
+      std::string item;
+      while (std::getline(is, item, ','))
+        config.key_sizes.push_back(atoi(item.c_str()));
+    }
+    else if (name == "scan_length")
+      config.scan_length = std::max(1, atoi(value.c_str()));
+    else if (name == "theta")
+      config.theta = atof(value.c_str());
+    else if (name == "blink")
+      config.blink = atoi(value.c_str()) != 0;
+    else if (name == "upper_cache")
+      config.upper_cache = atoi(value.c_str()) != 0;
+    else if (name == "swizzle")
+      config.swizzle = atoi(value.c_str()) != 0;
+    else if (name == "file")
+      config.file = value;
+    else
+    {
+      fprintf(stderr, "unknown parameter %s\n", name.c_str());
+      return 1;
+    }
+  }
+  if (!explicit_workloads)
+    config.workloads = "nl" + config.workloads;
+
+  if (config.key_type == "int64")
+  {
+    runAll<Int64Key, Int64Comparator>(config, "int64");
+    return 0;
+  }
+  if (config.key_type != "generic" && config.key_type != "memcmp")
+  {
+    fprintf(stderr, "key_type must be generic, int64 or memcmp\n");
+    return 1;
+  }
+  for (int key_size : config.key_sizes)
+  {
+    std::string key_name = config.key_type + std::to_string(key_size);
+    switch (key_size)
+    {
+    case 8: runSized<8>(config, key_name); break;
+    case 16: runSized<16>(config, key_name); break;
+    case 32: runSized<32>(config, key_name); break;
+    case 64: runSized<64>(config, key_name); break;
+    default:
+      fprintf(stderr, "key_size must be 8, 16, 32 or 64\n");
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -27,9 +27,53 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::Init(page_id_t page_id,
   SetSize(1);
   SetPageId(page_id);
   SetParentPageId(parent_id);
-  // 设置最大pagesize
-  int size = (PAGE_SIZE - sizeof(BPlusTreeInternalPage)) / (sizeof(KeyType) + sizeof(ValueType));
-  SetMaxSize(size);
+  SetNextPageId(INVALID_PAGE_ID);
+  SetLSN();
+  // 设置最大pagesize，减一是因为先插入再分裂
+  SetMaxSize(Capacity() - 1);
+}
+
+/*
+ * Number of key slots (and child slots) in a page. Both arrays have that many
+ * slots, the child array starts right after the last key slot
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int B_PLUS_TREE_INTERNAL_PAGE_TYPE::Capacity()
+{
+  static_assert(sizeof(KeyType) % alignof(ValueType) == 0,
+                "child array after the keys would be misaligned");
+  // 页尾留给缓冲池的校验和
+  return (PAGE_SIZE - PAGE_CHECKSUM_SIZE - sizeof(BPlusTreeInternalPage)) /
+         (sizeof(KeyType) + sizeof(ValueType));
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+ValueType *B_PLUS_TREE_INTERNAL_PAGE_TYPE::Children()
+{
+  return reinterpret_cast<ValueType *>(keys_ + Capacity());
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+const ValueType *B_PLUS_TREE_INTERNAL_PAGE_TYPE::Children() const
+{
+  return reinterpret_cast<const ValueType *>(keys_ + Capacity());
+}
+
+/*
+ * Slots of the two arrays, the write ahead log copies entries from them
+ */
+INDEX_TEMPLATE_ARGUMENTS
+const KeyType *B_PLUS_TREE_INTERNAL_PAGE_TYPE::GetKeys(int index) const
+{
+  assert(index >= 0 && index <= GetSize());
+  return keys_ + index;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+const ValueType *B_PLUS_TREE_INTERNAL_PAGE_TYPE::GetChildren(int index) const
+{
+  assert(index >= 0 && index <= GetSize());
+  return Children() + index;
 }
 /*
  * Helper method to get/set the key associated with input "index"(a.k.a
@@ -39,14 +83,14 @@ INDEX_TEMPLATE_ARGUMENTS
 KeyType B_PLUS_TREE_INTERNAL_PAGE_TYPE::KeyAt(int index) const {
   // replace with your own code
   assert(0 <= index && index < GetSize());
-  return array[index].first;
+  return keys_[index];
 }
 
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::SetKeyAt(int index, const KeyType &key) 
 {
   assert(index >= 0 && index < GetSize());
-  array[index].first = key;
+  keys_[index] = key;
 }
 
 /*
@@ -57,9 +101,10 @@ INDEX_TEMPLATE_ARGUMENTS
 int B_PLUS_TREE_INTERNAL_PAGE_TYPE::ValueIndex(const ValueType &value) const 
 {
   int count = GetSize();
+  const ValueType *children = Children();
   for (int i = 0; i < count; i++)
   {
-    if (array[i].second == value)
+    if (children[i] == value)
     {
       return i;
     }
@@ -75,14 +120,43 @@ INDEX_TEMPLATE_ARGUMENTS
 ValueType B_PLUS_TREE_INTERNAL_PAGE_TYPE::ValueAt(int index) const 
 { 
   assert(index >= 0 && index < GetSize());
-  return array[index].second;
+  return Children()[index];
 }
 
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::SetValueAt(int index, const ValueType &value) 
 {
   assert(0 <= index && index < GetSize());
-  array[index].second = value;
+  Children()[index] = value;
+}
+
+/*
+ * Helper methods to get/set the right link and the high key. High key is the
+ * upper bound (exclusive) of the keys routed through this page, meaningless
+ * on the right most page of a level
+ */
+INDEX_TEMPLATE_ARGUMENTS
+page_id_t B_PLUS_TREE_INTERNAL_PAGE_TYPE::GetNextPageId() const
+{
+  return next_page_id_;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void B_PLUS_TREE_INTERNAL_PAGE_TYPE::SetNextPageId(page_id_t next_page_id)
+{
+  next_page_id_ = next_page_id;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+KeyType B_PLUS_TREE_INTERNAL_PAGE_TYPE::GetHighKey() const
+{
+  return high_key_;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void B_PLUS_TREE_INTERNAL_PAGE_TYPE::SetHighKey(const KeyType &key)
+{
+  high_key_ = key;
 }
 
 /*****************************************************************************
@@ -92,6 +166,9 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::SetValueAt(int index, const ValueType &valu
  * Find and return the child pointer(page_id) which points to the child page
  * that contains input "key"
  * Start the search from the second key(the first key should always be invalid)
+ * The search only reads the key array and has no data dependent branch: each
+ * step keeps the half that may still hold the last key <= input, the
+ * compiler turns the choice into a conditional move
  */
 INDEX_TEMPLATE_ARGUMENTS
 ValueType
@@ -99,21 +176,19 @@ B_PLUS_TREE_INTERNAL_PAGE_TYPE::Lookup(const KeyType &key,
                                        const KeyComparator &comparator) const 
 {
   assert(GetSize() > 1);
-  
-  int myBegin = 1, myEnd = GetSize() - 1, myMiddle;
-  while (myBegin <= myEnd) 
-  { //find the last key in array <= input
-    myMiddle = (myEnd - myBegin) / 2 + myBegin;
-    if (comparator(array[myMiddle].first,key) <= 0) 
-    {
-      myBegin = myMiddle + 1;
-    }
-    else 
-    {
-      myEnd = myMiddle - 1;
-    }
+
+  const KeyType *base = keys_ + 1;
+  int length = GetSize() - 1;
+  while (length > 1)
+  {
+    int half = length / 2;
+    base = comparator(base[half], key) <= 0 ? base + half : base;
+    length -= half;
   }
-  return array[myBegin - 1].second;
+  // base 之前的 key 都 <= input，再看 base 自己
+  int index = static_cast<int>(base - keys_) - 1 +
+              (comparator(*base, key) <= 0 ? 1 : 0);
+  return Children()[index];
 }
 
 /*****************************************************************************
@@ -130,8 +205,10 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::PopulateNewRoot(
     const ValueType &old_value, const KeyType &new_key,
     const ValueType &new_value) 
 {
-  array[0].second = old_value;
-  array[1] = {new_key, new_value};
+  ValueType *children = Children();
+  children[0] = old_value;
+  keys_[1] = new_key;
+  children[1] = new_value;
   SetSize(2);
 }
 /*
@@ -148,12 +225,45 @@ int B_PLUS_TREE_INTERNAL_PAGE_TYPE::InsertNodeAfter(
   assert(idx > 0);
   IncreaseSize(1);
   int curSize = GetSize();
-  for (int i = curSize - 1; i > idx; i--) 
+  ValueType *children = Children();
+  memmove((void*)(keys_ + idx + 1), (void*)(keys_ + idx),
+          (curSize - 1 - idx) * sizeof(KeyType));
+  memmove((void*)(children + idx + 1), (void*)(children + idx),
+          (curSize - 1 - idx) * sizeof(ValueType));
+  keys_[idx] = new_key;
+  children[idx] = new_value;
+  return curSize;
+}
+
+/*
+ * Insert new_key & new_value pair at its position in key order. Used by the
+ * B-link insert, where the left neighbour of new_value may already have
+ * moved to another page
+ * @return:  new size after insertion
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int B_PLUS_TREE_INTERNAL_PAGE_TYPE::InsertByKey(
+    const KeyType &new_key, const ValueType &new_value,
+    const KeyComparator &comparator)
+{
+  int idx = GetSize();
+  for (int i = 1; i < GetSize(); i++)
   {
-    array[i] = array[i - 1];
+    if (comparator(new_key, keys_[i]) < 0)
+    {
+      idx = i;
+      break;
+    }
   }
-  array[idx].first = new_key;
-  array[idx].second = new_value;
+  IncreaseSize(1);
+  int curSize = GetSize();
+  ValueType *children = Children();
+  memmove((void*)(keys_ + idx + 1), (void*)(keys_ + idx),
+          (curSize - 1 - idx) * sizeof(KeyType));
+  memmove((void*)(children + idx + 1), (void*)(children + idx),
+          (curSize - 1 - idx) * sizeof(ValueType));
+  keys_[idx] = new_key;
+  children[idx] = new_value;
   return curSize;
 }
 
@@ -162,6 +272,8 @@ int B_PLUS_TREE_INTERNAL_PAGE_TYPE::InsertNodeAfter(
  *****************************************************************************/
 /*
  * Remove half of key & value pairs from this page to "recipient" page
+ * The moved children still name this page as their parent, the caller
+ * latches and updates them (see the file header)
  */
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveHalfTo(
@@ -174,20 +286,20 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveHalfTo(
   //复制过程
   int copyIdx = (total) / 2;
   page_id_t recipPageId = recipient->GetPageId();
-  for (int i = copyIdx; i < total; i++) 
-  {
-    recipient->array[i - copyIdx].first = array[i].first;
-    recipient->array[i - copyIdx].second = array[i].second;
-    // 更新
-    auto childRawPage = buffer_pool_manager->FetchPage(array[i].second);
-    BPlusTreePage *childTreePage = reinterpret_cast<BPlusTreePage *>(childRawPage->GetData());
-    childTreePage->SetParentPageId(recipPageId);
-
-    buffer_pool_manager->UnpinPage(array[i].second,true);
-  }
+  ValueType *children = Children();
+  memcpy((void*)recipient->keys_, (void*)(keys_ + copyIdx),
+         (total - copyIdx) * sizeof(KeyType));
+  memcpy((void*)recipient->Children(), (void*)(children + copyIdx),
+         (total - copyIdx) * sizeof(ValueType));
   //set size,is odd, bigger is last part
   SetSize(copyIdx);
   recipient->SetSize(total - copyIdx);
+
+  // 连接右指针，recipient 的第一个 key 就是推到父结点的分隔键
+  recipient->SetNextPageId(GetNextPageId());
+  recipient->SetHighKey(GetHighKey());
+  SetNextPageId(recipPageId);
+  SetHighKey(recipient->keys_[0]);
 }
 
 INDEX_TEMPLATE_ARGUMENTS
@@ -206,9 +318,12 @@ INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::Remove(int index) 
 {
   assert(0 <= index && index < GetSize());
-  for (int i = index; i < GetSize() - 1; ++i) {
-    array[i] = array[i + 1];
-  }
+  int tail = GetSize() - 1 - index;
+  ValueType *children = Children();
+  memmove((void*)(keys_ + index), (void*)(keys_ + index + 1),
+          tail * sizeof(KeyType));
+  memmove((void*)(children + index), (void*)(children + index + 1),
+          tail * sizeof(ValueType));
   IncreaseSize(-1);
 }
 
@@ -219,9 +334,10 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::Remove(int index)
 INDEX_TEMPLATE_ARGUMENTS
 ValueType B_PLUS_TREE_INTERNAL_PAGE_TYPE::RemoveAndReturnOnlyChild() 
 {
+  assert(GetSize() == 1);
+  ValueType only_child = ValueAt(0);
   IncreaseSize(-1);
-  assert(GetSize() == 0);
-  return ValueAt(0);
+  return only_child;
 }
 /*****************************************************************************
  * MERGE
@@ -229,6 +345,7 @@ ValueType B_PLUS_TREE_INTERNAL_PAGE_TYPE::RemoveAndReturnOnlyChild()
 /*
  * Remove all of key & value pairs from this page to "recipient" page, then
  * update relavent key & value pair in its parent page.
+ * The moved children are left to the caller like in MoveHalfTo
  */
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveAllTo(
@@ -236,7 +353,6 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveAllTo(
     BufferPoolManager *buffer_pool_manager) 
 {
   int start = recipient->GetSize();
-  page_id_t recipPageId = recipient->GetPageId();
 
   // 首先找父亲结点
   Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
@@ -246,21 +362,17 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveAllTo(
   // 从父亲结点分离
   SetKeyAt(0, parent->KeyAt(index_in_parent));
   buffer_pool_manager->UnpinPage(parent->GetPageId(), false);
-  for (int i = 0; i < GetSize(); ++i) 
-  {
-    recipient->array[start + i].first = array[i].first;
-    recipient->array[start + i].second = array[i].second;
-
-    //更新子结点
-    auto childRawPage = buffer_pool_manager->FetchPage(array[i].second);
-    BPlusTreePage *childTreePage = reinterpret_cast<BPlusTreePage *>(childRawPage->GetData());
-    childTreePage->SetParentPageId(recipPageId);
-    buffer_pool_manager->UnpinPage(array[i].second,true);
-  }
+  ValueType *children = Children();
+  memcpy((void*)(recipient->keys_ + start), (void*)keys_,
+         GetSize() * sizeof(KeyType));
+  memcpy((void*)(recipient->Children() + start), (void*)children,
+         GetSize() * sizeof(ValueType));
 
   //更新兄弟结点
   recipient->SetSize(start + GetSize());
   assert(recipient->GetSize() <= GetMaxSize());
+  recipient->SetNextPageId(GetNextPageId());
+  recipient->SetHighKey(GetHighKey());
   SetSize(0);
 }
 
@@ -277,6 +389,7 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::CopyAllFrom(
 /*
  * Remove the first key & value pair from this page to tail of "recipient"
  * page, then update relavent key & value pair in its parent page.
+ * The moved child is left to the caller like in MoveHalfTo
  */
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveFirstToEndOf(
@@ -285,20 +398,11 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveFirstToEndOf(
 {
   assert(GetSize() > 1);
   MappingType pair{KeyAt(1), ValueAt(0)};
-  page_id_t child_page_id = ValueAt(0);
   SetValueAt(0, ValueAt(1));
   Remove(1);
 
   recipient->CopyLastFrom(pair, buffer_pool_manager);
-
-  // 更新pageid
-  auto *page = buffer_pool_manager->FetchPage(child_page_id);
-
-  auto child = reinterpret_cast<BPlusTreePage *>(page->GetData());
-  child->SetParentPageId(recipient->GetPageId());
-
-  assert(child->GetParentPageId() == recipient->GetPageId());
-  buffer_pool_manager->UnpinPage(child->GetPageId(), true);
+  recipient->SetHighKey(pair.first);
 }
 
 INDEX_TEMPLATE_ARGUMENTS
@@ -314,7 +418,8 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::CopyLastFrom(
   auto index = parent->ValueIndex(GetPageId());
   auto key = parent->KeyAt(index + 1);
 
-  array[GetSize()] = {key, pair.second};
+  keys_[GetSize()] = key;
+  Children()[GetSize()] = pair.second;
   IncreaseSize(1);
   parent->SetKeyAt(index + 1, pair.first);
 
@@ -325,6 +430,7 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::CopyLastFrom(
 /*
  * Remove the last key & value pair from this page to head of "recipient"
  * page, then update relavent key & value pair in its parent page.
+ * The moved child is left to the caller like in MoveHalfTo
  */
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveLastToFrontOf(
@@ -333,6 +439,7 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::MoveLastToFrontOf(
 {
   MappingType pair {KeyAt(GetSize() - 1),ValueAt(GetSize() - 1)};
   IncreaseSize(-1);
+  SetHighKey(pair.first);
   recipient->CopyFirstFrom(pair, parent_index, buffer_pool_manager);
 }
 
@@ -342,26 +449,43 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::CopyFirstFrom(
     BufferPoolManager *buffer_pool_manager) 
 {
   assert(GetSize() + 1 < GetMaxSize());
-  memmove((void*)(array + 1), (void*)array, GetSize()*sizeof(MappingType));
+  memmove((void*)(keys_ + 1), (void*)keys_, GetSize()*sizeof(KeyType));
+  memmove((void*)(Children() + 1), (void*)Children(), GetSize()*sizeof(ValueType));
   IncreaseSize(1);
-  array[0] = pair;
-
-
-  page_id_t childPageId = pair.second;
-  Page *page = buffer_pool_manager->FetchPage(childPageId);
-  assert (page != nullptr);
-  BPlusTreePage *child = reinterpret_cast<BPlusTreePage *>(page->GetData());
-  child->SetParentPageId(GetPageId());
-  assert(child->GetParentPageId() == GetPageId());
-  buffer_pool_manager->UnpinPage(child->GetPageId(), true);
+  keys_[0] = pair.first;
+  Children()[0] = pair.second;
 
-
-  page = buffer_pool_manager->FetchPage(GetParentPageId());
+  Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
   B_PLUS_TREE_INTERNAL_PAGE_TYPE *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE_TYPE *>(page->GetData());
-  parent->SetKeyAt(parent_index, array[0].first);
+  // 第 0 个 key 没有意义：原来的第一个孩子前面要用父结点的分隔键，借来的 key 上移
+  keys_[1] = parent->KeyAt(parent_index);
+  parent->SetKeyAt(parent_index, keys_[0]);
   buffer_pool_manager->UnpinPage(GetParentPageId(), true);
 }
 
+/*****************************************************************************
+ * BULK LOAD
+ *****************************************************************************/
+/*
+ * Fill a freshly initialized page with sorted <first key of child, child page
+ * id> pairs. The key of the first pair lands in the invalid slot 0 and is
+ * ignored by lookups. The caller points the children at this page.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void B_PLUS_TREE_INTERNAL_PAGE_TYPE::PopulateFromSorted(
+    const MappingType *items, int size)
+{
+  assert(GetSize() == 1);
+  assert(size > 0 && size <= GetMaxSize());
+  ValueType *children = Children();
+  for (int i = 0; i < size; ++i)
+  {
+    keys_[i] = items[i].first;
+    children[i] = items[i].second;
+  }
+  SetSize(size);
+}
+
 /*****************************************************************************
  * DEBUG
  *****************************************************************************/
@@ -370,7 +494,7 @@ void B_PLUS_TREE_INTERNAL_PAGE_TYPE::QueueUpChildren(
     std::queue<BPlusTreePage *> *queue,
     BufferPoolManager *buffer_pool_manager) {
   for (int i = 0; i < GetSize(); i++) {
-    auto *page = buffer_pool_manager->FetchPage(array[i].second);
+    auto *page = buffer_pool_manager->FetchPage(Children()[i]);
     if (page == nullptr)
       throw Exception(EXCEPTION_TYPE_INDEX,
                       "all page are pinned while printing");
@@ -400,9 +524,9 @@ std::string B_PLUS_TREE_INTERNAL_PAGE_TYPE::ToString(bool verbose) const {
     } else {
       os << " ";
     }
-    os << std::dec << array[entry].first.ToString();
+    os << std::dec << keys_[entry].ToString();
     if (verbose) {
-      os << "(" << array[entry].second << ")";
+      os << "(" << Children()[entry] << ")";
     }
     ++entry;
   }
@@ -420,4 +544,14 @@ template class BPlusTreeInternalPage<GenericKey<32>, page_id_t,
                                            GenericComparator<32>>;
 template class BPlusTreeInternalPage<GenericKey<64>, page_id_t,
                                            GenericComparator<64>>;
+template class BPlusTreeInternalPage<Int32Key, page_id_t, Int32Comparator>;
+template class BPlusTreeInternalPage<Int64Key, page_id_t, Int64Comparator>;
+template class BPlusTreeInternalPage<MemcmpKey<8>, page_id_t,
+                                           MemcmpComparator<8>>;
+template class BPlusTreeInternalPage<MemcmpKey<16>, page_id_t,
+                                           MemcmpComparator<16>>;
+template class BPlusTreeInternalPage<MemcmpKey<32>, page_id_t,
+                                           MemcmpComparator<32>>;
+template class BPlusTreeInternalPage<MemcmpKey<64>, page_id_t,
+                                           MemcmpComparator<64>>;
 } // namespace scudb
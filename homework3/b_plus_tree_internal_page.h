@@ -9,9 +9,22 @@
  * should ignore the first key.
  *
  * Internal page format (keys are stored in increasing order):
- *  --------------------------------------------------------------------------
- * | HEADER | KEY(1)+PAGE_ID(1) | KEY(2)+PAGE_ID(2) | ... | KEY(n)+PAGE_ID(n) |
- *  --------------------------------------------------------------------------
+ *  ---------------------------------------------------------------------
+ * | HEADER | KEY(1) | KEY(2) | ... | KEY(c) | PAGE_ID(1) | ... | PAGE_ID(c) |
+ *  ---------------------------------------------------------------------
+ *
+ * Keys and child page ids live in two separate arrays of c = Capacity()
+ * slots, so the binary search in Lookup only touches key cache lines and
+ * reads a single page id at the end. Sorted order is kept (no Eytzinger
+ * layout) because split, merge and redistribute work on slot indexes.
+ *
+ * The HEADER is followed by NextPageId (4) and HighKey (key size): the right
+ * link to the sibling on the same level and the separator between the two,
+ * same as in leaf pages. HighKey is only meaningful while NextPageId is valid.
+ *
+ * Methods that move children to another page do not touch the children: the
+ * parent page id of a child may only change under the child's write latch,
+ * so BPlusTree updates the moved ones.
  */
 
 #pragma once
@@ -39,12 +52,22 @@ public:
   ValueType ValueAt(int index) const;
   // 设置
   void SetValueAt(int index, const ValueType &value);
+  // array slots, for the write ahead log
+  const KeyType *GetKeys(int index) const;
+  const ValueType *GetChildren(int index) const;
+  // right link and high key (B-link)
+  page_id_t GetNextPageId() const;
+  void SetNextPageId(page_id_t next_page_id);
+  KeyType GetHighKey() const;
+  void SetHighKey(const KeyType &key);
 
   ValueType Lookup(const KeyType &key, const KeyComparator &comparator) const;
   void PopulateNewRoot(const ValueType &old_value, const KeyType &new_key,
                        const ValueType &new_value);
   int InsertNodeAfter(const ValueType &old_value, const KeyType &new_key,
                       const ValueType &new_value);
+  int InsertByKey(const KeyType &new_key, const ValueType &new_value,
+                  const KeyComparator &comparator);
   void Remove(int index);
   ValueType RemoveAndReturnOnlyChild();
 
@@ -57,6 +80,8 @@ public:
   void MoveLastToFrontOf(BPlusTreeInternalPage *recipient,
                          int parent_index,
                          BufferPoolManager *buffer_pool_manager);
+  // Bulk load utility method
+  void PopulateFromSorted(const MappingType *items, int size);
   // DEUBG and PRINT
   std::string ToString(bool verbose) const;
   void QueueUpChildren(std::queue<BPlusTreePage *> *queue,
@@ -71,6 +96,12 @@ private:
                     BufferPoolManager *buffer_pool_manager);
   void CopyFirstFrom(const MappingType &pair, int parent_index,
                      BufferPoolManager *buffer_pool_manager);
-  MappingType array[0];
+  // slots per array, the child array starts right after the last key slot
+  static int Capacity();
+  ValueType *Children();
+  const ValueType *Children() const;
+  page_id_t next_page_id_;
+  KeyType high_key_;
+  KeyType keys_[0];
 };
 } // namespace scudb
@@ -2,6 +2,7 @@
  * b_plus_tree_leaf_page.cpp
  */
 
+#include <algorithm>
 #include <sstream>
 
 #include "common/exception.h"
@@ -29,14 +30,25 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::Init(page_id_t page_id, page_id_t parent_id)
   SetPageType(IndexPageType::LEAF_PAGE);
 
   SetSize(0);
-  assert(sizeof(BPlusTreeLeafPage) == 28);
+  assert(sizeof(BPlusTreeLeafPage) >= 28 + sizeof(KeyType));
   
   SetPageId(page_id);
   SetParentPageId(parent_id);
   SetNextPageId(INVALID_PAGE_ID);
+  SetLSN();
 
-  int size = (PAGE_SIZE - sizeof(BPlusTreeLeafPage)) / (sizeof(KeyType) + sizeof(ValueType));
-  SetMaxSize(size); //minus 1 for insert first then split
+  SetMaxSize(Capacity() - 1); //minus 1 for insert first then split
+}
+
+/*
+ * Number of entry slots in a page, one more than the max size
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int B_PLUS_TREE_LEAF_PAGE_TYPE::Capacity()
+{
+  // 页尾留给缓冲池的校验和
+  return (PAGE_SIZE - PAGE_CHECKSUM_SIZE - sizeof(BPlusTreeLeafPage)) /
+         sizeof(MappingType);
 }
 
 /**
@@ -54,6 +66,22 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::SetNextPageId(page_id_t next_page_id)
   next_page_id_ = next_page_id;
 }
 
+/**
+ * Helper methods to set/get high key, the upper bound (exclusive) of the keys
+ * this page may hold. Meaningless on the right most leaf
+ */
+INDEX_TEMPLATE_ARGUMENTS
+KeyType B_PLUS_TREE_LEAF_PAGE_TYPE::GetHighKey() const
+{
+  return high_key_;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+void B_PLUS_TREE_LEAF_PAGE_TYPE::SetHighKey(const KeyType &key)
+{
+  high_key_ = key;
+}
+
 /**
  * Helper method to find the first index i so that array[i].first >= key
  * NOTE: This method is only used when generating index iterator
@@ -96,6 +124,38 @@ const MappingType &B_PLUS_TREE_LEAF_PAGE_TYPE::GetItem(int index)
   return array[index];
 }
 
+/*
+ * Copy at most max_count entries starting at "index" into two separate
+ * (columnar) arrays, keys and values
+ * @return  number of entries copied
+ */
+INDEX_TEMPLATE_ARGUMENTS
+int B_PLUS_TREE_LEAF_PAGE_TYPE::CopyRangeTo(int index, int max_count,
+                                            KeyType *keys,
+                                            ValueType *values) const
+{
+  assert(index >= 0 && index <= GetSize());
+  int count = std::min(max_count, GetSize() - index);
+  const MappingType *items = array + index;
+  for (int i = 0; i < count; ++i)
+  {
+    keys[i] = items[i].first;
+    values[i] = items[i].second;
+  }
+  return count;
+}
+
+/*
+ * Pointer to the entry at "index", entries after it are stored contiguously
+ * up to GetSize(). Only valid while the caller holds a latch on this page
+ */
+INDEX_TEMPLATE_ARGUMENTS
+const MappingType *B_PLUS_TREE_LEAF_PAGE_TYPE::GetItems(int index) const
+{
+  assert(index >= 0 && index <= GetSize());
+  return array + index;
+}
+
 /*****************************************************************************
  * INSERTION
  *****************************************************************************/
@@ -145,7 +205,9 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveHalfTo(
 
   //连接指针
   recipient->SetNextPageId(GetNextPageId());
+  recipient->SetHighKey(GetHighKey());
   SetNextPageId(recipient->GetPageId());
+  SetHighKey(recipient->array[0].first);
 
 
   SetSize(copyIdx);
@@ -237,6 +299,7 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveAllTo(BPlusTreeLeafPage *recipient,
 {
   recipient->CopyAllFrom(array, GetSize());
   recipient->SetNextPageId(GetNextPageId());
+  recipient->SetHighKey(GetHighKey());
 }
 INDEX_TEMPLATE_ARGUMENTS
 void B_PLUS_TREE_LEAF_PAGE_TYPE::CopyAllFrom(MappingType *items, int size) 
@@ -265,10 +328,11 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveFirstToEndOf(
   IncreaseSize(-1);
   memmove((void*)(array), (void*)(array + 1), static_cast<size_t>(GetSize()*sizeof(MappingType)));
   recipient->CopyLastFrom(pair);
+  recipient->SetHighKey(array[0].first);
   
   //update relavent key & value pair in its parent page.
   Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
-  B_PLUS_TREE_INTERNAL_PAGE_TYPE *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE_TYPE *>(page->GetData());
+  auto *parent = reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t, KeyComparator> *>(page->GetData());
   parent->SetKeyAt(parent->ValueIndex(GetPageId()), array[0].first);
   buffer_pool_manager->UnpinPage(GetParentPageId(), true);
 }
@@ -291,6 +355,7 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::MoveLastToFrontOf(
 {
   MappingType pair = GetItem(GetSize() - 1);
   IncreaseSize(-1);
+  SetHighKey(pair.first);
   recipient->CopyFirstFrom(pair, parentIndex, buffer_pool_manager);
 }
 
@@ -305,11 +370,27 @@ void B_PLUS_TREE_LEAF_PAGE_TYPE::CopyFirstFrom(
   array[0] = item;
 
   Page *page = buffer_pool_manager->FetchPage(GetParentPageId());
-  B_PLUS_TREE_INTERNAL_PAGE_TYPE *parent = reinterpret_cast<B_PLUS_TREE_INTERNAL_PAGE_TYPE *>(page->GetData());
+  auto *parent = reinterpret_cast<BPlusTreeInternalPage<KeyType, page_id_t, KeyComparator> *>(page->GetData());
   parent->SetKeyAt(parentIndex, array[0].first);
   buffer_pool_manager->UnpinPage(GetParentPageId(), true);
 }
 
+/*****************************************************************************
+ * BULK LOAD
+ *****************************************************************************/
+/*
+ * Append sorted key & value pairs to the end of this page. Every key in items
+ * must be larger than the keys already stored here (used by bulk loading)
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void B_PLUS_TREE_LEAF_PAGE_TYPE::AppendSorted(const MappingType *items,
+                                              int size)
+{
+  assert(GetSize() + size <= GetMaxSize());
+  std::copy(items, items + size, array + GetSize());
+  IncreaseSize(size);
+}
+
 /*****************************************************************************
  * DEBUG
  *****************************************************************************/
@@ -352,4 +433,10 @@ template class BPlusTreeLeafPage<GenericKey<32>, RID,
                                        GenericComparator<32>>;
 template class BPlusTreeLeafPage<GenericKey<64>, RID,
                                        GenericComparator<64>>;
+template class BPlusTreeLeafPage<Int32Key, RID, Int32Comparator>;
+template class BPlusTreeLeafPage<Int64Key, RID, Int64Comparator>;
+template class BPlusTreeLeafPage<MemcmpKey<8>, RID, MemcmpComparator<8>>;
+template class BPlusTreeLeafPage<MemcmpKey<16>, RID, MemcmpComparator<16>>;
+template class BPlusTreeLeafPage<MemcmpKey<32>, RID, MemcmpComparator<32>>;
+template class BPlusTreeLeafPage<MemcmpKey<64>, RID, MemcmpComparator<64>>;
 } // namespace scudb
@@ -14,9 +14,13 @@
  *  ---------------------------------------------------------------------
  * | PageType (4) | CurrentSize (4) | MaxSize (4) | ParentPageId (4) |
  *  ---------------------------------------------------------------------
- *  ------------------------------
- * | PageId (4) | NextPageId (4)
- *  ------------------------------
+ *  ---------------------------------------------
+ * | PageId (4) | NextPageId (4) | HighKey (key size)
+ *  ---------------------------------------------
+ *
+ * NextPageId is the right link of the leaf level. HighKey is the separator
+ * between this leaf and its right sibling (every key here is smaller than
+ * it); it is only meaningful while NextPageId is valid.
  */
 #pragma once
 #include <utility>
@@ -38,12 +42,20 @@ public:
   // After creating a new leaf page from buffer pool, must call initialize
   // method to set default values
   void Init(page_id_t page_id, page_id_t parent_id = INVALID_PAGE_ID);
+  // entry slots in a page, the max size is one less
+  static int Capacity();
   // helper methods
   page_id_t GetNextPageId() const;
   void SetNextPageId(page_id_t next_page_id);
+  KeyType GetHighKey() const;
+  void SetHighKey(const KeyType &key);
   KeyType KeyAt(int index) const;
   int KeyIndex(const KeyType &key, const KeyComparator &comparator) const;
   const MappingType &GetItem(int index);
+  // batch scan helpers, see IndexIterator::NextBatch
+  int CopyRangeTo(int index, int max_count, KeyType *keys,
+                  ValueType *values) const;
+  const MappingType *GetItems(int index) const;
 
   // insert and delete methods
   int Insert(const KeyType &key, const ValueType &value,
@@ -61,6 +73,8 @@ public:
                         BufferPoolManager *buffer_pool_manager);
   void MoveLastToFrontOf(BPlusTreeLeafPage *recipient, int parentIndex,
                          BufferPoolManager *buffer_pool_manager);
+  // Bulk load utility method
+  void AppendSorted(const MappingType *items, int size);
   // Debug
   std::string ToString(bool verbose = false) const;
 
@@ -71,6 +85,7 @@ private:
   void CopyFirstFrom(const MappingType &item, int parentIndex,
                      BufferPoolManager *buffer_pool_manager);
   page_id_t next_page_id_;
+  KeyType high_key_;
   MappingType array[0];
 };
 } // namespace scudb
@@ -23,6 +23,8 @@
 
 #include "buffer/buffer_pool_manager.h"
 #include "index/generic_key.h"
+#include "index/integer_key.h"
+#include "index/memcmp_key.h"
 using namespace std;
 
 namespace scudb {
@@ -58,6 +60,7 @@ public:
   page_id_t GetPageId() const;
   void SetPageId(page_id_t page_id);
 
+  lsn_t GetLSN() const;
   void SetLSN(lsn_t lsn = INVALID_LSN);
 
 private:
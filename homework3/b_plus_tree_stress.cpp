@@ -0,0 +1,316 @@
+/**
+ * b_plus_tree_stress.cpp
+ *
+ * Randomized concurrency stress for BPlusTree. Build it as its own
+ * executable next to the library, run it after touching latch crabbing,
+ * the root latch or the delete path.
+ *
+ *   b_plus_tree_stress                       crabbing, then B-link
+ *   b_plus_tree_stress threads=16 rounds=50 pool=32 compact=1 check=1 ...
+ *
+ * Every round `threads` threads run `ops` random inserts, removes, lookups
+ * and range scans each. Thread t owns the keys k with k % threads == t: only
+ * it changes them, so it knows exactly which of them must be in the tree at
+ * any time, while the keys of all threads share the same pages. Lookups and
+ * the owner's keys inside every scan are checked against that. compact=1
+ * also runs Compact in a loop meanwhile, check=1 runs BPlusTree::Check in a
+ * loop, which must not find anything while the tree changes under it.
+ *
+ * When the threads are done:
+ *   - every frame of the pool has pin count zero (a leaked pin fails here
+ *     instead of as "out of memory" much later)
+ *   - BPlusTree::Check finds nothing wrong with the structure
+ *   - a scan returns exactly the keys the threads expect
+ * The exit code is the number of failures (capped), the first few are
+ * printed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_pool_manager.h"
+#include "index/b_plus_tree.h"
+#include "vtable/virtual_table.h"
+
+namespace scudb {
+
+using KeyType = GenericKey<8>;
+using Comparator = GenericComparator<8>;
+using Tree = BPlusTree<KeyType, RID, Comparator>;
+
+static const char *const INDEX_NAME = "stress";
+
+struct StressConfig {
+  int threads = 8;
+  int rounds = 10;
+  long ops = 20000; // per thread and round
+  int keys = 20000;
+  size_t pool = 64;
+  int blink = -1;   // -1: both modes
+  bool compact = false;
+  bool check = false;
+  unsigned seed = 1;
+  std::string file = "/dev/shm/scudb_stress.db";
+};
+
+class StressTest {
+public:
+  StressTest(const StressConfig &config, bool blink)
+      : config_(config), blink_(blink), failures_(0),
+        key_schema_(ParseCreateStatement("a bigint")),
+        comparator_(key_schema_), present_(config.keys, 0) {}
+  ~StressTest() { delete key_schema_; }
+
+  int Run()
+  {
+    std::remove(config_.file.c_str());
+    DiskManager disk_manager(config_.file);
+    BufferPoolManager bpm(config_.pool, &disk_manager);
+    page_id_t header_page_id;
+    bpm.NewPage(header_page_id);
+    bpm.UnpinPage(header_page_id, true);
+    Tree tree(INDEX_NAME, &bpm, comparator_, INVALID_PAGE_ID, blink_);
+
+    for (int round = 0; round < config_.rounds && failures_ == 0; ++round)
+    {
+      std::atomic<bool> done(false);
+      std::thread compactor;
+      if (config_.compact)
+      {
+        compactor = std::thread([&] {
+          while (!done)
+            guarded([&] { tree.Compact(); });
+        });
+      }
+      std::thread checker;
+      if (config_.check)
+      {
+        checker = std::thread([&] {
+          while (!done)
+            guarded([&] { checkTree(tree); });
+        });
+      }
+      std::vector<std::thread> workers;
+      for (int t = 0; t < config_.threads; ++t)
+      {
+        workers.emplace_back([&, t] {
+          guarded([&] { work(tree, t, config_.seed * 1000003u + round * 101 + t); });
+        });
+      }
+      for (auto &worker : workers)
+        worker.join();
+      done = true;
+      if (compactor.joinable())
+        compactor.join();
+      if (checker.joinable())
+        checker.join();
+
+      check(bpm, tree);
+      size_t expected = std::count(present_.begin(), present_.end(), 1);
+      printf("%s round %d: %zu keys, %d failures\n",
+             blink_ ? "b-link" : "crabbing", round, expected, failures_.load());
+    }
+    std::remove(config_.file.c_str());
+    return failures_;
+  }
+
+private:
+  template <typename F> void guarded(const F &f)
+  {
+    try
+    {
+      f();
+    }
+    catch (std::exception &e)
+    {
+      fail(std::string("exception: ") + e.what());
+    }
+  }
+
+  void fail(const std::string &message)
+  {
+    if (failures_++ < 10)
+      printf("FAIL %s\n", message.c_str());
+  }
+
+  static KeyType makeKey(int64_t k)
+  {
+    KeyType key;
+    key.SetFromInteger(k);
+    return key;
+  }
+
+  // 40% insert, 30% remove, 20% lookup, 10% scan over this thread's keys
+  void work(Tree &tree, int t, unsigned seed)
+  {
+    std::mt19937 rng(seed);
+    int threads = config_.threads;
+    int own_keys = (config_.keys - t + threads - 1) / threads;
+    if (own_keys <= 0)
+      return;
+    std::vector<RID> result;
+    for (long i = 0; i < config_.ops && failures_ == 0; ++i)
+    {
+      int k = t + static_cast<int>(rng() % own_keys) * threads;
+      int dice = rng() % 10;
+      if (dice < 4)
+      {
+        bool inserted = tree.Insert(makeKey(k), RID(k, k));
+        if (inserted == (present_[k] != 0))
+          fail("insert of " + std::to_string(k) + " returned " +
+               std::to_string(inserted));
+        present_[k] = 1;
+      }
+      else if (dice < 7)
+      {
+        tree.Remove(makeKey(k));
+        present_[k] = 0;
+      }
+      else if (dice < 9)
+      {
+        result.clear();
+        bool found = tree.GetValue(makeKey(k), result);
+        if (found != (present_[k] != 0) ||
+            (found && !(result.size() == 1 && result[0] == RID(k, k))))
+          fail("lookup of " + std::to_string(k) + " found " +
+               std::to_string(found));
+      }
+      else
+      {
+        scan(tree, t, k, 1 + rng() % 64);
+      }
+    }
+  }
+
+  // entries must come in ascending order and the scanned range must hold
+  // exactly this thread's present keys
+  void scan(Tree &tree, int t, int start, int length)
+  {
+    int64_t prev = start - 1;
+    int count = 0;
+    for (auto it = tree.Begin(makeKey(start)); !it.isEnd() && count < length;
+         ++it, ++count)
+    {
+      int64_t k = (*it).first.ToString();
+      if (k <= prev)
+      {
+        fail("scan from " + std::to_string(start) + " went from " +
+             std::to_string(prev) + " to " + std::to_string(k));
+        return;
+      }
+      for (int64_t j = prev + 1; j < k && j < config_.keys; ++j)
+      {
+        if (j % config_.threads == t && present_[j])
+          fail("scan from " + std::to_string(start) + " skipped " +
+               std::to_string(j));
+      }
+      if (k % config_.threads == t && !present_[k])
+        fail("scan from " + std::to_string(start) + " returned removed " +
+             std::to_string(k));
+      prev = k;
+    }
+  }
+
+  void checkTree(Tree &tree)
+  {
+    std::vector<std::string> errors;
+    if (!tree.Check(&errors))
+    {
+      for (auto &error : errors)
+        fail(error);
+    }
+  }
+
+  void check(BufferPoolManager &bpm, Tree &tree)
+  {
+    if (!bpm.CheckAllUnpinned())
+    {
+      MetricsSnapshot snapshot;
+      bpm.GetMetrics(snapshot);
+      fail("frames still pinned after the round: " +
+           std::to_string(snapshot.Get("bpm_pinned_pages")));
+      return;
+    }
+
+    checkTree(tree);
+    std::vector<int64_t> keys;
+    for (auto it = tree.Begin(); !it.isEnd(); ++it)
+      keys.push_back((*it).first.ToString());
+    std::vector<int64_t> expected;
+    for (int k = 0; k < config_.keys; ++k)
+    {
+      if (present_[k])
+        expected.push_back(k);
+    }
+    if (keys != expected)
+      fail("tree holds " + std::to_string(keys.size()) + " keys, expected " +
+           std::to_string(expected.size()));
+    if (!bpm.CheckAllUnpinned())
+      fail("the check itself leaked a pin");
+  }
+
+  const StressConfig &config_;
+  bool blink_;
+  std::atomic<int> failures_;
+  Schema *key_schema_;
+  Comparator comparator_;
+  // 每个 key 只由它所属的线程读写
+  std::vector<char> present_;
+};
+
+} // namespace scudb
+
+int main(int argc, char **argv)
+{
+  using namespace scudb;
+  StressConfig config;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    const char *value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    if (name == "threads")
+      config.threads = std::max(1, atoi(value));
+    else if (name == "rounds")
+      config.rounds = atoi(value);
+    else if (name == "ops")
+      config.ops = atol(value);
+    else if (name == "keys")
+      config.keys = std::max(1, atoi(value));
+    else if (name == "pool")
+      config.pool = atol(value);
+    else if (name == "blink")
+      config.blink = atoi(value);
+    else if (name == "compact")
+      config.compact = atoi(value) != 0;
+    else if (name == "check")
+      config.check = atoi(value) != 0;
+    else if (name == "seed")
+      config.seed = atoi(value);
+    else if (name == "file")
+      config.file = value;
+    else
+    {
+      fprintf(stderr, "usage: %s [name=value]..., see the top of "
+                      "b_plus_tree_stress.cpp\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int failures = 0;
+  for (int blink = 0; blink <= 1; ++blink)
+  {
+    if (config.blink >= 0 && config.blink != blink)
+      continue;
+    StressTest test(config, blink != 0);
+    failures += test.Run();
+  }
+  return std::min(failures, 100);
+}
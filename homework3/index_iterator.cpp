@@ -1,8 +1,10 @@
 /**
  * index_iterator.cpp
  */
+#include <algorithm>
 #include <cassert>
 
+#include "common/exception.h"
 #include "index/index_iterator.h"
 
 using namespace std;
@@ -14,29 +16,65 @@ namespace scudb {
  * set your own input parameters
  */
 INDEX_TEMPLATE_ARGUMENTS
-INDEXITERATOR_TYPE::IndexIterator() {}
+INDEXITERATOR_TYPE::IndexIterator()
+    : index_(0), page_(nullptr), leaf_(nullptr), buff_pool_manager_(nullptr) {}
 
 INDEX_TEMPLATE_ARGUMENTS
-INDEXITERATOR_TYPE::IndexIterator(B_PLUS_TREE_LEAF_PAGE_TYPE *leaf, int index, BufferPoolManager *bufferPoolManager) : index_(index),leaf_(leaf), buff_pool_manager_(bufferPoolManager){}
+INDEXITERATOR_TYPE::IndexIterator(Page *page, int index,
+                                  BufferPoolManager *bufferPoolManager)
+    : index_(index), page_(page), leaf_(nullptr),
+      buff_pool_manager_(bufferPoolManager)
+{
+  if (page_ != nullptr)
+  {
+    leaf_ = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page_->GetData());
+    assert(leaf_->IsLeafPage());
+    SkipExhaustedLeaf();
+  }
+}
 
+INDEX_TEMPLATE_ARGUMENTS
+INDEXITERATOR_TYPE::IndexIterator(IndexIterator &&other) noexcept
+    : index_(other.index_), page_(other.page_), leaf_(other.leaf_),
+      buff_pool_manager_(other.buff_pool_manager_)
+{
+  other.page_ = nullptr;
+  other.leaf_ = nullptr;
+}
+
+INDEX_TEMPLATE_ARGUMENTS
+INDEXITERATOR_TYPE &INDEXITERATOR_TYPE::operator=(IndexIterator &&other) noexcept
+{
+  if (this != &other)
+  {
+    Release();
+    index_ = other.index_;
+    page_ = other.page_;
+    leaf_ = other.leaf_;
+    buff_pool_manager_ = other.buff_pool_manager_;
+    other.page_ = nullptr;
+    other.leaf_ = nullptr;
+  }
+  return *this;
+}
 
 INDEX_TEMPLATE_ARGUMENTS
 INDEXITERATOR_TYPE::~IndexIterator() 
 {
-  buff_pool_manager_->FetchPage(leaf_->GetPageId())->RUnlatch();
-  buff_pool_manager_->UnpinPage(leaf_->GetPageId(), false);
-  buff_pool_manager_->UnpinPage(leaf_->GetPageId(), false);
-};
+  Release();
+}
 
 INDEX_TEMPLATE_ARGUMENTS
 bool INDEXITERATOR_TYPE::isEnd()
 {
-  return (leaf_ == nullptr || (index_ == leaf_->GetSize() && leaf_->GetNextPageId() == INVALID_PAGE_ID));
+  return (leaf_ == nullptr || (index_ >= leaf_->GetSize() && leaf_->GetNextPageId() == INVALID_PAGE_ID));
 }
 
 INDEX_TEMPLATE_ARGUMENTS
 const MappingType &INDEXITERATOR_TYPE::operator*()
 {
+  // NextSpan leaves the cursor at the end of a leaf, move on lazily
+  SkipExhaustedLeaf();
   return leaf_->GetItem(index_);
 }
 
@@ -44,26 +82,83 @@ INDEX_TEMPLATE_ARGUMENTS
 INDEXITERATOR_TYPE &INDEXITERATOR_TYPE::operator++()
 {
   ++index_;
+  SkipExhaustedLeaf();
+  return *this;
+}
 
-  if (index_ == leaf_->GetSize() && leaf_->GetNextPageId() != INVALID_PAGE_ID) 
+INDEX_TEMPLATE_ARGUMENTS
+int INDEXITERATOR_TYPE::NextBatch(KeyType *keys, ValueType *values,
+                                  int max_count)
+{
+  int count = 0;
+  while (count < max_count && leaf_ != nullptr)
   {
-    page_id_t next_page_id = leaf_->GetNextPageId();
-
-    auto *page = buff_pool_manager_->FetchPage(next_page_id);
-
-    page->RLatch();
+    SkipExhaustedLeaf();
+    // 一次拷贝当前叶子中剩余的一段
+    int copied = leaf_->CopyRangeTo(index_, max_count - count, keys + count,
+                                    values + count);
+    if (copied == 0)
+      break;
+    index_ += copied;
+    count += copied;
+  }
+  return count;
+}
 
-    buff_pool_manager_->FetchPage(leaf_->GetPageId())->RUnlatch();
-    buff_pool_manager_->UnpinPage(leaf_->GetPageId(), false);
-    buff_pool_manager_->UnpinPage(leaf_->GetPageId(), false);
+INDEX_TEMPLATE_ARGUMENTS
+int INDEXITERATOR_TYPE::NextSpan(const MappingType *&items, int max_count)
+{
+  if (leaf_ == nullptr)
+    return 0;
+  // the previous run is released here, not at the end of the last call,
+  // so that it stays readable until the caller asks for more
+  SkipExhaustedLeaf();
+  int count = std::min(max_count, leaf_->GetSize() - index_);
+  if (count <= 0)
+    return 0;
+  items = leaf_->GetItems(index_);
+  index_ += count;
+  return count;
+}
 
-    auto next_leaf = reinterpret_cast<BPlusTreeLeafPage<KeyType, ValueType, KeyComparator> *>(page->GetData());
-    assert(next_leaf->IsLeafPage());
+/*
+ * Latch coupling along the leaf chain: the next leaf is pinned and read
+ * latched before the current one is let go, and the pin taken by FetchPage is
+ * the only one ever released for that page.
+ */
+INDEX_TEMPLATE_ARGUMENTS
+void INDEXITERATOR_TYPE::SkipExhaustedLeaf()
+{
+  while (leaf_ != nullptr && index_ >= leaf_->GetSize() &&
+         leaf_->GetNextPageId() != INVALID_PAGE_ID)
+  {
+    Page *next_page = buff_pool_manager_->FetchPage(leaf_->GetNextPageId());
+    if (next_page == nullptr)
+    {
+      throw Exception(EXCEPTION_TYPE_INDEX,
+                      "all page are pinned while iterating");
+    }
+    next_page->RLatch();
+    Release();
+
+    page_ = next_page;
+    leaf_ = reinterpret_cast<B_PLUS_TREE_LEAF_PAGE_TYPE *>(page_->GetData());
+    assert(leaf_->IsLeafPage());
     index_ = 0;
-    leaf_ = next_leaf;
+    // 映射模式下让内核先把再下一个叶子读进来
+    buff_pool_manager_->ReadAhead(leaf_->GetNextPageId(), 1);
   }
+}
 
-  return *this;
+INDEX_TEMPLATE_ARGUMENTS
+void INDEXITERATOR_TYPE::Release()
+{
+  if (page_ == nullptr)
+    return;
+  page_->RUnlatch();
+  buff_pool_manager_->UnpinPage(page_->GetPageId(), false);
+  page_ = nullptr;
+  leaf_ = nullptr;
 }
 
 template class IndexIterator<GenericKey<4>, RID, GenericComparator<4>>;
@@ -71,5 +166,11 @@ template class IndexIterator<GenericKey<8>, RID, GenericComparator<8>>;
 template class IndexIterator<GenericKey<16>, RID, GenericComparator<16>>;
 template class IndexIterator<GenericKey<32>, RID, GenericComparator<32>>;
 template class IndexIterator<GenericKey<64>, RID, GenericComparator<64>>;
+template class IndexIterator<Int32Key, RID, Int32Comparator>;
+template class IndexIterator<Int64Key, RID, Int64Comparator>;
+template class IndexIterator<MemcmpKey<8>, RID, MemcmpComparator<8>>;
+template class IndexIterator<MemcmpKey<16>, RID, MemcmpComparator<16>>;
+template class IndexIterator<MemcmpKey<32>, RID, MemcmpComparator<32>>;
+template class IndexIterator<MemcmpKey<64>, RID, MemcmpComparator<64>>;
 
 } // namespace scudb
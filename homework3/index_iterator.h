@@ -1,6 +1,11 @@
 /**
  * index_iterator.h
  * For range scan of b+ tree
+ *
+ * The iterator owns exactly one pin and one read latch on the leaf page it is
+ * positioned on. Both are handed over to the next leaf when the cursor moves
+ * across a leaf boundary, and released when the iterator is destroyed. The
+ * iterator can be moved but not copied, so a pin is never released twice.
  */
 #pragma once
 #include "page/b_plus_tree_leaf_page.h"
@@ -18,8 +23,15 @@ public:
   // you may define your own constructor based on your member variables
   IndexIterator();
 
-// 增加有参数的构造函数
-  IndexIterator(BPlusTreeLeafPage<KeyType, ValueType, KeyComparator> *,int, BufferPoolManager *);
+  // page must already be pinned and read latched by the caller, the iterator
+  // takes over both
+  IndexIterator(Page *page, int index, BufferPoolManager *bufferPoolManager);
+
+  IndexIterator(IndexIterator &&other) noexcept;
+  IndexIterator &operator=(IndexIterator &&other) noexcept;
+
+  IndexIterator(const IndexIterator &) = delete;
+  IndexIterator &operator=(const IndexIterator &) = delete;
 
   ~IndexIterator();
 
@@ -29,9 +41,25 @@ public:
 
   IndexIterator &operator++();
 
+  // Copy up to max_count consecutive entries into the caller's key and value
+  // arrays and advance past them, crossing leaf boundaries as needed.
+  // Return the number of entries copied, 0 means the scan is finished.
+  int NextBatch(KeyType *keys, ValueType *values, int max_count);
+
+  // Zero-copy variant: point items at the next run of entries inside the
+  // current leaf (at most max_count) and advance past them. The run stays
+  // valid until the next call on this iterator.
+  int NextSpan(const MappingType *&items, int max_count);
+
 private:
+  // 当前叶子已经读完时，沿着 next_page_id 移动到下一个非空叶子
+  void SkipExhaustedLeaf();
+  // 释放当前叶子的读锁和 pin
+  void Release();
+
   // add your own private member variables here
   int index_;
+  Page *page_;
   BPlusTreeLeafPage<KeyType, ValueType, KeyComparator> *leaf_;
   BufferPoolManager *buff_pool_manager_;
 };
@@ -0,0 +1,62 @@
+/**
+ * integer_key.h
+ *
+ * Index key for a single INTEGER or BIGINT column. GenericComparator turns
+ * both keys into Values through the key schema, column by column, on every
+ * comparison; these keys hold the plain integer and compare it inline, for
+ * the common case of an index on an integer id.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include "table/tuple.h"
+
+namespace scudb {
+
+template <typename IntType> class IntegerKey {
+public:
+  // the key schema is one column of IntType, stored inline at the start of
+  // the key tuple
+  inline void SetFromKey(const Tuple &tuple) {
+    value = 0;
+    memcpy(&value, tuple.GetData(),
+           std::min<size_t>(sizeof(IntType), tuple.GetLength()));
+  }
+
+  // NOTE: for test purpose only
+  inline void SetFromInteger(int64_t key) {
+    value = static_cast<IntType>(key);
+  }
+
+  // NOTE: for test purpose only
+  inline int64_t ToString() const { return value; }
+
+  friend std::ostream &operator<<(std::ostream &os, const IntegerKey &key) {
+    os << key.value;
+    return os;
+  }
+
+  IntType value;
+};
+
+template <typename IntType> class IntegerComparator {
+public:
+  inline int operator()(const IntegerKey<IntType> &lhs,
+                        const IntegerKey<IntType> &rhs) const {
+    return (lhs.value > rhs.value) - (lhs.value < rhs.value);
+  }
+
+  // same constructor as GenericComparator, the schema is not needed
+  IntegerComparator(Schema *key_schema = nullptr) {}
+};
+
+using Int32Key = IntegerKey<int32_t>;
+using Int64Key = IntegerKey<int64_t>;
+using Int32Comparator = IntegerComparator<int32_t>;
+using Int64Comparator = IntegerComparator<int64_t>;
+
+} // namespace scudb
@@ -0,0 +1,169 @@
+/**
+ * key_encoder.cpp
+ */
+#include <cstring>
+
+#include "common/exception.h"
+#include "index/key_encoder.h"
+#include "type/value.h"
+
+namespace scudb {
+
+namespace {
+
+// 越界的字节只计数不写入, 调用方根据返回的长度判断是否被截断
+class Writer {
+public:
+  Writer(char *buffer, int size) : buffer_(buffer), size_(size), pos_(0) {}
+
+  inline void Put(unsigned char byte)
+  {
+    if (pos_ < size_)
+      buffer_[pos_] = static_cast<char>(byte);
+    ++pos_;
+  }
+
+  // big endian, the lowest `bytes` bytes of bits
+  inline void PutBits(uint64_t bits, int bytes)
+  {
+    for (int i = bytes - 1; i >= 0; --i)
+      Put(static_cast<unsigned char>(bits >> (8 * i)));
+  }
+
+  // 降序列: 把这一列已写入的字节全部取反
+  inline void Invert(int from)
+  {
+    for (int i = from; i < pos_ && i < size_; ++i)
+      buffer_[i] = static_cast<char>(~buffer_[i]);
+  }
+
+  inline int Position() const { return pos_; }
+
+private:
+  char *buffer_;
+  int size_;
+  int pos_;
+};
+
+// two's complement with the sign bit flipped is unsigned order
+inline void PutSigned(Writer &writer, int64_t value, int bytes)
+{
+  writer.PutBits(static_cast<uint64_t>(value) ^ (1ULL << (8 * bytes - 1)),
+                 bytes);
+}
+
+inline void PutDecimal(Writer &writer, double value)
+{
+  if (value == 0)
+    value = 0; // -0.0 == 0.0, give both the same bytes
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits = (bits & (1ULL << 63)) ? ~bits : bits ^ (1ULL << 63);
+  writer.PutBits(bits, sizeof(bits));
+}
+
+inline void PutVarchar(Writer &writer, const Value &value)
+{
+  const char *data = value.GetData();
+  uint32_t length = value.GetLength();
+  // VARCHAR 的长度包含结尾的 '\0'
+  if (length > 0 && data[length - 1] == '\0')
+    --length;
+  for (uint32_t i = 0; i < length; ++i)
+  {
+    writer.Put(static_cast<unsigned char>(data[i]));
+    if (data[i] == '\0')
+      writer.Put(0xFF);
+  }
+  writer.Put(0x00);
+  writer.Put(0x00);
+}
+
+} // namespace
+
+KeyEncoder::KeyEncoder(Schema *key_schema,
+                       const std::vector<bool> &descending)
+    : key_schema_(key_schema), descending_(descending)
+{
+  descending_.resize(key_schema->GetColumnCount(), false);
+}
+
+int KeyEncoder::Encode(const Tuple &key, char *buffer, int size) const
+{
+  Writer writer(buffer, size);
+  for (int i = 0; i < key_schema_->GetColumnCount(); ++i)
+  {
+    int start = writer.Position();
+    Value value = key.GetValue(key_schema_, i);
+    if (value.IsNull())
+    {
+      writer.Put(0x00);
+    }
+    else
+    {
+      writer.Put(0x01);
+      switch (key_schema_->GetType(i))
+      {
+      case BOOLEAN:
+      case TINYINT:
+        PutSigned(writer, value.GetAs<int8_t>(), 1);
+        break;
+      case SMALLINT:
+        PutSigned(writer, value.GetAs<int16_t>(), 2);
+        break;
+      case INTEGER:
+        PutSigned(writer, value.GetAs<int32_t>(), 4);
+        break;
+      case BIGINT:
+        PutSigned(writer, value.GetAs<int64_t>(), 8);
+        break;
+      case TIMESTAMP:
+        writer.PutBits(value.GetAs<uint64_t>(), 8);
+        break;
+      case DECIMAL:
+        PutDecimal(writer, value.GetAs<double>());
+        break;
+      case VARCHAR:
+        PutVarchar(writer, value);
+        break;
+      default:
+        throw Exception(EXCEPTION_TYPE_UNKNOWN_TYPE,
+                        "column type cannot be used in a memcmp key");
+      }
+    }
+    if (descending_[i])
+      writer.Invert(start);
+  }
+  return writer.Position();
+}
+
+int KeyEncoder::GetMaxLength() const
+{
+  int length = 0;
+  for (int i = 0; i < key_schema_->GetColumnCount(); ++i)
+  {
+    switch (key_schema_->GetType(i))
+    {
+    case BOOLEAN:
+    case TINYINT:
+      length += 1 + 1;
+      break;
+    case SMALLINT:
+      length += 1 + 2;
+      break;
+    case INTEGER:
+      length += 1 + 4;
+      break;
+    case BIGINT:
+    case TIMESTAMP:
+    case DECIMAL:
+      length += 1 + 8;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return length;
+}
+
+} // namespace scudb
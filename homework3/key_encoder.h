@@ -0,0 +1,51 @@
+/**
+ * key_encoder.h
+ *
+ * Order preserving binary encoding of (multi column) index keys. Two key
+ * tuples compare the same way as memcmp of their encodings, so a composite
+ * key stored in a MemcmpKey needs no schema driven comparator: every
+ * comparison inside the tree is one memcmp.
+ *
+ * Every column is a null byte (0x00 NULL, 0x01 not NULL, NULLs sort first)
+ * followed by the value, unless it is NULL:
+ *   BOOLEAN, TINYINT .. BIGINT  big endian, sign bit flipped
+ *   TIMESTAMP                   big endian
+ *   DECIMAL                     IEEE 754 bits, sign bit flipped for positive
+ *                               numbers, all bits flipped for negative ones
+ *   VARCHAR                     bytes with 0x00 escaped as 0x00 0xFF, ended
+ *                               by 0x00 0x00, so "ab" sorts before "abc"
+ * Every column encoding is prefix free, which keeps the columns apart
+ * without length fields. A descending column has all of its bytes
+ * inverted, including the null byte (NULLs sort last there).
+ */
+#pragma once
+
+#include <vector>
+
+#include "catalog/schema.h"
+#include "table/tuple.h"
+
+namespace scudb {
+
+class KeyEncoder {
+public:
+  // descending[i] sorts column i of the key schema in descending order,
+  // missing entries are ascending
+  KeyEncoder(Schema *key_schema,
+             const std::vector<bool> &descending = std::vector<bool>());
+
+  // writes the encoding of a key tuple (laid out as the key schema) to
+  // buffer, at most size bytes. Returns the full length of the encoding like
+  // snprintf: a result greater than size means it was cut off
+  int Encode(const Tuple &key, char *buffer, int size) const;
+
+  // length of the longest encoding (no NULLs), or -1 if the schema has a
+  // VARCHAR column. A MemcmpKey of at least this size holds any key
+  int GetMaxLength() const;
+
+private:
+  Schema *key_schema_;
+  std::vector<bool> descending_;
+};
+
+} // namespace scudb
@@ -0,0 +1,68 @@
+/**
+ * memcmp_key.h
+ *
+ * Fixed size index key whose bytes are already in key order, so comparing
+ * two keys is one inlined memcmp, no schema involved. Integers are stored
+ * big endian with the sign bit flipped, which makes negative numbers sort
+ * before positive ones byte by byte. Composite keys come from KeyEncoder,
+ * see key_encoder.h for the format.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include "common/exception.h"
+#include "index/key_encoder.h"
+#include "table/tuple.h"
+
+namespace scudb {
+
+template <size_t KeySize> class MemcmpKey {
+public:
+  // the rest of the key is zero filled, which keeps the order because the
+  // encoding is prefix free
+  inline void SetFromKey(const KeyEncoder &encoder, const Tuple &tuple) {
+    memset(data, 0, KeySize);
+    if (encoder.Encode(tuple, data, KeySize) > static_cast<int>(KeySize))
+      throw Exception(EXCEPTION_TYPE_INDEX, "key does not fit in MemcmpKey");
+  }
+
+  // NOTE: for test purpose only
+  inline void SetFromInteger(int64_t key) {
+    memset(data, 0, KeySize);
+    uint64_t bits = static_cast<uint64_t>(key) ^ (1ULL << 63);
+    for (size_t i = 0; i < sizeof(bits) && i < KeySize; ++i)
+      data[i] = static_cast<char>(bits >> (56 - 8 * i));
+  }
+
+  // NOTE: for test purpose only
+  inline int64_t ToString() const {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < sizeof(bits); ++i)
+      bits = (bits << 8) |
+             (i < KeySize ? static_cast<unsigned char>(data[i]) : 0);
+    return static_cast<int64_t>(bits ^ (1ULL << 63));
+  }
+
+  friend std::ostream &operator<<(std::ostream &os, const MemcmpKey &key) {
+    os << key.ToString();
+    return os;
+  }
+
+  char data[KeySize];
+};
+
+template <size_t KeySize> class MemcmpComparator {
+public:
+  inline int operator()(const MemcmpKey<KeySize> &lhs,
+                        const MemcmpKey<KeySize> &rhs) const {
+    return memcmp(lhs.data, rhs.data, KeySize);
+  }
+
+  // same constructor as GenericComparator, the schema is not needed
+  MemcmpComparator(Schema *key_schema = nullptr) {}
+};
+
+} // namespace scudb
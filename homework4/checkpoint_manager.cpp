@@ -0,0 +1,126 @@
+/**
+ * checkpoint_manager.cpp
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "logging/checkpoint_manager.h"
+#include "page/header_page.h"
+
+namespace scudb {
+void CheckpointManager::AddFlushCallback(const std::function<void()> &callback)
+{
+  std::lock_guard<std::mutex> lck(callbacks_latch_);
+  flush_callbacks_.push_back(callback);
+}
+
+/*
+ * Between BEGIN and END foreground work goes on, so both tables are only
+ * approximately "at" any point in time. That is enough: a page dirtied after
+ * the dirty page table was read got a recovery LSN larger than begin_lsn, and
+ * recovery replays everything from begin_lsn on anyway
+ */
+lsn_t CheckpointManager::Checkpoint()
+{
+  LogRecord begin_record(INVALID_TXN_ID, INVALID_LSN,
+                         LogRecordType::CHECKPOINT_BEGIN);
+  lsn_t begin_lsn = log_manager_->AppendLogRecord(begin_record);
+
+  // 早于 BEGIN 的改动要在这次写出的页里
+  {
+    std::lock_guard<std::mutex> lck(callbacks_latch_);
+    for (auto &callback : flush_callbacks_)
+      callback();
+  }
+
+  std::vector<std::pair<page_id_t, lsn_t>> dirty_pages;
+  std::vector<std::pair<txn_id_t, lsn_t>> active_txns;
+  lsn_t oldest_lsn;
+  buffer_pool_manager_->GetDirtyPageTable(dirty_pages);
+  log_manager_->GetActiveTxnTable(active_txns, oldest_lsn);
+  if (oldest_lsn == INVALID_LSN || oldest_lsn > begin_lsn)
+    oldest_lsn = begin_lsn;
+  for (auto &entry : dirty_pages)
+    oldest_lsn = std::min(oldest_lsn, entry.second);
+  int scan_offset = log_manager_->GetLogOffset(oldest_lsn);
+
+  LogRecord end_record(INVALID_TXN_ID, INVALID_LSN,
+                       LogRecordType::CHECKPOINT_END, begin_lsn, scan_offset,
+                       dirty_pages, active_txns);
+  int end_offset;
+  lsn_t end_lsn = log_manager_->AppendLogRecord(end_record, &end_offset);
+  log_manager_->Flush(end_lsn);
+
+  // master record，指向刚写完的 END
+  Page *page = buffer_pool_manager_->FetchPage(HEADER_PAGE_ID);
+  if (page == nullptr)
+    return INVALID_LSN;
+  page->WLatch();
+  auto *header_page = reinterpret_cast<HeaderPage *>(page);
+  if (!header_page->InsertRecord(CHECKPOINT_RECORD_NAME, end_offset))
+    header_page->UpdateRecord(CHECKPOINT_RECORD_NAME, end_offset);
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, true);
+  buffer_pool_manager_->FlushPage(HEADER_PAGE_ID);
+
+  // 以后的检查点不会从更早的位置开始
+  log_manager_->TruncateLogOffsets(scan_offset);
+  return end_lsn;
+}
+
+size_t CheckpointManager::FlushOldPages()
+{
+  std::vector<std::pair<page_id_t, lsn_t>> dirty_pages;
+  buffer_pool_manager_->GetDirtyPageTable(dirty_pages);
+  int log_size = log_manager_->GetLogSize();
+  int max_distance = max_redo_bytes_ / 2;
+
+  // 比这个 LSN 早弄脏的页都要写回
+  lsn_t flush_lsn = INVALID_LSN;
+  for (auto &entry : dirty_pages)
+  {
+    if (entry.second >= flush_lsn &&
+        log_size - log_manager_->GetLogOffset(entry.second) > max_distance)
+      flush_lsn = entry.second + 1;
+  }
+  if (flush_lsn == INVALID_LSN)
+    return 0;
+  return buffer_pool_manager_->FlushDirtyPages(flush_lsn, dirty_pages.size());
+}
+
+void CheckpointManager::RunCheckpointThread(std::chrono::milliseconds interval)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  if (checkpoint_thread_ != nullptr)
+    return;
+  stop_ = false;
+  checkpoint_thread_ = new std::thread([this, interval] {
+    std::unique_lock<std::mutex> lock(latch_);
+    while (!cv_.wait_for(lock, interval, [this] { return stop_; }))
+    {
+      lock.unlock();
+      FlushOldPages();
+      Checkpoint();
+      lock.lock();
+    }
+  });
+}
+
+void CheckpointManager::StopCheckpointThread()
+{
+  std::thread *checkpoint_thread;
+  {
+    std::lock_guard<std::mutex> lck(latch_);
+    if (checkpoint_thread_ == nullptr)
+      return;
+    stop_ = true;
+    checkpoint_thread = checkpoint_thread_;
+    checkpoint_thread_ = nullptr;
+    cv_.notify_one();
+  }
+  checkpoint_thread->join();
+  delete checkpoint_thread;
+}
+
+} // namespace scudb
@@ -0,0 +1,83 @@
+/**
+ * checkpoint_manager.h
+ *
+ * Fuzzy checkpoints. A checkpoint appends CHECKPOINT_BEGIN, then reads the
+ * dirty page table from the buffer pool and the active transaction table from
+ * the log manager (neither stops FetchPage/UnpinPage or transactions), and
+ * appends CHECKPOINT_END holding both. Last, the master record in the header
+ * page is pointed at the end record.
+ * State kept outside the buffer pool (the root page ids of the indexes) is
+ * written into its pages by flush callbacks, right after the begin record.
+ * Recovery starts reading the log at the oldest of: the begin record, the
+ * recovery LSN of any dirty page and the first record of any active
+ * transaction. The background thread keeps that distance below
+ * max_redo_bytes by writing back the pages that were dirtied first.
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_pool_manager.h"
+#include "logging/log_manager.h"
+
+namespace scudb {
+
+// header page record holding the log offset of the last CHECKPOINT_END
+#define CHECKPOINT_RECORD_NAME "__checkpoint__"
+
+class CheckpointManager {
+public:
+  CheckpointManager(BufferPoolManager *buffer_pool_manager,
+                    LogManager *log_manager,
+                    int max_redo_bytes = 64 * LOG_BUFFER_SIZE)
+      : buffer_pool_manager_(buffer_pool_manager), log_manager_(log_manager),
+        max_redo_bytes_(max_redo_bytes), stop_(false),
+        checkpoint_thread_(nullptr) {}
+
+  ~CheckpointManager() { StopCheckpointThread(); }
+
+  // called by every checkpoint after its begin record, e.g. to write a
+  // tree's root page id (BPlusTree::FlushRootPageId). The callback has to
+  // stay valid while checkpoints are taken
+  void AddFlushCallback(const std::function<void()> &callback);
+
+  // take one checkpoint now
+  // @return: lsn of the CHECKPOINT_END record, INVALID_LSN if the header page
+  // could not be pinned
+  lsn_t Checkpoint();
+
+  // write back the pages that keep recovery from starting within
+  // max_redo_bytes / 2 of the end of the log
+  size_t FlushOldPages();
+
+  // flush old pages and checkpoint every interval. The log written during
+  // one interval should stay well below max_redo_bytes / 2
+  void RunCheckpointThread(std::chrono::milliseconds interval);
+  void StopCheckpointThread();
+
+  // upper bound on the log recovery has to read, in bytes
+  inline int GetMaxRedoBytes() { return max_redo_bytes_; }
+  inline void SetMaxRedoBytes(int max_redo_bytes) {
+    max_redo_bytes_ = max_redo_bytes;
+  }
+
+private:
+  BufferPoolManager *buffer_pool_manager_;
+  LogManager *log_manager_;
+  std::atomic<int> max_redo_bytes_;
+  std::mutex callbacks_latch_;
+  std::vector<std::function<void()>> flush_callbacks_;
+  // background thread
+  bool stop_;
+  std::mutex latch_;
+  std::condition_variable cv_;
+  std::thread *checkpoint_thread_;
+};
+
+} // namespace scudb
@@ -0,0 +1,332 @@
+/**
+ * log_manager.cpp
+ */
+
+#include "logging/log_manager.h"
+
+namespace scudb {
+/*
+ * set ENABLE_LOGGING = true
+ * Start a separate thread to execute flush to disk operation periodically
+ * The flush can be triggered when the log buffer is full or buffer pool
+ * manager wants to force flush (it only happens when the flushed page has a
+ * larger LSN than persistent LSN)
+ */
+void LogManager::RunFlushThread()
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  if (flush_thread_ != nullptr)
+    return;
+  ENABLE_LOGGING = true;
+  flush_thread_ = new std::thread([this] {
+    std::unique_lock<std::mutex> lock(latch_);
+    while (ENABLE_LOGGING)
+    {
+      cv_.wait_for(lock, LOG_TIMEOUT,
+                   [this] { return flush_requested_ || !ENABLE_LOGGING; });
+      FlushBuffer(lock);
+    }
+    // 退出前把剩下的写完
+    FlushBuffer(lock);
+  });
+}
+
+/*
+ * Stop and join the flush thread, set ENABLE_LOGGING = false
+ */
+void LogManager::StopFlushThread()
+{
+  std::thread *flush_thread;
+  {
+    std::lock_guard<std::mutex> lck(latch_);
+    if (flush_thread_ == nullptr)
+      return;
+    ENABLE_LOGGING = false;
+    flush_thread = flush_thread_;
+    cv_.notify_one();
+  }
+  flush_thread->join();
+  delete flush_thread;
+  std::lock_guard<std::mutex> lck(latch_);
+  flush_thread_ = nullptr;
+  // 还在等刷盘线程的调用者改为自己写
+  flushed_cv_.notify_all();
+}
+
+/*
+ * append a log record into log buffer
+ * you MUST set the log record's lsn within this method
+ * @return: lsn that is assigned to this log record
+ *
+ * example below
+ * // First, serialize the must have fields(20 bytes in total)
+ * log_record.lsn_ = next_lsn_++;
+ * memcpy(log_buffer_ + offset_, &log_record, 20);
+ * int pos = offset_ + 20;
+ *
+ * if (log_record.log_record_type_ == LogRecordType::INSERT) {
+ *    memcpy(log_buffer_ + pos, &log_record.insert_rid_, sizeof(RID));
+ *    pos += sizeof(RID);
+ *    // we have provided serialize function for tuple class
+ *    log_record.insert_tuple_.SerializeTo(log_buffer_ + pos);
+ *  }
+ */
+lsn_t LogManager::AppendLogRecord(LogRecord &log_record, int *offset)
+{
+  assert(log_record.size_ <= LOG_BUFFER_SIZE);
+  std::unique_lock<std::mutex> lock(latch_);
+  while (offset_ + log_record.size_ > LOG_BUFFER_SIZE)
+  {
+    // 缓冲区满了：有刷盘线程就叫醒它，否则自己写
+    if (flush_thread_ != nullptr)
+    {
+      flush_requested_ = true;
+      cv_.notify_one();
+      flushed_cv_.wait(lock);
+    }
+    else
+    {
+      FlushBuffer(lock);
+    }
+  }
+  log_record.lsn_ = next_lsn_++;
+  if (offset_ == 0)
+    buffer_first_lsn_ = log_record.lsn_;
+  if (offset != nullptr)
+    *offset = buffer_start_ + offset_;
+  SerializeLogRecord(log_record, log_buffer_ + offset_);
+  offset_ += log_record.size_;
+
+  // 活跃事务表
+  txn_id_t txn_id = log_record.txn_id_;
+  if (txn_id != INVALID_TXN_ID)
+  {
+    if (log_record.log_record_type_ == LogRecordType::COMMIT ||
+        log_record.log_record_type_ == LogRecordType::ABORT)
+      active_txn_.erase(txn_id);
+    else if (active_txn_.count(txn_id) == 0)
+      active_txn_[txn_id] = std::make_pair(log_record.lsn_, log_record.lsn_);
+    else
+      active_txn_[txn_id].second = log_record.lsn_;
+  }
+  return log_record.lsn_;
+}
+
+/*
+ * Wait until persistent_lsn_ >= lsn. Callers arriving while a buffer is being
+ * written all wait for the following one, that is what makes it a group commit
+ */
+void LogManager::Flush(lsn_t lsn)
+{
+  std::unique_lock<std::mutex> lock(latch_);
+  // 不可能等到还没分配的 LSN
+  lsn = std::min(lsn, next_lsn_ - 1);
+  while (persistent_lsn_ < lsn)
+  {
+    if (flush_thread_ != nullptr)
+    {
+      flush_requested_ = true;
+      cv_.notify_one();
+      flushed_cv_.wait(lock);
+    }
+    else
+    {
+      FlushBuffer(lock);
+    }
+  }
+}
+
+/*
+ * Swap log_buffer_ and flush_buffer_, then write flush_buffer_ with latch_
+ * released so that appenders are not blocked by the disk. Only one buffer is
+ * written at a time. Called and returns with latch_ held
+ */
+void LogManager::FlushBuffer(std::unique_lock<std::mutex> &lock)
+{
+  flushed_cv_.wait(lock, [this] { return !flushing_; });
+  if (offset_ == 0)
+  {
+    flush_requested_ = false;
+    flushed_cv_.notify_all();
+    return;
+  }
+  flushing_ = true;
+  std::swap(log_buffer_, flush_buffer_);
+  int size = offset_;
+  lsn_t last_lsn = next_lsn_ - 1;
+  buffer_offsets_.emplace_back(buffer_first_lsn_, buffer_start_);
+  buffer_start_ += size;
+  buffer_first_lsn_ = INVALID_LSN;
+  offset_ = 0;
+  flush_requested_ = false;
+
+  lock.unlock();
+  disk_manager_->WriteLog(flush_buffer_, size);
+  lock.lock();
+
+  persistent_lsn_ = last_lsn;
+  flushing_ = false;
+  flushed_cv_.notify_all();
+}
+
+/*
+ * Records of one buffer are contiguous in the file, so the offset of the
+ * buffer holding lsn is a safe place to start reading from
+ */
+int LogManager::GetLogOffset(lsn_t lsn)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  if (lsn >= next_lsn_ || (offset_ > 0 && lsn >= buffer_first_lsn_))
+    return buffer_start_;
+  auto it = std::upper_bound(
+      buffer_offsets_.begin(), buffer_offsets_.end(), lsn,
+      [](lsn_t l, const std::pair<lsn_t, int> &b) { return l < b.first; });
+  // 比记得的都早（比如重启前写的）：只能从头开始
+  if (it == buffer_offsets_.begin())
+    return 0;
+  return std::prev(it)->second;
+}
+
+int LogManager::GetLogSize()
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  return buffer_start_ + offset_;
+}
+
+void LogManager::SetLogSize(int size)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  assert(offset_ == 0);
+  buffer_start_ = size;
+  buffer_offsets_.clear();
+}
+
+/*
+ * Keep the buffer that contains offset, drop everything before it
+ */
+void LogManager::TruncateLogOffsets(int offset)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  while (buffer_offsets_.size() > 1 && buffer_offsets_[1].second <= offset)
+    buffer_offsets_.pop_front();
+}
+
+void LogManager::GetActiveTxnTable(
+    std::vector<std::pair<txn_id_t, lsn_t>> &att, lsn_t &oldest_lsn)
+{
+  std::lock_guard<std::mutex> lck(latch_);
+  att.clear();
+  oldest_lsn = INVALID_LSN;
+  for (auto &txn : active_txn_)
+  {
+    att.emplace_back(txn.first, txn.second.second);
+    if (oldest_lsn == INVALID_LSN || txn.second.first < oldest_lsn)
+      oldest_lsn = txn.second.first;
+  }
+}
+
+/*
+ * Layout is described in log_record.h
+ */
+void LogManager::SerializeLogRecord(LogRecord &log_record, char *storage)
+{
+  memcpy(storage, &log_record.size_, sizeof(int32_t));
+  memcpy(storage + 4, &log_record.lsn_, sizeof(lsn_t));
+  memcpy(storage + 8, &log_record.txn_id_, sizeof(txn_id_t));
+  memcpy(storage + 12, &log_record.prev_lsn_, sizeof(lsn_t));
+  memcpy(storage + 16, &log_record.log_record_type_, sizeof(int32_t));
+  char *pos = storage + LogRecord::HEADER_SIZE;
+
+  switch (log_record.log_record_type_)
+  {
+  case LogRecordType::INSERT:
+    memcpy(pos, &log_record.insert_rid_, sizeof(RID));
+    log_record.insert_tuple_.SerializeTo(pos + sizeof(RID));
+    break;
+  case LogRecordType::MARKDELETE:
+  case LogRecordType::APPLYDELETE:
+  case LogRecordType::ROLLBACKDELETE:
+    memcpy(pos, &log_record.delete_rid_, sizeof(RID));
+    log_record.delete_tuple_.SerializeTo(pos + sizeof(RID));
+    break;
+  case LogRecordType::UPDATE:
+    memcpy(pos, &log_record.update_rid_, sizeof(RID));
+    pos += sizeof(RID);
+    log_record.old_tuple_.SerializeTo(pos);
+    pos += sizeof(int32_t) + log_record.old_tuple_.GetLength();
+    log_record.new_tuple_.SerializeTo(pos);
+    break;
+  case LogRecordType::NEWPAGE:
+    memcpy(pos, &log_record.prev_page_id_, sizeof(page_id_t));
+    break;
+  case LogRecordType::INDEX_INSERT:
+  case LogRecordType::INDEX_DELETE:
+  {
+    int32_t entry_size = log_record.index_data_.size();
+    memcpy(pos, &log_record.index_page_id_, sizeof(page_id_t));
+    memcpy(pos + 4, &log_record.index_array_offset_, sizeof(int32_t));
+    memcpy(pos + 8, &log_record.index_slot_, sizeof(int32_t));
+    memcpy(pos + 12, &entry_size, sizeof(int32_t));
+    memcpy(pos + 16, log_record.index_data_.data(), entry_size);
+    break;
+  }
+  case LogRecordType::INDEX_SPLIT:
+  case LogRecordType::INDEX_MERGE:
+  case LogRecordType::INDEX_REDISTRIBUTE:
+  {
+    int32_t array_count = log_record.index_arrays_.size();
+    memcpy(pos, &log_record.index_page_id_, sizeof(page_id_t));
+    memcpy(pos + 4, &log_record.index_array_offset_, sizeof(int32_t));
+    memcpy(pos + 8, &log_record.index_slot_, sizeof(int32_t));
+    memcpy(pos + 12, &log_record.index_remove_count_, sizeof(int32_t));
+    memcpy(pos + 16, &log_record.index_insert_count_, sizeof(int32_t));
+    memcpy(pos + 20, &array_count, sizeof(int32_t));
+    pos += 24;
+    for (auto &array : log_record.index_arrays_)
+    {
+      memcpy(pos, &array.first, sizeof(int32_t));
+      memcpy(pos + 4, &array.second, sizeof(int32_t));
+      pos += 8;
+    }
+    memcpy(pos, log_record.index_data_.data(), log_record.index_data_.size());
+    break;
+  }
+  case LogRecordType::INDEX_ROOT:
+  {
+    int32_t name_size = log_record.index_data_.size();
+    memcpy(pos, &log_record.index_page_id_, sizeof(page_id_t));
+    memcpy(pos + 4, &name_size, sizeof(int32_t));
+    memcpy(pos + 8, log_record.index_data_.data(), name_size);
+    break;
+  }
+  case LogRecordType::CHECKPOINT_END:
+  {
+    int32_t dpt_count = log_record.dirty_pages_.size();
+    int32_t att_count = log_record.active_txns_.size();
+    memcpy(pos, &log_record.checkpoint_begin_lsn_, sizeof(lsn_t));
+    memcpy(pos + 4, &log_record.checkpoint_scan_offset_, sizeof(int32_t));
+    memcpy(pos + 8, &dpt_count, sizeof(int32_t));
+    pos += 12;
+    for (auto &entry : log_record.dirty_pages_)
+    {
+      memcpy(pos, &entry.first, sizeof(page_id_t));
+      memcpy(pos + 4, &entry.second, sizeof(lsn_t));
+      pos += 8;
+    }
+    memcpy(pos, &att_count, sizeof(int32_t));
+    pos += 4;
+    for (auto &entry : log_record.active_txns_)
+    {
+      memcpy(pos, &entry.first, sizeof(txn_id_t));
+      memcpy(pos + 4, &entry.second, sizeof(lsn_t));
+      pos += 8;
+    }
+    break;
+  }
+  default:
+    // BEGIN/COMMIT/ABORT/CHECKPOINT_BEGIN only have the header
+    break;
+  }
+}
+
+} // namespace scudb
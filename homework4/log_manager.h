@@ -0,0 +1,117 @@
+/**
+ * log_manager.h
+ * log manager maintain a separate thread that is awaken when the log buffer is
+ * full or time out(every X second) to write log buffer's content into disk log
+ * file.
+ *
+ * Group commit: records are only ever written by the flush thread. While it
+ * writes one buffer, new records keep going into the other one, so every
+ * caller that asks for a flush during that write is served by the next single
+ * WriteLog call.
+ *
+ * For checkpoints it also keeps the active transaction table (first and last
+ * lsn of every transaction without COMMIT/ABORT yet) and, for every buffer
+ * written, where its first record landed in the log file, so that an lsn can
+ * be turned into a file offset to start recovery from.
+ */
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "disk/disk_manager.h"
+#include "logging/log_record.h"
+
+namespace scudb {
+
+class LogManager {
+public:
+  LogManager(DiskManager *disk_manager)
+      : next_lsn_(0), persistent_lsn_(INVALID_LSN), offset_(0),
+        flush_requested_(false), flushing_(false), buffer_start_(0),
+        buffer_first_lsn_(INVALID_LSN), flush_thread_(nullptr),
+        disk_manager_(disk_manager) {
+    log_buffer_ = new char[LOG_BUFFER_SIZE];
+    flush_buffer_ = new char[LOG_BUFFER_SIZE];
+  }
+
+  ~LogManager() {
+    StopFlushThread();
+    delete[] log_buffer_;
+    delete[] flush_buffer_;
+    log_buffer_ = nullptr;
+    flush_buffer_ = nullptr;
+  }
+  // spawn a separate thread to wake up periodically to flush
+  void RunFlushThread();
+  void StopFlushThread();
+
+  // append a log record into log buffer, offset (if given) receives the
+  // position of the record in the log file
+  lsn_t AppendLogRecord(LogRecord &log_record, int *offset = nullptr);
+
+  // block until every record up to lsn is on disk. Used both for commit and
+  // by the buffer pool before it writes back a page (WAL)
+  void Flush(lsn_t lsn);
+
+  // get/set helper functions
+  inline lsn_t GetPersistentLSN() { return persistent_lsn_; }
+  inline void SetPersistentLSN(lsn_t lsn) { persistent_lsn_ = lsn; }
+  inline lsn_t GetNextLSN() { return next_lsn_; }
+  inline void SetNextLSN(lsn_t lsn) { next_lsn_ = lsn; }
+  inline char *GetLogBuffer() { return log_buffer_; }
+
+  // checkpoint helpers
+  // log file offset at or before the record with this lsn, 0 if unknown
+  int GetLogOffset(lsn_t lsn);
+  // bytes appended so far (written or not), i.e. offset of the next record
+  int GetLogSize();
+  // after recovery: the log file already holds size bytes
+  void SetLogSize(int size);
+  // forget offsets of buffers that end before offset
+  void TruncateLogOffsets(int offset);
+  // snapshot of the active transaction table, txn_id -> last lsn.
+  // oldest_lsn receives the first lsn of the oldest of them
+  void GetActiveTxnTable(std::vector<std::pair<txn_id_t, lsn_t>> &att,
+                         lsn_t &oldest_lsn);
+
+private:
+  void FlushBuffer(std::unique_lock<std::mutex> &lock);
+  void SerializeLogRecord(LogRecord &log_record, char *storage);
+
+  // also used to hold the lsn of the last record appended
+  std::atomic<lsn_t> next_lsn_;
+  // log records before & include persistent_lsn_ have been written to disk
+  std::atomic<lsn_t> persistent_lsn_;
+  // log buffer related
+  char *log_buffer_;
+  char *flush_buffer_;
+  int offset_;                    // bytes used in log_buffer_
+  bool flush_requested_;          // somebody is waiting for the flush thread
+  bool flushing_;                 // flush_buffer_ is being written
+  int buffer_start_;              // log file offset of log_buffer_[0]
+  lsn_t buffer_first_lsn_;        // first lsn in log_buffer_
+  // (first lsn, log file offset) of every buffer handed to the disk
+  std::deque<std::pair<lsn_t, int>> buffer_offsets_;
+  // txn_id -> (first lsn, last lsn) for transactions still running
+  std::unordered_map<txn_id_t, std::pair<lsn_t, lsn_t>> active_txn_;
+  // latch to protect shared member variables
+  std::mutex latch_;
+  // flush thread
+  std::thread *flush_thread_;
+  // wakes the flush thread
+  std::condition_variable cv_;
+  // signaled every time a buffer has reached the disk
+  std::condition_variable flushed_cv_;
+  DiskManager *disk_manager_;
+};
+
+} // namespace scudb
@@ -0,0 +1,344 @@
+/**
+ * log_record.h
+ * For every write opeartion on table page, you should write ahead a
+ * corresponding log record.
+ * For EACH log record, HEADER is like (5 fields in common, 20 bytes in total)
+ *-------------------------------------------------------------
+ * | size | LSN | transID | prevLSN | LogType |
+ *-------------------------------------------------------------
+ * For insert type log record
+ *-------------------------------------------------------------
+ * | HEADER | tuple_rid | tuple_size | tuple_data(char[] array) |
+ *-------------------------------------------------------------
+ * For delete type(including markdelete, rollbackdelete, applydelete)
+ *-------------------------------------------------------------
+ * | HEADER | tuple_rid | tuple_size | tuple_data(char[] array) |
+ *-------------------------------------------------------------
+ * For update type log record
+ *------------------------------------------------------------------------------
+ * | HEADER | tuple_rid | tuple_size | old_tuple_data | tuple_size |
+ * | new_tuple_data |
+ *------------------------------------------------------------------------------
+ * For new page type log record
+ *-------------------------------------------------------------
+ * | HEADER | prev_page_id |
+ *-------------------------------------------------------------
+ *
+ * B+ tree index pages are logged physiologically: every record names one page
+ * and describes the change inside that page.
+ * For index insert/delete type (one entry of a leaf page)
+ *------------------------------------------------------------------------------
+ * | HEADER | page_id | array_offset | slot | entry_size | entry_data |
+ *------------------------------------------------------------------------------
+ * For index split/merge/redistribute type (one range of one page: remove_count
+ * entries at slot were replaced by the insert_count entries logged, and the
+ * page header, array_offset bytes, is as logged)
+ *------------------------------------------------------------------------------
+ * | HEADER | page_id | array_offset | slot | remove_count | insert_count |
+ * | array_count | (offset | entry_size) * array_count | header_data |
+ * | entry_data of every array |
+ *------------------------------------------------------------------------------
+ * Leaf pages have one array, internal pages two: the keys, then the child
+ * page ids. The parent page id of a child is not logged; recovery derives it
+ * from the child page ids of internal page records (and from INDEX_ROOT),
+ * as an INDEX_REPARENT record that only exists in memory.
+ * For index root type (record in the header page)
+ *-------------------------------------------------------------
+ * | HEADER | root_page_id | name_size | index_name |
+ *-------------------------------------------------------------
+ *
+ * Fuzzy checkpoint: CHECKPOINT_BEGIN only has the header, CHECKPOINT_END
+ * carries the tables taken after it (page_id/rec_lsn, txn_id/last_lsn pairs)
+ *------------------------------------------------------------------------------
+ * | HEADER | begin_lsn | scan_offset | dpt_count | dirty page table |
+ * | att_count | active transaction table |
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/config.h"
+#include "table/tuple.h"
+
+namespace scudb {
+// log record type
+enum class LogRecordType {
+  INVALID = 0,
+  INSERT,
+  MARKDELETE,
+  APPLYDELETE,
+  ROLLBACKDELETE,
+  UPDATE,
+  BEGIN,
+  COMMIT,
+  ABORT,
+  // when create a new page in heap table
+  NEWPAGE,
+  // B+ tree index
+  INDEX_INSERT,       // entry inserted into a leaf slot
+  INDEX_DELETE,       // entry removed from a leaf slot
+  INDEX_SPLIT,        // range of a page touched by a split
+  INDEX_MERGE,        // range of a page touched by a merge
+  INDEX_REDISTRIBUTE, // range of a page touched by a redistribute
+  INDEX_REPARENT,     // parent page id of a page, derived during recovery
+  INDEX_ROOT,         // root page id of an index changed
+  // fuzzy checkpoint
+  CHECKPOINT_BEGIN,
+  CHECKPOINT_END,
+};
+
+class LogRecord {
+  friend class LogManager;
+  friend class LogRecovery;
+
+public:
+  LogRecord()
+      : size_(0), lsn_(INVALID_LSN), txn_id_(INVALID_TXN_ID),
+        prev_lsn_(INVALID_LSN), log_record_type_(LogRecordType::INVALID) {}
+
+  // constructor for Transaction type(BEGIN/COMMIT/ABORT)
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type)
+      : size_(HEADER_SIZE), txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type) {}
+
+  // constructor for INSERT/DELETE type
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            const RID &rid, const Tuple &tuple)
+      : txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type) {
+    if (log_record_type == LogRecordType::INSERT) {
+      insert_rid_ = rid;
+      insert_tuple_ = tuple;
+    } else {
+      assert(log_record_type == LogRecordType::APPLYDELETE ||
+             log_record_type == LogRecordType::MARKDELETE ||
+             log_record_type == LogRecordType::ROLLBACKDELETE);
+      delete_rid_ = rid;
+      delete_tuple_ = tuple;
+    }
+    // calculate log record size
+    size_ = HEADER_SIZE + sizeof(RID) + sizeof(int32_t) + tuple.GetLength();
+  }
+
+  // constructor for UPDATE type
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            const RID &update_rid, const Tuple &old_tuple,
+            const Tuple &new_tuple)
+      : txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), update_rid_(update_rid),
+        old_tuple_(old_tuple), new_tuple_(new_tuple) {
+    // calculate log record size
+    size_ = HEADER_SIZE + sizeof(RID) + old_tuple.GetLength() +
+            new_tuple.GetLength() + 2 * sizeof(int32_t);
+  }
+
+  // constructor for NEWPAGE type
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            page_id_t page_id)
+      : size_(HEADER_SIZE), txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), prev_page_id_(page_id) {
+    // calculate log record size
+    size_ = HEADER_SIZE + sizeof(page_id_t);
+  }
+
+  // constructor for INDEX_INSERT/INDEX_DELETE type
+  // entry points into the leaf page and is copied right away
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            page_id_t page_id, int32_t array_offset, int32_t slot,
+            const char *entry, int32_t entry_size)
+      : txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), index_page_id_(page_id),
+        index_array_offset_(array_offset), index_slot_(slot),
+        index_data_(entry, entry + entry_size) {
+    assert(log_record_type == LogRecordType::INDEX_INSERT ||
+           log_record_type == LogRecordType::INDEX_DELETE);
+    size_ = HEADER_SIZE + sizeof(page_id_t) + 3 * sizeof(int32_t) + entry_size;
+  }
+
+  // constructor for INDEX_SPLIT/INDEX_MERGE/INDEX_REDISTRIBUTE type
+  // page_data is the page after the change, its header (array_offset bytes)
+  // and entries [slot, slot + insert_count) of every array are copied
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            page_id_t page_id, const char *page_data, int32_t array_offset,
+            int32_t slot, int32_t remove_count, int32_t insert_count,
+            const std::vector<std::pair<int32_t, int32_t>> &arrays)
+      : txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), index_page_id_(page_id),
+        index_array_offset_(array_offset), index_slot_(slot),
+        index_remove_count_(remove_count), index_insert_count_(insert_count),
+        index_arrays_(arrays), index_data_(page_data, page_data + array_offset) {
+    assert(log_record_type == LogRecordType::INDEX_SPLIT ||
+           log_record_type == LogRecordType::INDEX_MERGE ||
+           log_record_type == LogRecordType::INDEX_REDISTRIBUTE);
+    for (auto &array : arrays) {
+      const char *entries = page_data + array.first + slot * array.second;
+      index_data_.insert(index_data_.end(), entries,
+                         entries + insert_count * array.second);
+    }
+    size_ = HEADER_SIZE + sizeof(page_id_t) + 5 * sizeof(int32_t) +
+            arrays.size() * 2 * sizeof(int32_t) + index_data_.size();
+  }
+
+  // constructor for INDEX_REPARENT type, built by recovery only
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            page_id_t page_id, page_id_t parent_page_id)
+      : size_(HEADER_SIZE + 2 * sizeof(page_id_t)), txn_id_(txn_id),
+        prev_lsn_(prev_lsn), log_record_type_(log_record_type),
+        index_page_id_(page_id), index_parent_page_id_(parent_page_id) {
+    assert(log_record_type == LogRecordType::INDEX_REPARENT);
+  }
+
+  // constructor for INDEX_ROOT type
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            const std::string &index_name, page_id_t root_page_id)
+      : size_(HEADER_SIZE + sizeof(page_id_t) + sizeof(int32_t) +
+              index_name.size()),
+        txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), index_page_id_(root_page_id),
+        index_data_(index_name.begin(), index_name.end()) {
+    assert(log_record_type == LogRecordType::INDEX_ROOT);
+  }
+
+  // constructor for CHECKPOINT_END type
+  // scan_offset: log file offset recovery has to start reading from
+  LogRecord(txn_id_t txn_id, lsn_t prev_lsn, LogRecordType log_record_type,
+            lsn_t begin_lsn, int32_t scan_offset,
+            const std::vector<std::pair<page_id_t, lsn_t>> &dirty_pages,
+            const std::vector<std::pair<txn_id_t, lsn_t>> &active_txns)
+      : size_(HEADER_SIZE + sizeof(lsn_t) + 3 * sizeof(int32_t) +
+              dirty_pages.size() * (sizeof(page_id_t) + sizeof(lsn_t)) +
+              active_txns.size() * (sizeof(txn_id_t) + sizeof(lsn_t))),
+        txn_id_(txn_id), prev_lsn_(prev_lsn),
+        log_record_type_(log_record_type), checkpoint_begin_lsn_(begin_lsn),
+        checkpoint_scan_offset_(scan_offset), dirty_pages_(dirty_pages),
+        active_txns_(active_txns) {
+    assert(log_record_type == LogRecordType::CHECKPOINT_END);
+  }
+
+  ~LogRecord() {}
+
+  inline RID &GetDeleteRID() { return delete_rid_; }
+
+  inline Tuple &GetInserteTuple() { return insert_tuple_; }
+
+  inline RID &GetInsertRID() { return insert_rid_; }
+
+  inline page_id_t GetNewPageRecord() { return prev_page_id_; }
+
+  // index page the record applies to (root page id for INDEX_ROOT)
+  inline page_id_t GetIndexPageId() { return index_page_id_; }
+
+  inline page_id_t GetIndexParentPageId() { return index_parent_page_id_; }
+
+  inline int32_t GetIndexArrayOffset() { return index_array_offset_; }
+
+  inline int32_t GetIndexSlot() { return index_slot_; }
+
+  inline int32_t GetIndexRemoveCount() { return index_remove_count_; }
+
+  inline int32_t GetIndexInsertCount() { return index_insert_count_; }
+
+  // (offset, entry_size) of the arrays of a split/merge/redistribute record
+  inline const std::vector<std::pair<int32_t, int32_t>> &GetIndexArrays() {
+    return index_arrays_;
+  }
+
+  // entry bytes for INDEX_INSERT/INDEX_DELETE, name for INDEX_ROOT, header
+  // then entries for INDEX_SPLIT/INDEX_MERGE/INDEX_REDISTRIBUTE
+  inline const std::vector<char> &GetIndexData() { return index_data_; }
+
+  // CHECKPOINT_END fields
+  inline lsn_t GetCheckpointBeginLSN() { return checkpoint_begin_lsn_; }
+
+  inline int32_t GetCheckpointScanOffset() { return checkpoint_scan_offset_; }
+
+  inline const std::vector<std::pair<page_id_t, lsn_t>> &GetDirtyPages() {
+    return dirty_pages_;
+  }
+
+  inline const std::vector<std::pair<txn_id_t, lsn_t>> &GetActiveTxns() {
+    return active_txns_;
+  }
+
+  inline int32_t GetSize() { return size_; }
+
+  inline lsn_t GetLSN() { return lsn_; }
+
+  inline txn_id_t GetTxnId() { return txn_id_; }
+
+  inline lsn_t GetPrevLSN() { return prev_lsn_; }
+
+  inline LogRecordType &GetLogRecordType() { return log_record_type_; }
+
+  // true for the physiological B+ tree page records
+  inline bool IsIndexRecord() const {
+    return log_record_type_ >= LogRecordType::INDEX_INSERT &&
+           log_record_type_ <= LogRecordType::INDEX_ROOT;
+  }
+
+  // For debug purpose
+  inline std::string ToString() const {
+    std::ostringstream os;
+    os << "Log["
+       << "size:" << size_ << ", "
+       << "LSN:" << lsn_ << ", "
+       << "transID:" << txn_id_ << ", "
+       << "prevLSN:" << prev_lsn_ << ", "
+       << "LogType:" << (int)log_record_type_;
+    if (IsIndexRecord())
+      os << ", pageID:" << index_page_id_;
+    os << "]";
+
+    return os.str();
+  }
+
+private:
+  // the length of log record(for serialization, in bytes)
+  int32_t size_ = 0;
+  // must have fields
+  lsn_t lsn_ = INVALID_LSN;
+  txn_id_t txn_id_ = INVALID_TXN_ID;
+  lsn_t prev_lsn_ = INVALID_LSN;
+  LogRecordType log_record_type_ = LogRecordType::INVALID;
+
+  // case1: for delete opeartion, delete_tuple_ for UNDO opeartion
+  RID delete_rid_;
+  Tuple delete_tuple_;
+
+  // case2: for insert opeartion
+  RID insert_rid_;
+  Tuple insert_tuple_;
+
+  // case3: for update opeartion
+  RID update_rid_;
+  Tuple old_tuple_;
+  Tuple new_tuple_;
+
+  // case4: for new page opeartion
+  page_id_t prev_page_id_ = INVALID_PAGE_ID;
+
+  // case5: for B+ tree index page opeartion
+  page_id_t index_page_id_ = INVALID_PAGE_ID;
+  page_id_t index_parent_page_id_ = INVALID_PAGE_ID;
+  int32_t index_array_offset_ = 0;
+  int32_t index_slot_ = 0;
+  int32_t index_remove_count_ = 0;
+  int32_t index_insert_count_ = 0;
+  std::vector<std::pair<int32_t, int32_t>> index_arrays_;
+  std::vector<char> index_data_;
+
+  // case6: for checkpoint end
+  lsn_t checkpoint_begin_lsn_ = INVALID_LSN;
+  int32_t checkpoint_scan_offset_ = 0;
+  std::vector<std::pair<page_id_t, lsn_t>> dirty_pages_;
+  std::vector<std::pair<txn_id_t, lsn_t>> active_txns_;
+
+  const static int HEADER_SIZE = 20;
+};
+
+} // namespace scudb
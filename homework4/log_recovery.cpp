@@ -0,0 +1,517 @@
+/**
+ * log_recovery.cpp
+ */
+
+#include "buffer/parallel.h"
+#include "common/exception.h"
+#include "logging/checkpoint_manager.h"
+#include "logging/log_recovery.h"
+#include "page/b_plus_tree_page.h"
+#include "page/header_page.h"
+
+namespace scudb {
+/*
+ * deserialize a log record from log buffer
+ * @return: true means deserialize succeed, otherwise can't deserialize cause
+ * incomplete log record
+ */
+bool LogRecovery::DeserializeLogRecord(const char *data,
+                                       LogRecord &log_record)
+{
+  int32_t size;
+  memcpy(&size, data, sizeof(int32_t));
+  // 日志文件尾部是补零的，读到 0 就结束了
+  if (size < LogRecord::HEADER_SIZE || size > LOG_BUFFER_SIZE)
+    return false;
+  LogRecordType type;
+  memcpy(&type, data + 16, sizeof(int32_t));
+  if (type <= LogRecordType::INVALID || type > LogRecordType::CHECKPOINT_END)
+    return false;
+
+  log_record = LogRecord();
+  log_record.size_ = size;
+  memcpy(&log_record.lsn_, data + 4, sizeof(lsn_t));
+  memcpy(&log_record.txn_id_, data + 8, sizeof(txn_id_t));
+  memcpy(&log_record.prev_lsn_, data + 12, sizeof(lsn_t));
+  log_record.log_record_type_ = type;
+  const char *pos = data + LogRecord::HEADER_SIZE;
+
+  switch (type)
+  {
+  case LogRecordType::INSERT:
+    memcpy(&log_record.insert_rid_, pos, sizeof(RID));
+    log_record.insert_tuple_.DeserializeFrom(pos + sizeof(RID));
+    break;
+  case LogRecordType::MARKDELETE:
+  case LogRecordType::APPLYDELETE:
+  case LogRecordType::ROLLBACKDELETE:
+    memcpy(&log_record.delete_rid_, pos, sizeof(RID));
+    log_record.delete_tuple_.DeserializeFrom(pos + sizeof(RID));
+    break;
+  case LogRecordType::UPDATE:
+    memcpy(&log_record.update_rid_, pos, sizeof(RID));
+    pos += sizeof(RID);
+    log_record.old_tuple_.DeserializeFrom(pos);
+    pos += sizeof(int32_t) + log_record.old_tuple_.GetLength();
+    log_record.new_tuple_.DeserializeFrom(pos);
+    break;
+  case LogRecordType::NEWPAGE:
+    memcpy(&log_record.prev_page_id_, pos, sizeof(page_id_t));
+    break;
+  case LogRecordType::INDEX_INSERT:
+  case LogRecordType::INDEX_DELETE:
+  {
+    int32_t entry_size;
+    memcpy(&log_record.index_page_id_, pos, sizeof(page_id_t));
+    memcpy(&log_record.index_array_offset_, pos + 4, sizeof(int32_t));
+    memcpy(&log_record.index_slot_, pos + 8, sizeof(int32_t));
+    memcpy(&entry_size, pos + 12, sizeof(int32_t));
+    if (entry_size < 0 || LogRecord::HEADER_SIZE + 16 + entry_size != size)
+      return false;
+    log_record.index_data_.assign(pos + 16, pos + 16 + entry_size);
+    break;
+  }
+  case LogRecordType::INDEX_SPLIT:
+  case LogRecordType::INDEX_MERGE:
+  case LogRecordType::INDEX_REDISTRIBUTE:
+  {
+    int32_t array_count;
+    memcpy(&log_record.index_page_id_, pos, sizeof(page_id_t));
+    memcpy(&log_record.index_array_offset_, pos + 4, sizeof(int32_t));
+    memcpy(&log_record.index_slot_, pos + 8, sizeof(int32_t));
+    memcpy(&log_record.index_remove_count_, pos + 12, sizeof(int32_t));
+    memcpy(&log_record.index_insert_count_, pos + 16, sizeof(int32_t));
+    memcpy(&array_count, pos + 20, sizeof(int32_t));
+    pos += 24;
+    if (array_count < 0 || pos + array_count * 8 > data + size)
+      return false;
+    int32_t data_size = log_record.index_array_offset_;
+    for (int i = 0; i < array_count; ++i, pos += 8)
+    {
+      int32_t offset, entry_size;
+      memcpy(&offset, pos, sizeof(int32_t));
+      memcpy(&entry_size, pos + 4, sizeof(int32_t));
+      log_record.index_arrays_.emplace_back(offset, entry_size);
+      data_size += log_record.index_insert_count_ * entry_size;
+    }
+    if (data_size < 0 || pos + data_size != data + size)
+      return false;
+    log_record.index_data_.assign(pos, pos + data_size);
+    break;
+  }
+  case LogRecordType::INDEX_ROOT:
+  {
+    int32_t name_size;
+    memcpy(&log_record.index_page_id_, pos, sizeof(page_id_t));
+    memcpy(&name_size, pos + 4, sizeof(int32_t));
+    if (name_size < 0 || LogRecord::HEADER_SIZE + 8 + name_size != size)
+      return false;
+    log_record.index_data_.assign(pos + 8, pos + 8 + name_size);
+    break;
+  }
+  case LogRecordType::CHECKPOINT_END:
+  {
+    int32_t count;
+    memcpy(&log_record.checkpoint_begin_lsn_, pos, sizeof(lsn_t));
+    memcpy(&log_record.checkpoint_scan_offset_, pos + 4, sizeof(int32_t));
+    memcpy(&count, pos + 8, sizeof(int32_t));
+    pos += 12;
+    if (count < 0 || pos + count * 8 + 4 > data + size)
+      return false;
+    for (int i = 0; i < count; ++i, pos += 8)
+    {
+      page_id_t page_id;
+      lsn_t rec_lsn;
+      memcpy(&page_id, pos, sizeof(page_id_t));
+      memcpy(&rec_lsn, pos + 4, sizeof(lsn_t));
+      log_record.dirty_pages_.emplace_back(page_id, rec_lsn);
+    }
+    memcpy(&count, pos, sizeof(int32_t));
+    pos += 4;
+    if (count < 0 || pos + count * 8 != data + size)
+      return false;
+    for (int i = 0; i < count; ++i, pos += 8)
+    {
+      txn_id_t txn_id;
+      lsn_t last_lsn;
+      memcpy(&txn_id, pos, sizeof(txn_id_t));
+      memcpy(&last_lsn, pos + 4, sizeof(lsn_t));
+      log_record.active_txns_.emplace_back(txn_id, last_lsn);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return true;
+}
+
+/*
+ * Find the last complete checkpoint through the master record in the header
+ * page: it gives the offset to start reading at, the dirty page table and
+ * the transactions that were running
+ */
+bool LogRecovery::ReadCheckpoint(LogRecord &checkpoint)
+{
+  Page *page = buffer_pool_manager_->FetchPage(HEADER_PAGE_ID);
+  if (page == nullptr)
+    throw Exception(EXCEPTION_TYPE_INDEX,
+                    "all page are pinned while recovering");
+  page_id_t end_offset;
+  bool found = reinterpret_cast<HeaderPage *>(page)->GetRootId(
+      CHECKPOINT_RECORD_NAME, end_offset);
+  buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, false);
+  if (!found ||
+      !disk_manager_->ReadLog(log_buffer_, LOG_BUFFER_SIZE, end_offset) ||
+      !DeserializeLogRecord(log_buffer_, checkpoint))
+    return false;
+  return checkpoint.log_record_type_ == LogRecordType::CHECKPOINT_END;
+}
+
+/*
+ * Scan the log from the last checkpoint (or the beginning). Every complete
+ * record is mapped to its file offset (for undo), the last lsn of every
+ * unfinished transaction is kept in active_txn_, and index records that may
+ * be missing from their page are bucketed by page id, together with the
+ * parent changes derived from them (see DeriveReparents)
+ * Heap table records are not replayed here, the table pages are not part of
+ * this tree
+ */
+void LogRecovery::Analysis(std::vector<std::vector<LogRecord>> &partitions)
+{
+  int num_partitions = partitions.size();
+  int file_offset = 0;
+  active_txn_.clear();
+  lsn_mapping_.clear();
+  max_lsn_ = INVALID_LSN;
+
+  // 检查点之前已经落盘的页不用再看
+  LogRecord checkpoint;
+  bool has_checkpoint = ReadCheckpoint(checkpoint);
+  lsn_t begin_lsn = INVALID_LSN;
+  std::unordered_map<page_id_t, lsn_t> dirty_pages;
+  if (has_checkpoint)
+  {
+    file_offset = checkpoint.checkpoint_scan_offset_;
+    begin_lsn = checkpoint.checkpoint_begin_lsn_;
+    for (auto &entry : checkpoint.dirty_pages_)
+      dirty_pages[entry.first] = entry.second;
+    for (auto &entry : checkpoint.active_txns_)
+      active_txn_[entry.first] = entry.second;
+  }
+
+  while (disk_manager_->ReadLog(log_buffer_, LOG_BUFFER_SIZE, file_offset))
+  {
+    int pos = 0;
+    while (pos + LogRecord::HEADER_SIZE <= LOG_BUFFER_SIZE)
+    {
+      int32_t size;
+      memcpy(&size, log_buffer_ + pos, sizeof(int32_t));
+      // 记录跨越了缓冲区末尾，从它开头重新读
+      if (size > LOG_BUFFER_SIZE - pos)
+        break;
+      LogRecord log_record;
+      if (!DeserializeLogRecord(log_buffer_ + pos, log_record))
+        break;
+
+      lsn_t lsn = log_record.lsn_;
+      lsn_mapping_[lsn] = file_offset + pos;
+      max_lsn_ = std::max(max_lsn_, lsn);
+      if (log_record.txn_id_ != INVALID_TXN_ID)
+      {
+        if (log_record.log_record_type_ == LogRecordType::COMMIT ||
+            log_record.log_record_type_ == LogRecordType::ABORT)
+          active_txn_.erase(log_record.txn_id_);
+        else if (!active_txn_.count(log_record.txn_id_) ||
+                 active_txn_[log_record.txn_id_] < lsn)
+          active_txn_[log_record.txn_id_] = lsn;
+      }
+      if (log_record.IsIndexRecord())
+      {
+        std::vector<LogRecord> records;
+        DeriveReparents(log_record, records);
+        records.push_back(std::move(log_record));
+        for (auto &record : records)
+        {
+          // 根记录都写在 header page 上，放进同一个桶保持顺序
+          page_id_t page_id =
+              record.log_record_type_ == LogRecordType::INDEX_ROOT
+                  ? HEADER_PAGE_ID
+                  : record.index_page_id_;
+          // 检查点时页是干净的，或者这条早于它变脏：已经在磁盘上了
+          bool on_disk = false;
+          if (has_checkpoint && lsn < begin_lsn)
+          {
+            auto it = dirty_pages.find(page_id);
+            on_disk = it == dirty_pages.end() || lsn < it->second;
+          }
+          if (!on_disk)
+            partitions[page_id % num_partitions].push_back(std::move(record));
+        }
+      }
+      pos += size;
+    }
+    // 一条完整的记录都没有：日志结束
+    if (pos == 0)
+      break;
+    file_offset += pos;
+  }
+  offset_ = file_offset;
+}
+
+/*
+ * The parent page id of a child is not logged: a child listed in an internal
+ * page record now belongs to that page, and a new root has no parent. The
+ * tree sets the child's page LSN to at least the record's before the child
+ * can be written back, so the derived record carries the same LSN and is
+ * skipped like any other when the child already has it
+ */
+void LogRecovery::DeriveReparents(LogRecord &log_record,
+                                  std::vector<LogRecord> &derived)
+{
+  auto reparent = [&log_record, &derived](page_id_t page_id,
+                                          page_id_t parent_page_id) {
+    derived.emplace_back(INVALID_TXN_ID, INVALID_LSN,
+                         LogRecordType::INDEX_REPARENT, page_id,
+                         parent_page_id);
+    derived.back().lsn_ = log_record.lsn_;
+  };
+  switch (log_record.log_record_type_)
+  {
+  case LogRecordType::INDEX_ROOT:
+    if (log_record.index_page_id_ != INVALID_PAGE_ID)
+      reparent(log_record.index_page_id_, INVALID_PAGE_ID);
+    break;
+  case LogRecordType::INDEX_SPLIT:
+  case LogRecordType::INDEX_MERGE:
+  case LogRecordType::INDEX_REDISTRIBUTE:
+  {
+    const char *data = log_record.index_data_.data();
+    auto &arrays = log_record.index_arrays_;
+    if (reinterpret_cast<const BPlusTreePage *>(data)->IsLeafPage() ||
+        arrays.size() != 2)
+      break;
+    // 内部页先记 key 再记孩子
+    const char *children = data + log_record.index_array_offset_ +
+                           log_record.index_insert_count_ * arrays[0].second;
+    for (int i = 0; i < log_record.index_insert_count_; ++i)
+    {
+      page_id_t child;
+      memcpy(&child, children + i * sizeof(page_id_t), sizeof(page_id_t));
+      reparent(child, log_record.index_page_id_);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/*
+ * Redo one index record unless the page already has it. Each page is only
+ * ever touched by one worker, the latch is for anybody else holding the pool
+ */
+void LogRecovery::RedoIndexRecord(LogRecord &log_record)
+{
+  if (log_record.log_record_type_ == LogRecordType::INDEX_ROOT)
+  {
+    // header page 没有 LSN，插入或更新本身是幂等的
+    Page *page = buffer_pool_manager_->FetchPage(HEADER_PAGE_ID);
+    if (page == nullptr)
+      throw Exception(EXCEPTION_TYPE_INDEX,
+                      "all page are pinned while recovering");
+    page->WLatch();
+    auto *header_page = reinterpret_cast<HeaderPage *>(page);
+    std::string name(log_record.index_data_.begin(),
+                     log_record.index_data_.end());
+    if (!header_page->UpdateRecord(name, log_record.index_page_id_))
+      header_page->InsertRecord(name, log_record.index_page_id_);
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(HEADER_PAGE_ID, true);
+    return;
+  }
+
+  page_id_t page_id = log_record.index_page_id_;
+  Page *page = buffer_pool_manager_->FetchPage(page_id);
+  if (page == nullptr)
+    throw Exception(EXCEPTION_TYPE_INDEX,
+                    "all page are pinned while recovering");
+  page->WLatch();
+  char *data = page->GetData();
+  auto *node = reinterpret_cast<BPlusTreePage *>(data);
+  // 从没写回过的页读出来全是 0，它的 LSN 没有意义
+  bool formatted = node->GetPageId() == page_id;
+  // 推出来的父指针只改有内容的页，还没写出过的页由它自己前面的记录建出来
+  if ((formatted && node->GetLSN() >= log_record.lsn_) ||
+      (!formatted &&
+       log_record.log_record_type_ == LogRecordType::INDEX_REPARENT))
+  {
+    page->WUnlatch();
+    buffer_pool_manager_->UnpinPage(page_id, false);
+    return;
+  }
+
+  switch (log_record.log_record_type_)
+  {
+  case LogRecordType::INDEX_INSERT:
+  case LogRecordType::INDEX_DELETE:
+  {
+    int entry_size = log_record.index_data_.size();
+    int size = node->GetSize();
+    int slot = log_record.index_slot_;
+    char *entry = data + log_record.index_array_offset_ + slot * entry_size;
+    if (log_record.log_record_type_ == LogRecordType::INDEX_INSERT)
+    {
+      assert(formatted && slot <= size);
+      memmove(entry + entry_size, entry, (size - slot) * entry_size);
+      memcpy(entry, log_record.index_data_.data(), entry_size);
+      node->IncreaseSize(1);
+    }
+    else
+    {
+      assert(formatted && slot < size);
+      memmove(entry, entry + entry_size, (size - slot - 1) * entry_size);
+      node->IncreaseSize(-1);
+    }
+    break;
+  }
+  case LogRecordType::INDEX_SPLIT:
+  case LogRecordType::INDEX_MERGE:
+  case LogRecordType::INDEX_REDISTRIBUTE:
+  {
+    // 旧 size 由记录里的新页头倒推，不看页上的：新页原来是什么都不用管
+    const char *header = log_record.index_data_.data();
+    const char *entries = header + log_record.index_array_offset_;
+    int slot = log_record.index_slot_;
+    int remove_count = log_record.index_remove_count_;
+    int insert_count = log_record.index_insert_count_;
+    int size = reinterpret_cast<const BPlusTreePage *>(header)->GetSize() -
+               insert_count + remove_count;
+    assert(slot + remove_count <= size);
+    for (auto &array : log_record.index_arrays_)
+    {
+      char *base = data + array.first;
+      int entry_size = array.second;
+      memmove(base + (slot + insert_count) * entry_size,
+              base + (slot + remove_count) * entry_size,
+              (size - slot - remove_count) * entry_size);
+      memcpy(base + slot * entry_size, entries, insert_count * entry_size);
+      entries += insert_count * entry_size;
+    }
+    memcpy(data, header, log_record.index_array_offset_);
+    break;
+  }
+  case LogRecordType::INDEX_REPARENT:
+    node->SetParentPageId(log_record.index_parent_page_id_);
+    break;
+  default:
+    assert(false);
+  }
+  node->SetLSN(log_record.lsn_);
+  page->WUnlatch();
+  buffer_pool_manager_->UnpinPage(page_id, true);
+}
+
+/*
+ * redo phase on TABLE PAGE level(table/table_page.h)
+ * read log file from the beginning to end (you must prefetch log records into
+ * log buffer to reduce unnecessary I/O operations), remember to compare page's
+ * LSN with log_record's sequence number, and also build active_txn_ table &
+ * lsn_mapping_ table
+ *
+ * Index records are replayed by num_threads workers, worker i owns the pages
+ * with page_id % num_threads == i. The buffer pool must be able to pin one
+ * page per worker
+ */
+void LogRecovery::Redo(int num_threads)
+{
+  num_threads = std::max(num_threads, 1);
+  std::vector<std::vector<LogRecord>> partitions(num_threads);
+  Analysis(partitions);
+
+  RunInParallel(num_threads, [this, &partitions](int i) {
+    for (auto &log_record : partitions[i])
+      RedoIndexRecord(log_record);
+  });
+
+  // 新的日志接在已有日志后面
+  if (log_manager_ != nullptr)
+  {
+    log_manager_->SetNextLSN(max_lsn_ + 1);
+    log_manager_->SetPersistentLSN(max_lsn_);
+    log_manager_->SetLogSize(offset_);
+  }
+}
+
+/*
+ * undo phase on TABLE PAGE level(table/table_page.h)
+ * iterate through active txn map and undo each operation
+ *
+ * Losers are rolled back together, always the largest lsn first. Structure
+ * modification records are redo only: a split or merge that reached the log
+ * stays, only the entries the loser put in or took out are reverted, by
+ * undo_index. Those compensations are logged as system changes (they are
+ * idempotent, so a crash in the middle of undo just runs them again), then
+ * every loser gets an ABORT record
+ */
+void LogRecovery::Undo(const std::function<void(LogRecord &)> &undo_index)
+{
+  std::unordered_map<txn_id_t, lsn_t> to_undo = active_txn_;
+  if (log_manager_ != nullptr)
+    ENABLE_LOGGING = true;
+
+  while (!to_undo.empty())
+  {
+    auto next = std::max_element(
+        to_undo.begin(), to_undo.end(),
+        [](const std::pair<const txn_id_t, lsn_t> &a,
+           const std::pair<const txn_id_t, lsn_t> &b) {
+          return a.second < b.second;
+        });
+    LogRecord log_record;
+    if (!ReadLogRecord(next->second, log_record))
+    {
+      // 链断了（日志被截断），这个事务没有更早的记录了
+      to_undo.erase(next);
+      continue;
+    }
+    if ((log_record.log_record_type_ == LogRecordType::INDEX_INSERT ||
+         log_record.log_record_type_ == LogRecordType::INDEX_DELETE) &&
+        undo_index)
+      undo_index(log_record);
+    if (log_record.prev_lsn_ == INVALID_LSN)
+      to_undo.erase(next);
+    else
+      next->second = log_record.prev_lsn_;
+  }
+
+  if (log_manager_ != nullptr)
+  {
+    lsn_t last_lsn = INVALID_LSN;
+    for (auto &txn : active_txn_)
+    {
+      LogRecord log_record(txn.first, txn.second, LogRecordType::ABORT);
+      last_lsn = log_manager_->AppendLogRecord(log_record);
+    }
+    if (last_lsn != INVALID_LSN)
+      log_manager_->Flush(last_lsn);
+    ENABLE_LOGGING = false;
+  }
+  active_txn_.clear();
+  lsn_mapping_.clear();
+}
+
+/*
+ * re-read one record through lsn_mapping_
+ */
+bool LogRecovery::ReadLogRecord(lsn_t lsn, LogRecord &log_record)
+{
+  auto it = lsn_mapping_.find(lsn);
+  if (it == lsn_mapping_.end())
+    return false;
+  if (!disk_manager_->ReadLog(log_buffer_, LOG_BUFFER_SIZE, it->second))
+    return false;
+  return DeserializeLogRecord(log_buffer_, log_record);
+}
+
+} // namespace scudb
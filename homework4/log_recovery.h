@@ -0,0 +1,82 @@
+/**
+ * log_recovery.h
+ * Read log file from disk, redo and undo.
+ *
+ * ARIES style restart for the B+ tree index pages:
+ * (1) analysis: scan the log once from the last checkpoint, find the
+ *     transactions that never committed (losers) and bucket every index
+ *     record by its page, leaving out those the checkpoint's dirty page
+ *     table shows are already on disk. Parent page ids are not logged, the
+ *     records that set them are derived here from the structure records
+ * (2) redo: repeat history. Buckets are spread over worker threads by page
+ *     id, so two workers never touch the same page and each page still sees
+ *     its records in LSN order. A record is skipped when the page LSN shows
+ *     it is already on the page
+ * (3) undo: roll back the losers in reverse LSN order. Leaf entries can move
+ *     to another page after the change (split, merge), so they are undone
+ *     logically by the index, which logs the compensation like any other
+ *     change. An ABORT record then closes every loser
+ */
+
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer/buffer_pool_manager.h"
+#include "logging/log_record.h"
+
+namespace scudb {
+
+class LogRecovery {
+public:
+  LogRecovery(DiskManager *disk_manager,
+              BufferPoolManager *buffer_pool_manager,
+              LogManager *log_manager = nullptr)
+      : disk_manager_(disk_manager), buffer_pool_manager_(buffer_pool_manager),
+        log_manager_(log_manager), offset_(0), max_lsn_(INVALID_LSN) {
+    // global variable
+    ENABLE_LOGGING = false;
+    log_buffer_ = new char[LOG_BUFFER_SIZE];
+  }
+
+  ~LogRecovery() {
+    delete[] log_buffer_;
+    log_buffer_ = nullptr;
+  }
+
+  // analysis + redo, num_threads workers replay the index pages
+  void Redo(int num_threads = 1);
+  // undo_index(log_record) rolls back one INDEX_INSERT/INDEX_DELETE entry
+  void Undo(const std::function<void(LogRecord &)> &undo_index = nullptr);
+
+  // false if data does not hold a complete record (end of log)
+  bool DeserializeLogRecord(const char *data, LogRecord &log_record);
+
+private:
+  bool ReadCheckpoint(LogRecord &checkpoint);
+  void Analysis(std::vector<std::vector<LogRecord>> &partitions);
+  void DeriveReparents(LogRecord &log_record,
+                       std::vector<LogRecord> &derived);
+  void RedoIndexRecord(LogRecord &log_record);
+  bool ReadLogRecord(lsn_t lsn, LogRecord &log_record);
+
+  DiskManager *disk_manager_;
+  BufferPoolManager *buffer_pool_manager_;
+  // needed by Undo() to log compensations and ABORT records
+  LogManager *log_manager_;
+
+  // maintain active transactions and its correspoinding latest lsn
+  std::unordered_map<txn_id_t, lsn_t> active_txn_;
+  // mapping log sequence number to log file offset, for undo purpose
+  std::unordered_map<lsn_t, int> lsn_mapping_;
+
+  // log buffer related
+  int offset_;     // log file offset right after the last complete record
+  lsn_t max_lsn_;  // last lsn in the log
+  char *log_buffer_;
+};
+
+} // namespace scudb